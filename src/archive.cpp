@@ -0,0 +1,182 @@
+//
+//  archive.cpp - tar archive of MP3 streams written by many workers
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "archive.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+namespace {
+
+    static const size_t BLOCK_SIZE = 512;
+
+    // Lengths of name fields of ustar header
+    static const size_t NAME_LENGTH = 100;
+    static const size_t PREFIX_LENGTH = 155;
+
+    static const uint64_t NANOSECONDS = 1000000000;
+
+    static const char* WRITE_ERROR = "Failed to write archive";
+
+    // Stores number as zero padded octal with terminating NUL
+    void putOctal(unsigned char* field, size_t length, uint64_t value) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%0*llo", static_cast<int>(length - 1),
+            static_cast<unsigned long long>(value));
+        memcpy(field, buf, length);
+    }
+
+    // Appends zeros up to the end of the block
+    void pad(std::vector<unsigned char>& out) {
+        out.resize((out.size() + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE);
+    }
+
+    // Appends header block of a member. Names that do not fit ustar
+    // fields are stored in extended header ('x') as 'path' record.
+    void appendHeader(
+        std::vector<unsigned char>& out,
+        const std::string& name,
+        uint64_t size,
+        int64_t mtime,
+        char type) {
+        std::string shortName(name);
+        std::string prefix;
+        if (name.size() > NAME_LENGTH) {
+            // Split at a slash into prefix and name if possible
+            std::string::size_type slash = name.rfind('/', PREFIX_LENGTH);
+            if (slash != std::string::npos && name.size() - slash - 1 <= NAME_LENGTH && slash > 0) {
+                prefix.assign(name, 0, slash);
+                shortName.assign(name, slash + 1, std::string::npos);
+            } else {
+                // Record length includes its own decimal digits
+                const std::string record(" path=" + name + "\n");
+                size_t length = record.size() + 1;
+                char digits[32];
+                for (;;) {
+                    snprintf(digits, sizeof(digits), "%lu", static_cast<unsigned long>(length));
+                    if (record.size() + strlen(digits) == length)
+                        break;
+                    length = record.size() + strlen(digits);
+                }
+                const std::string data(digits + record);
+                appendHeader(out, "PaxHeader", data.size(), mtime, 'x');
+                out.insert(out.end(), data.begin(), data.end());
+                pad(out);
+                shortName.assign(name, 0, NAME_LENGTH);
+            }
+        }
+
+        const size_t begin = out.size();
+        out.resize(begin + BLOCK_SIZE);
+        unsigned char* header = &out[begin];
+        memcpy(header, shortName.data(), shortName.size());
+        putOctal(header + 100, 8, 0644);
+        putOctal(header + 108, 8, 0);
+        putOctal(header + 116, 8, 0);
+        putOctal(header + 124, 12, size);
+        putOctal(header + 136, 12, mtime > 0 ? static_cast<uint64_t>(mtime) / NANOSECONDS : 0);
+        header[156] = type;
+        memcpy(header + 257, "ustar", 6);
+        memcpy(header + 263, "00", 2);
+        memcpy(header + 345, prefix.data(), prefix.size());
+
+        // Checksum is computed with the checksum field set to spaces
+        memset(header + 148, ' ', 8);
+        unsigned long checksum = 0;
+        for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+            checksum += header[i];
+        }
+        putOctal(header + 148, 7, checksum);
+    }
+
+} // namespace
+
+namespace mp3enc {
+
+const char* const Archive::INDEX_NAME = ".mp3enc-index";
+
+Archive::Archive(const Options& options)
+: _directory(utils::NormalizeDirectory(options.directory))
+, _output(NULL)
+, _size(0)
+, _failed(false) {
+    if (!options.archive.empty()) {
+        _output = new OutputFile(options.archive.c_str(), options.output, 0);
+    }
+}
+
+Archive::~Archive() {
+    delete _output;
+}
+
+void Archive::Add(const std::string& wavPath, int64_t mtime, const std::vector<unsigned char>& mp3) {
+    // Path relative to the directory with MP3 extension
+    Member member;
+    member.name = wavPath.compare(0, _directory.size(), _directory) == 0
+        ? wavPath.substr(_directory.size())
+        : wavPath;
+    member.name.replace(member.name.size() - 3, 3, "mp3");
+    std::replace(member.name.begin(), member.name.end(), '\\', '/');
+    member.size = mp3.size();
+
+    std::vector<unsigned char> header;
+    appendHeader(header, member.name, mp3.size(), mtime, '0');
+    static const unsigned char zeros[BLOCK_SIZE] = {0};
+
+    threading::ScopedLock lock(_lock);
+    if (_failed)
+        throw std::runtime_error(WRITE_ERROR);
+    write(&header[0], header.size());
+    member.offset = _size;
+    if (!mp3.empty()) {
+        write(&mp3[0], mp3.size());
+    }
+    write(zeros, (BLOCK_SIZE - mp3.size() % BLOCK_SIZE) % BLOCK_SIZE);
+    _index.push_back(member);
+}
+
+bool Archive::Close() {
+    threading::ScopedLock lock(_lock);
+    if (!_output || _failed)
+        return false;
+    try {
+        std::string index;
+        for (size_t i = 0; i < _index.size(); ++i) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "%llu\t%llu\t",
+                static_cast<unsigned long long>(_index[i].offset),
+                static_cast<unsigned long long>(_index[i].size));
+            index += buf + _index[i].name + "\n";
+        }
+        std::vector<unsigned char> tail;
+        appendHeader(tail, INDEX_NAME, index.size(), static_cast<int64_t>(time(NULL)) * static_cast<int64_t>(NANOSECONDS), '0');
+        tail.insert(tail.end(), index.begin(), index.end());
+        pad(tail);
+        // End of archive is marked by two zero blocks
+        tail.resize(tail.size() + 2 * BLOCK_SIZE);
+        write(&tail[0], tail.size());
+    } catch (std::exception&) {
+        return false;
+    }
+    return _output->Publish();
+}
+
+void Archive::write(const void* data, size_t size) {
+    if (size > 0 && _output->Write(data, size) != size) {
+        _failed = true;
+        throw std::runtime_error(WRITE_ERROR);
+    }
+    _size += size;
+}
+
+} // namespace mp3enc
@@ -0,0 +1,77 @@
+//
+//  archive.hpp - tar archive of MP3 streams written by many workers
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_ARCHIVE_HPP
+#define MP3ENC_ARCHIVE_HPP
+
+#include "file.hpp"
+#include "mutex.hpp"
+#include "options.hpp"
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace mp3enc {
+
+    // Archive collects MP3 streams of all files of a run in a single tar
+    // (POSIX.1-2001) file instead of a file per input (--archive). Workers
+    // encode files in memory and append them as a whole, so the archive
+    // is written sequentially in large chunks. The last member of the
+    // archive is an index (INDEX_NAME) with a line per MP3 stream:
+    // "<offset>\t<size>\t<name>", where offset is that of the stream data
+    // from the beginning of the archive. The archive appears at its path
+    // once it is closed, like any other output.
+    class Archive {
+        struct Member {
+            std::string name;
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        // Prefix of input paths cut off to get member names
+        const std::string _directory;
+        OutputFile* _output;
+
+        // Serializes appends
+        threading::Mutex _lock;
+        // Size of the archive written so far
+        uint64_t _size;
+        std::vector<Member> _index;
+        bool _failed;
+
+        Archive(const Archive&);
+        Archive& operator=(const Archive&);
+
+    public:
+        static const char* const INDEX_NAME;
+
+        // Creates the archive if it is given in the options
+        Archive(const Options& options);
+        // Removes the archive unless it was closed successfully
+        ~Archive();
+
+        bool IsEnabled() const {
+            return _output != NULL;
+        }
+
+        // Appends MP3 stream of given input file modified at 'mtime'
+        // (nanoseconds since the epoch). Thread-safe. Throws on write
+        // errors.
+        void Add(const std::string& wavPath, int64_t mtime, const std::vector<unsigned char>& mp3);
+
+        // Writes the index and the end of archive and publishes the
+        // archive. Returns false on error.
+        bool Close();
+
+    private:
+        void write(const void* data, size_t size);
+    }; // class Archive
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_ARCHIVE_HPP
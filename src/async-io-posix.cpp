@@ -0,0 +1,319 @@
+//
+//  async-io-posix.cpp - asynchronous file I/O based on Linux io_uring
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "async-io.hpp"
+#include "utils.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define MP3ENC_IO_URING 1
+#endif
+#endif
+
+#if defined(MP3ENC_IO_URING)
+
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+    // Ring indices are shared with the kernel
+    inline unsigned loadAcquire(const unsigned* ptr) {
+        return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+    }
+
+    inline void storeRelease(unsigned* ptr, unsigned value) {
+        __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+    }
+
+    // io_uring instance driven by raw system calls, so that no
+    // library besides libc is needed
+    class Uring {
+        int _fd;
+        unsigned _features;
+
+        // Submission queue ring, shared with the kernel
+        void* _sqRing;
+        size_t _sqRingSize;
+        unsigned* _sqHead;
+        unsigned* _sqTail;
+        unsigned _sqMask;
+        unsigned _sqEntries;
+        unsigned* _sqArray;
+        io_uring_sqe* _sqes;
+        size_t _sqesSize;
+
+        // Completion queue ring, same mapping as submission queue
+        // ring if the kernel supports it
+        void* _cqRing;
+        size_t _cqRingSize;
+        unsigned* _cqHead;
+        unsigned* _cqTail;
+        unsigned _cqMask;
+        io_uring_cqe* _cqes;
+
+        // Entries filled but not yet passed to the kernel
+        unsigned _queued;
+        bool _registered;
+
+        Uring(const Uring&);
+        Uring& operator=(const Uring&);
+
+    public:
+        Uring()
+        : _fd(-1)
+        , _features(0)
+        , _sqRing(MAP_FAILED)
+        , _sqRingSize(0)
+        , _sqEntries(0)
+        , _sqes(static_cast<io_uring_sqe*>(MAP_FAILED))
+        , _sqesSize(0)
+        , _cqRing(MAP_FAILED)
+        , _cqRingSize(0)
+        , _queued(0)
+        , _registered(false) {
+        }
+
+        ~Uring() {
+            if (_sqes != MAP_FAILED)
+                munmap(_sqes, _sqesSize);
+            if (_cqRing != MAP_FAILED && _cqRing != _sqRing)
+                munmap(_cqRing, _cqRingSize);
+            if (_sqRing != MAP_FAILED)
+                munmap(_sqRing, _sqRingSize);
+            if (_fd >= 0)
+                close(_fd);
+        }
+
+        bool open(unsigned depth) {
+            io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            _fd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+            if (_fd < 0)
+                return false;
+            _features = params.features;
+#if defined(IORING_FEAT_RW_CUR_POS)
+            // Plain (non-vectored) reads and writes came along with this
+            // feature. Older kernels are served by blocking I/O.
+            if (!(_features & IORING_FEAT_RW_CUR_POS))
+                return false;
+#endif
+
+            _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (_features & IORING_FEAT_SINGLE_MMAP) {
+                if (_cqRingSize > _sqRingSize)
+                    _sqRingSize = _cqRingSize;
+                _cqRingSize = _sqRingSize;
+            }
+
+            _sqRing = mmap(NULL, _sqRingSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+            if (_sqRing == MAP_FAILED)
+                return false;
+            if (_features & IORING_FEAT_SINGLE_MMAP) {
+                _cqRing = _sqRing;
+            } else {
+                _cqRing = mmap(NULL, _cqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+                if (_cqRing == MAP_FAILED)
+                    return false;
+            }
+            _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            _sqes = static_cast<io_uring_sqe*>(mmap(NULL, _sqesSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES));
+            if (_sqes == MAP_FAILED)
+                return false;
+
+            char* sq = static_cast<char*>(_sqRing);
+            _sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+            _sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            _sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            _sqEntries = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+            _sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+            char* cq = static_cast<char*>(_cqRing);
+            _cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            _cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            _cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+            return true;
+        }
+
+        bool registerBuffers(void* const* buffers, const size_t* sizes, unsigned count) {
+            if (_registered) {
+                syscall(__NR_io_uring_register, _fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+                _registered = false;
+            }
+            std::vector<iovec> iovecs(count);
+            for (unsigned i = 0; i < count; ++i) {
+                iovecs[i].iov_base = buffers[i];
+                iovecs[i].iov_len = sizes[i];
+            }
+            // Fails if pinned memory limit (RLIMIT_MEMLOCK) is too low,
+            // unregistered buffers still work
+            _registered = count > 0 &&
+                syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS, &iovecs[0], count) == 0;
+            return _registered;
+        }
+
+        void queue(int opcode, int fixedOpcode, int fd, uint64_t offset,
+            const void* data, size_t size, int buffer, bool ordered, void* tag) {
+            unsigned tail = *_sqTail;
+            if (tail - loadAcquire(_sqHead) >= _sqEntries) {
+                // Callers keep number of operations within the depth of
+                // the queue, so this is not expected to happen
+                submit(false);
+                tail = *_sqTail;
+            }
+            const unsigned index = tail & _sqMask;
+            io_uring_sqe* sqe = &_sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            const bool fixed = buffer >= 0 && _registered;
+            sqe->opcode = static_cast<__u8>(fixed ? fixedOpcode : opcode);
+            sqe->flags = ordered ? IOSQE_IO_DRAIN : 0;
+            sqe->fd = fd;
+            sqe->off = offset;
+            sqe->addr = reinterpret_cast<uintptr_t>(data);
+            sqe->len = static_cast<__u32>(size);
+            sqe->buf_index = static_cast<__u16>(fixed ? buffer : 0);
+            sqe->user_data = reinterpret_cast<uintptr_t>(tag);
+            _sqArray[index] = index;
+            storeRelease(_sqTail, tail + 1);
+            ++_queued;
+        }
+
+        void submit(bool wait) {
+            while (_queued > 0 || wait) {
+                const long res = syscall(__NR_io_uring_enter, _fd, _queued, wait ? 1 : 0,
+                    wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+                if (res < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    // Resources are reserved by io_uring_setup() and the
+                    // number of operations in flight is bounded, hence
+                    // this indicates a bug rather than a runtime condition
+                    mp3enc::utils::abort_on_error(errno);
+                }
+                _queued -= static_cast<unsigned>(res);
+                wait = false;
+            }
+        }
+
+        bool complete(void*& tag, long& result) {
+            const unsigned head = *_cqHead;
+            if (head == loadAcquire(_cqTail))
+                return false;
+            const io_uring_cqe& cqe = _cqes[head & _cqMask];
+            tag = reinterpret_cast<void*>(static_cast<uintptr_t>(cqe.user_data));
+            result = cqe.res;
+            storeRelease(_cqHead, head + 1);
+            return true;
+        }
+    }; // class Uring
+
+} // namespace
+
+namespace mp3enc {
+namespace platform {
+
+AsyncIoHandle asyncIoInit(unsigned depth) {
+    Uring* uring = new Uring;
+    if (!uring->open(depth)) {
+        // Kernel is too old or io_uring is disabled
+        delete uring;
+        return 0;
+    }
+    return reinterpret_cast<AsyncIoHandle>(uring);
+}
+
+bool asyncIoRegister(AsyncIoHandle handle, void* const* buffers, const size_t* sizes, unsigned count) {
+    assert(handle);
+    return reinterpret_cast<Uring*>(handle)->registerBuffers(buffers, sizes, count);
+}
+
+void asyncIoRead(AsyncIoHandle handle, int fd, uint64_t offset,
+    void* data, size_t size, int buffer, void* tag) {
+    assert(handle);
+    reinterpret_cast<Uring*>(handle)->queue(
+        IORING_OP_READ, IORING_OP_READ_FIXED, fd, offset, data, size, buffer, false, tag);
+}
+
+void asyncIoWrite(AsyncIoHandle handle, int fd, uint64_t offset,
+    const void* data, size_t size, int buffer, bool ordered, void* tag) {
+    assert(handle);
+    reinterpret_cast<Uring*>(handle)->queue(
+        IORING_OP_WRITE, IORING_OP_WRITE_FIXED, fd, offset, data, size, buffer, ordered, tag);
+}
+
+void asyncIoSubmit(AsyncIoHandle handle, bool wait) {
+    assert(handle);
+    reinterpret_cast<Uring*>(handle)->submit(wait);
+}
+
+bool asyncIoComplete(AsyncIoHandle handle, void*& tag, long& result) {
+    assert(handle);
+    return reinterpret_cast<Uring*>(handle)->complete(tag, result);
+}
+
+void asyncIoClose(AsyncIoHandle handle) {
+    assert(handle);
+    delete reinterpret_cast<Uring*>(handle);
+}
+
+} // namspace platform
+} // namespace mp3enc
+
+#else // #if defined(MP3ENC_IO_URING)
+
+namespace mp3enc {
+namespace platform {
+
+// No asynchronous I/O on this platform, callers use blocking I/O
+
+AsyncIoHandle asyncIoInit(unsigned) {
+    return 0;
+}
+
+bool asyncIoRegister(AsyncIoHandle, void* const*, const size_t*, unsigned) {
+    assert(false);
+    return false;
+}
+
+void asyncIoRead(AsyncIoHandle, int, uint64_t, void*, size_t, int, void*) {
+    assert(false);
+}
+
+void asyncIoWrite(AsyncIoHandle, int, uint64_t, const void*, size_t, int, bool, void*) {
+    assert(false);
+}
+
+void asyncIoSubmit(AsyncIoHandle, bool) {
+    assert(false);
+}
+
+bool asyncIoComplete(AsyncIoHandle, void*&, long&) {
+    assert(false);
+    return false;
+}
+
+void asyncIoClose(AsyncIoHandle) {
+}
+
+} // namspace platform
+} // namespace mp3enc
+
+#endif // #if defined(MP3ENC_IO_URING)
@@ -0,0 +1,49 @@
+//
+//  async-io-win32.cpp - Windows asynchronous file I/O
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "async-io.hpp"
+
+#include <cassert>
+
+namespace mp3enc {
+namespace platform {
+
+// Overlapped I/O on C runtime descriptors is not available, the
+// pipeline uses blocking I/O on its I/O thread instead
+
+AsyncIoHandle asyncIoInit(unsigned) {
+    return 0;
+}
+
+bool asyncIoRegister(AsyncIoHandle, void* const*, const size_t*, unsigned) {
+    assert(false);
+    return false;
+}
+
+void asyncIoRead(AsyncIoHandle, int, uint64_t, void*, size_t, int, void*) {
+    assert(false);
+}
+
+void asyncIoWrite(AsyncIoHandle, int, uint64_t, const void*, size_t, int, bool, void*) {
+    assert(false);
+}
+
+void asyncIoSubmit(AsyncIoHandle, bool) {
+    assert(false);
+}
+
+bool asyncIoComplete(AsyncIoHandle, void*&, long&) {
+    assert(false);
+    return false;
+}
+
+void asyncIoClose(AsyncIoHandle) {
+}
+
+} // namspace platform
+} // namespace mp3enc
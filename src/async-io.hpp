@@ -0,0 +1,106 @@
+//
+//  async-io.hpp - cross platform asynchronous file I/O queue
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_ASYNC_IO_HPP
+#define MP3ENC_ASYNC_IO_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mp3enc {
+    namespace platform {
+        //
+        // Platform-specific I/O queue handle
+        //
+        typedef void* AsyncIoHandle;
+
+        //
+        // The following functions are implemented in platform-
+        // specific files (async-io-posix.cpp, async-io-win32.cpp, etc)
+        //
+
+        // Creates a queue for up to 'depth' operations in flight. Returns
+        // NULL if asynchronous I/O is not available, in which case the
+        // caller is expected to fall back to blocking I/O.
+        AsyncIoHandle asyncIoInit(unsigned depth);
+        // Registers buffers that are used for most operations, replacing
+        // previously registered ones. Registered buffers are mapped by
+        // the system once instead of on every operation. Must not be
+        // called while operations are in flight.
+        bool asyncIoRegister(AsyncIoHandle handle, void* const* buffers, const size_t* sizes, unsigned count);
+        // Queue reading or writing of 'size' bytes at 'offset' of the
+        // file. 'buffer' is the index of registered buffer that contains
+        // 'data', or -1. Ordered operations start after all operations
+        // queued before them are complete.
+        void asyncIoRead(AsyncIoHandle handle, int fd, uint64_t offset,
+            void* data, size_t size, int buffer, void* tag);
+        void asyncIoWrite(AsyncIoHandle handle, int fd, uint64_t offset,
+            const void* data, size_t size, int buffer, bool ordered, void* tag);
+        // Starts queued operations with a single system call. If 'wait'
+        // is set, blocks until at least one operation is complete.
+        void asyncIoSubmit(AsyncIoHandle handle, bool wait);
+        // Fetches result of a completed operation: number of bytes
+        // transferred or negated error code. Returns false if there are
+        // no completed operations.
+        bool asyncIoComplete(AsyncIoHandle handle, void*& tag, long& result);
+        void asyncIoClose(AsyncIoHandle handle);
+
+    } // namespace platform
+
+    class AsyncIo {
+        platform::AsyncIoHandle _handle;
+        // Objects of this class must not be copied
+        AsyncIo(const AsyncIo&);
+        AsyncIo& operator=(const AsyncIo&);
+
+    public:
+        AsyncIo()
+        : _handle(0) {
+        }
+        ~AsyncIo() {
+            Close();
+        }
+
+        bool Open(unsigned depth) {
+            Close();
+            _handle = platform::asyncIoInit(depth);
+            return _handle != 0;
+        }
+
+        void Close() {
+            if (_handle) {
+                platform::asyncIoClose(_handle);
+                _handle = 0;
+            }
+        }
+
+        bool IsOpen() const {
+            return _handle != 0;
+        }
+
+        bool Register(void* const* buffers, const size_t* sizes, unsigned count) {
+            return platform::asyncIoRegister(_handle, buffers, sizes, count);
+        }
+
+        void Read(int fd, uint64_t offset, void* data, size_t size, int buffer, void* tag) {
+            platform::asyncIoRead(_handle, fd, offset, data, size, buffer, tag);
+        }
+
+        void Write(int fd, uint64_t offset, const void* data, size_t size, int buffer, bool ordered, void* tag) {
+            platform::asyncIoWrite(_handle, fd, offset, data, size, buffer, ordered, tag);
+        }
+
+        void Submit(bool wait) {
+            platform::asyncIoSubmit(_handle, wait);
+        }
+
+        bool Complete(void*& tag, long& result) {
+            return platform::asyncIoComplete(_handle, tag, result);
+        }
+    }; // class AsyncIo
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_ASYNC_IO_HPP
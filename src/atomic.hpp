@@ -0,0 +1,255 @@
+//
+//  atomic.hpp - atomic operations and lock-free ring buffer
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_ATOMIC_HPP
+#define MP3ENC_ATOMIC_HPP
+
+#include "mutex.hpp"
+#include "platform.hpp"
+
+#include <cassert>
+#include <vector>
+
+#include <stddef.h>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#endif
+
+namespace mp3enc {
+namespace threading {
+
+    //
+    // Minimal set of atomic operations on machine words. The code is
+    // C++98, hence compiler intrinsics are used instead of <atomic>.
+    //
+
+#if defined(_MSC_VER)
+
+    // Volatile accesses have acquire/release semantics
+    // with Microsoft compiler (/volatile:ms)
+    inline size_t AtomicLoad(const volatile size_t* ptr) {
+        return *ptr;
+    }
+
+    inline void AtomicStore(volatile size_t* ptr, size_t value) {
+        *ptr = value;
+    }
+
+    inline size_t AtomicExchange(volatile size_t* ptr, size_t value) {
+#if defined(_WIN64)
+        return static_cast<size_t>(InterlockedExchange64(
+            reinterpret_cast<volatile LONG64*>(ptr), static_cast<LONG64>(value)));
+#else
+        return static_cast<size_t>(InterlockedExchange(
+            reinterpret_cast<volatile LONG*>(ptr), static_cast<LONG>(value)));
+#endif
+    }
+
+    inline void FullBarrier() {
+        MemoryBarrier();
+    }
+
+#else
+
+    // Load with acquire semantics
+    inline size_t AtomicLoad(const volatile size_t* ptr) {
+        return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+    }
+
+    // Store with release semantics
+    inline void AtomicStore(volatile size_t* ptr, size_t value) {
+        __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+    }
+
+    // Sequentially consistent exchange
+    inline size_t AtomicExchange(volatile size_t* ptr, size_t value) {
+        return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+    }
+
+    inline void FullBarrier() {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+
+#endif
+
+    // Parker lets a thread sleep until another thread has something
+    // for it. Unpark() called before Park() is not lost: the next
+    // Park() returns immediately. Mutex is taken only when the thread
+    // actually goes to sleep, so wake-ups are cheap while the thread
+    // is busy.
+    class Parker {
+        Mutex _lock;
+        Condition _wakeup;
+        volatile size_t _token;
+        volatile size_t _sleeping;
+
+        Parker(const Parker&);
+        Parker& operator=(const Parker&);
+    public:
+        Parker()
+        : _token(0)
+        , _sleeping(0) {
+        }
+
+        // Must be called only by the thread owning the object
+        void Park() {
+            if (AtomicExchange(&_token, 0) != 0)
+                return;
+            ScopedLock lock(_lock);
+            AtomicStore(&_sleeping, 1);
+            // Pairs with the barrier of AtomicExchange() in Unpark():
+            // either Unpark() sees the flag, or token is seen here
+            FullBarrier();
+            while (AtomicExchange(&_token, 0) == 0) {
+                _wakeup.Wait(_lock);
+            }
+            AtomicStore(&_sleeping, 0);
+        }
+
+        // Same as Park(), but returns after given number of
+        // milliseconds at the latest
+        void Park(unsigned timeout) {
+            if (AtomicExchange(&_token, 0) != 0)
+                return;
+            timespec deadline;
+            platform::RealTimeAfter(timeout, deadline);
+            ScopedLock lock(_lock);
+            AtomicStore(&_sleeping, 1);
+            FullBarrier();
+            while (AtomicExchange(&_token, 0) == 0) {
+                if (!_wakeup.WaitUntil(_lock, deadline))
+                    break;
+            }
+            AtomicStore(&_sleeping, 0);
+        }
+
+        void Unpark() {
+            if (AtomicExchange(&_token, 1) == 0 && AtomicLoad(&_sleeping) != 0) {
+                ScopedLock lock(_lock);
+                _wakeup.Signal();
+            }
+        }
+    }; // class Parker
+
+    // Bounded single-producer single-consumer queue. Push() and Pop()
+    // never block and never take locks; a full or empty ring is
+    // reported to the caller, who usually parks until the other side
+    // makes progress.
+    template <class T>
+    class SpscRing {
+        std::vector<T> _items;
+        size_t _mask;
+        // Head is advanced by consumer, tail by producer. Both grow
+        // monotonically and wrap around naturally.
+        volatile size_t _head;
+        char _padding[64];
+        volatile size_t _tail;
+
+        SpscRing(const SpscRing&);
+        SpscRing& operator=(const SpscRing&);
+    public:
+        // Capacity must be a power of two
+        SpscRing(size_t capacity)
+        : _items(capacity)
+        , _mask(capacity - 1)
+        , _head(0)
+        , _tail(0) {
+            assert(capacity > 0 && (capacity & _mask) == 0);
+        }
+
+        // Producer side. Returns false if the ring is full.
+        bool Push(const T& item) {
+            const size_t tail = _tail;
+            if (tail - AtomicLoad(&_head) > _mask)
+                return false;
+            _items[tail & _mask] = item;
+            AtomicStore(&_tail, tail + 1);
+            return true;
+        }
+
+        // Consumer side. Returns false if the ring is empty.
+        bool Pop(T& item) {
+            const size_t head = _head;
+            if (head == AtomicLoad(&_tail))
+                return false;
+            item = _items[head & _mask];
+            AtomicStore(&_head, head + 1);
+            return true;
+        }
+    }; // class SpscRing
+
+    // Unbounded multiple-producer single-consumer queue (D. Vyukov's
+    // intrusive node queue). Producers never block and never take
+    // locks: a push is a single atomic exchange, no matter how many
+    // items are pushed at once. The consumer may briefly see the queue
+    // empty while a producer is between the exchange and linking its
+    // items, in which case it just tries again later.
+    template <class T>
+    class MpscQueue {
+    public:
+        // Items are allocated by producers and freed by the consumer
+        struct Node {
+            T value;
+            volatile size_t next;
+
+            Node()
+            : next(0) {
+            }
+        };
+
+    private:
+        // Consumer side: the node consumed last (or the initial stub),
+        // its successor holds the next item
+        Node* _head;
+        char _padding[64];
+        // Producer side: the node pushed last
+        volatile size_t _tail;
+
+        MpscQueue(const MpscQueue&);
+        MpscQueue& operator=(const MpscQueue&);
+    public:
+        MpscQueue()
+        : _head(new Node)
+        , _tail(reinterpret_cast<size_t>(_head)) {
+        }
+
+        ~MpscQueue() {
+            while (_head) {
+                Node* next = reinterpret_cast<Node*>(_head->next);
+                delete _head;
+                _head = next;
+            }
+        }
+
+        // Producer side. Takes ownership of the chain of nodes from
+        // 'first' to 'last' linked through their 'next' members.
+        void Push(Node* first, Node* last) {
+            last->next = 0;
+            Node* prev = reinterpret_cast<Node*>(
+                AtomicExchange(&_tail, reinterpret_cast<size_t>(last)));
+            AtomicStore(&prev->next, reinterpret_cast<size_t>(first));
+        }
+
+        // Consumer side. Returns false if there is nothing to take.
+        bool Pop(T& value) {
+            Node* next = reinterpret_cast<Node*>(AtomicLoad(&_head->next));
+            if (!next)
+                return false;
+            delete _head;
+            _head = next;
+            // The node stays in the queue as a stub, its value is
+            // not needed anymore
+            value = next->value;
+            next->value = T();
+            return true;
+        }
+    }; // class MpscQueue
+
+} // namespace threading
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_ATOMIC_HPP
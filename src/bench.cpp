@@ -0,0 +1,353 @@
+//
+//  bench.cpp - mp3enc benchmark suite
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+//
+// mp3enc-bench generates a deterministic synthetic corpus, measures
+// single-threaded encode() and end-to-end EncoderPool throughput with a
+// growing number of threads, and optionally compares the results with
+// a baseline saved by an earlier run. Results that are worse than the
+// baseline by more than the threshold make the program fail, so that
+// it can guard LAME upgrades and build flag changes.
+//
+
+#include <config.h>
+
+#include "encoder-pool.hpp"
+#include "kernels.hpp"
+#include "mp3encoder.hpp"
+#include "options.hpp"
+#include "synth.hpp"
+#include "utils.hpp"
+#include "walker.hpp"
+#include "wavfile.hpp"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lame.h>
+
+using namespace mp3enc;
+
+namespace {
+
+    // Version of the JSON report format
+    static const int REPORT_VERSION = 1;
+
+    struct BenchOptions {
+        std::string corpus;
+        double shortSeconds;
+        double longSeconds;
+        // Maximum number of threads, zero means one per CPU
+        unsigned threads;
+        std::string json;
+        std::string baseline;
+        // Allowed regression against the baseline, in percent
+        double threshold;
+
+        BenchOptions()
+        : corpus("mp3enc-bench.corpus")
+        , shortSeconds(1)
+        , longSeconds(10)
+        , threads(0)
+        , threshold(5) {
+        }
+    };
+
+    // Metrics keyed by name, e.g. "pool.4.efficiency"
+    typedef std::map<std::string, double> Metrics;
+
+    void usage() {
+        puts("Usage: mp3enc-bench [options]");
+        puts("");
+        puts("Options:");
+        puts("  --corpus <directory>     where to generate synthetic WAV files");
+        puts("                           (default: mp3enc-bench.corpus)");
+        puts("  --short <seconds>        length of short files (default: 1)");
+        puts("  --long <seconds>         length of long files (default: 10)");
+        puts("  -j, --jobs <count>       maximum number of threads (default: one per CPU)");
+        puts("  --json <file>            write results as JSON, '-' for standard output");
+        puts("  --baseline <file>        compare results with JSON of an earlier run");
+        puts("  --threshold <percent>    allowed regression against the baseline");
+        puts("                           (default: 5)");
+        puts("  --kernels <isa>          sample conversion kernels to use: 'avx2',");
+        puts("                           'sse2' or 'scalar' (default: best supported)");
+    }
+
+    bool parseNumber(const char* str, double& value) {
+        if (!str || !*str)
+            return false;
+        char* end = NULL;
+        value = strtod(str, &end);
+        return *end == '\0' && value >= 0;
+    }
+
+    bool parseOptions(int argc, const char* argv[], BenchOptions& options) {
+        for (int i = 1; i < argc; ++i) {
+            const char* arg = argv[i];
+            const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+            double number = 0;
+            if (0 == strcmp(arg, "--corpus") && value) {
+                options.corpus = value;
+            } else if (0 == strcmp(arg, "--short") && parseNumber(value, number) && number > 0) {
+                options.shortSeconds = number;
+            } else if (0 == strcmp(arg, "--long") && parseNumber(value, number) && number > 0) {
+                options.longSeconds = number;
+            } else if ((0 == strcmp(arg, "-j") || 0 == strcmp(arg, "--jobs")) &&
+                parseNumber(value, number) && number >= 1) {
+                options.threads = static_cast<unsigned>(number);
+            } else if (0 == strcmp(arg, "--json") && value) {
+                options.json = value;
+            } else if (0 == strcmp(arg, "--baseline") && value) {
+                options.baseline = value;
+            } else if (0 == strcmp(arg, "--threshold") && parseNumber(value, number)) {
+                options.threshold = number;
+            } else if (0 == strcmp(arg, "--kernels") && value && kernels::SetInstructionSet(value)) {
+                // Selected for the whole process
+            } else {
+                return false;
+            }
+            ++i;
+        }
+        return true;
+    }
+
+    double seconds(uint64_t nanoseconds) {
+        return nanoseconds / 1e9;
+    }
+
+    // Nearest-rank percentile of sorted values
+    double percentile(const std::vector<double>& sorted, double p) {
+        if (sorted.empty())
+            return 0;
+        size_t rank = static_cast<size_t>(p / 100.0 * sorted.size() + 0.999999);
+        rank = rank < 1 ? 1 : rank > sorted.size() ? sorted.size() : rank;
+        return sorted[rank - 1];
+    }
+
+    std::string mp3Path(const std::string& wavPath) {
+        return wavPath.substr(0, wavPath.size() - 3) + "mp3";
+    }
+
+    void removeOutputs(const std::vector<std::string>& files) {
+        for (size_t i = 0; i < files.size(); ++i) {
+            remove(mp3Path(files[i]).c_str());
+        }
+    }
+
+    // Measures encode() on a single thread, file by file
+    void benchEncode(const std::vector<std::string>& files, uint64_t samples, Metrics& metrics) {
+        EncoderCache encoders;
+        std::vector<unsigned char> inBuf;
+        std::vector<unsigned char> outBuf;
+        std::vector<double> latencies;
+
+        const uint64_t start = platform::MonotonicTime();
+        for (size_t i = 0; i < files.size(); ++i) {
+            const uint64_t begin = platform::MonotonicTime();
+            WavFile input(files[i].c_str(), true);
+            encode(encoders, input, inBuf, outBuf, mp3Path(files[i]).c_str());
+            latencies.push_back(seconds(platform::MonotonicTime() - begin) * 1000.0);
+        }
+        const double elapsed = seconds(platform::MonotonicTime() - start);
+        removeOutputs(files);
+
+        std::sort(latencies.begin(), latencies.end());
+        metrics["encode.samples_per_sec"] = samples / elapsed;
+        metrics["encode.latency_p50_ms"] = percentile(latencies, 50);
+        metrics["encode.latency_p90_ms"] = percentile(latencies, 90);
+        metrics["encode.latency_p99_ms"] = percentile(latencies, 99);
+        metrics["encode.latency_max_ms"] = latencies.empty() ? 0 : latencies.back();
+    }
+
+    // Runs EncoderPool end to end on the corpus directory
+    double benchPool(const BenchOptions& bench, const std::vector<std::string>& files, unsigned threads) {
+        Options options;
+        options.directory = bench.corpus;
+        options.workers = threads;
+        options.quiet = true;
+
+        const uint64_t start = platform::MonotonicTime();
+        DirWalker wavFiles(options.directory.c_str(), ".wav", false);
+        EncoderPool pool(options);
+        const int status = pool.Run(wavFiles);
+        const double elapsed = seconds(platform::MonotonicTime() - start);
+        removeOutputs(files);
+        if (status != 0) {
+            throw std::runtime_error("Encoder pool failed");
+        }
+        return elapsed;
+    }
+
+    void writeReport(FILE* out, const BenchOptions& options, size_t files,
+        uint64_t samples, unsigned threads, const Metrics& metrics) {
+        fprintf(out, "{\n");
+        fprintf(out, "  \"version\": %d,\n", REPORT_VERSION);
+        fprintf(out, "  \"lame\": \"%s\",\n", get_lame_version());
+        fprintf(out, "  \"cpus\": %d,\n", platform::CpuCount());
+        fprintf(out, "  \"threads\": %u,\n", threads);
+        fprintf(out, "  \"kernels\": \"%s\",\n", kernels::GetInstructionSet());
+        fprintf(out, "  \"corpus\": { \"files\": %lu, \"samples\": %llu, \"short_seconds\": %g, \"long_seconds\": %g },\n",
+            static_cast<unsigned long>(files), static_cast<unsigned long long>(samples),
+            options.shortSeconds, options.longSeconds);
+        fprintf(out, "  \"metrics\": {");
+        for (Metrics::const_iterator it = metrics.begin(); it != metrics.end(); ++it) {
+            fprintf(out, "%s\n    \"%s\": %.6g", it == metrics.begin() ? "" : ",",
+                it->first.c_str(), it->second);
+        }
+        fprintf(out, "\n  }\n}\n");
+    }
+
+    // Reads "metrics" object of a report. Only the subset of JSON
+    // written by writeReport() is understood.
+    Metrics readMetrics(const std::string& path) {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            throw std::runtime_error("Cannot open baseline " + path);
+        std::string text;
+        char buf[4096];
+        for (size_t read; (read = fread(buf, 1, sizeof(buf), file)) > 0; ) {
+            text.append(buf, read);
+        }
+        fclose(file);
+
+        Metrics metrics;
+        size_t pos = text.find("\"metrics\"");
+        if (pos == std::string::npos || (pos = text.find('{', pos)) == std::string::npos)
+            throw std::runtime_error("No metrics in baseline " + path);
+        for (++pos; ; ) {
+            const size_t open = text.find_first_of("\"}", pos);
+            if (open == std::string::npos || text[open] == '}')
+                break;
+            const size_t close = text.find('"', open + 1);
+            const size_t colon = close == std::string::npos ? close : text.find(':', close);
+            if (colon == std::string::npos)
+                throw std::runtime_error("Malformed baseline " + path);
+            const char* start = text.c_str() + colon + 1;
+            char* end = NULL;
+            const double value = strtod(start, &end);
+            if (end == start)
+                throw std::runtime_error("Malformed baseline " + path);
+            metrics[text.substr(open + 1, close - open - 1)] = value;
+            pos = end - text.c_str();
+        }
+        return metrics;
+    }
+
+    // Prints changes against the baseline and returns the number
+    // of regressions beyond the threshold
+    int compare(const Metrics& baseline, const Metrics& metrics, double threshold) {
+        int regressions = 0;
+        utils::error("\n%-36s %14s %14s %9s\n", "metric", "baseline", "current", "change");
+        for (Metrics::const_iterator it = metrics.begin(); it != metrics.end(); ++it) {
+            Metrics::const_iterator base = baseline.find(it->first);
+            if (base == baseline.end() || base->second == 0)
+                continue;
+            const double change = (it->second - base->second) / base->second * 100.0;
+            // Latencies are better when lower, everything else is
+            // better when higher
+            const bool lowerIsBetter = it->first.find("latency") != std::string::npos;
+            const bool regressed = (lowerIsBetter ? change : -change) > threshold;
+            regressions += regressed ? 1 : 0;
+            utils::error("%-36s %14.6g %14.6g %+8.1f%%%s\n", it->first.c_str(),
+                base->second, it->second, change, regressed ? "  REGRESSION" : "");
+        }
+        return regressions;
+    }
+
+    int run(const BenchOptions& options) {
+        // Generate the corpus
+        std::vector<SynthSpec> specs = synthCorpus(options.shortSeconds, options.longSeconds);
+        std::vector<std::string> files;
+        uint64_t samples = 0;
+        if (!platform::MakeDirectory(options.corpus.c_str())) {
+            throw std::runtime_error("Failed to create corpus directory " + options.corpus);
+        }
+        utils::error("Generating %lu files in %s\n",
+            static_cast<unsigned long>(specs.size()), options.corpus.c_str());
+        for (size_t i = 0; i < specs.size(); ++i) {
+            files.push_back(utils::NormalizeDirectory(options.corpus) + specs[i].Name());
+            synthWrite(files.back(), specs[i]);
+            samples += specs[i].Samples();
+        }
+
+        Metrics metrics;
+        utils::error("Running encode() on a single thread\n");
+        benchEncode(files, samples, metrics);
+        utils::error("  %.4g samples/s, latency p50 %.4g ms, p90 %.4g ms, p99 %.4g ms\n",
+            metrics["encode.samples_per_sec"], metrics["encode.latency_p50_ms"],
+            metrics["encode.latency_p90_ms"], metrics["encode.latency_p99_ms"]);
+
+        // Powers of two up to the maximum and the maximum itself
+        const unsigned maxThreads = options.threads > 0
+            ? options.threads
+            : static_cast<unsigned>(platform::CpuCount());
+        std::vector<unsigned> counts;
+        for (unsigned threads = 1; threads < maxThreads; threads *= 2) {
+            counts.push_back(threads);
+        }
+        counts.push_back(maxThreads);
+
+        double single = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            const unsigned threads = counts[i];
+            utils::error("Running encoder pool with %u thread(s)\n", threads);
+            const double rate = samples / benchPool(options, files, threads);
+            if (threads == 1) {
+                single = rate;
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "pool.%u.", threads);
+            const std::string prefix(name);
+            metrics[prefix + "samples_per_sec"] = rate;
+            metrics[prefix + "samples_per_sec_per_core"] = rate / threads;
+            // Share of linear speed-up relative to a single thread
+            metrics[prefix + "efficiency"] = single > 0 ? rate / (single * threads) : 0;
+            utils::error("  %.4g samples/s, %.4g samples/s per core, efficiency %.2f\n",
+                rate, rate / threads, metrics[prefix + "efficiency"]);
+        }
+
+        if (!options.json.empty()) {
+            FILE* out = options.json == "-" ? stdout : fopen(options.json.c_str(), "w");
+            if (!out)
+                throw std::runtime_error("Cannot create " + options.json);
+            writeReport(out, options, files.size(), samples, maxThreads, metrics);
+            if (out != stdout && fclose(out) != 0)
+                throw std::runtime_error("Failed to write " + options.json);
+        }
+
+        if (!options.baseline.empty()) {
+            const int regressions = compare(readMetrics(options.baseline), metrics, options.threshold);
+            if (regressions > 0) {
+                utils::error("%d metric(s) regressed by more than %g%%\n", regressions, options.threshold);
+                return EXIT_FAILURE;
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+
+} // namespace
+
+int main(int argc, const char* argv[]) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        usage();
+        return 1;
+    }
+
+    try {
+        return run(options);
+    } catch (std::exception& e) {
+        utils::error("Error: %s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,345 @@
+//
+//  daemon.cpp - long-running encoder serving jobs over a local socket
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "daemon.hpp"
+#include "platform.hpp"
+#include "socket.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+    // Requests longer than that are rejected and the client
+    // is disconnected
+    static const size_t MAX_REQUEST_LENGTH = 65536;
+
+    // Limit of inline PCM data in a single request
+    static const unsigned MAX_INLINE_PCM = 256 * 1024 * 1024;
+
+    // Size of the buffer for incoming requests
+    static const size_t READ_BUFFER_SIZE = 65536;
+
+    // Buffered reader of requests arriving at a socket
+    class RequestReader {
+        mp3enc::platform::SocketHandle _socket;
+        std::vector<char> _buf;
+        size_t _pos;
+        size_t _len;
+
+        RequestReader(const RequestReader&);
+        RequestReader& operator=(const RequestReader&);
+
+        bool fill() {
+            _pos = 0;
+            _len = mp3enc::platform::socketRead(_socket, &_buf[0], _buf.size());
+            return _len > 0;
+        }
+
+    public:
+        RequestReader(mp3enc::platform::SocketHandle socket)
+        : _socket(socket)
+        , _buf(READ_BUFFER_SIZE)
+        , _pos(0)
+        , _len(0) {
+        }
+
+        // Reads a line without line terminator (either "\n" or "\r\n").
+        // Returns false at the end of stream and if the line is too long.
+        bool ReadLine(std::string& line) {
+            line.clear();
+            for (;;) {
+                if (_pos == _len && !fill())
+                    return false;
+                const char* begin = &_buf[_pos];
+                const char* end = static_cast<const char*>(memchr(begin, '\n', _len - _pos));
+                if (!end) {
+                    line.append(begin, _len - _pos);
+                    _pos = _len;
+                    if (line.size() > MAX_REQUEST_LENGTH)
+                        return false;
+                    continue;
+                }
+                line.append(begin, end);
+                _pos += end - begin + 1;
+                if (!line.empty() && *line.rbegin() == '\r') {
+                    line.erase(line.size() - 1);
+                }
+                return true;
+            }
+        }
+
+        // Reads exactly size bytes. Returns false if the stream
+        // ends earlier.
+        bool Read(void* dest, size_t size) {
+            unsigned char* out = reinterpret_cast<unsigned char*>(dest);
+            while (size > 0) {
+                if (_pos == _len && !fill())
+                    return false;
+                const size_t chunk = std::min(size, _len - _pos);
+                memcpy(out, &_buf[_pos], chunk);
+                _pos += chunk;
+                out += chunk;
+                size -= chunk;
+            }
+            return true;
+        }
+    }; // class RequestReader
+
+    // Splits request into tab separated fields. Paths may contain
+    // spaces, but hardly ever contain tabs.
+    void split(const std::string& line, std::vector<std::string>& fields) {
+        fields.clear();
+        std::string::size_type begin = 0;
+        for (;;) {
+            const std::string::size_type end = line.find('\t', begin);
+            fields.push_back(line.substr(begin, end == std::string::npos ? end : end - begin));
+            if (end == std::string::npos)
+                break;
+            begin = end + 1;
+        }
+    }
+
+    // Parses non-negative decimal number
+    bool parseUnsigned(const std::string& str, unsigned& value) {
+        if (str.empty() || str[0] == '-')
+            return false;
+        char* end = NULL;
+        const unsigned long res = strtoul(str.c_str(), &end, 10);
+        if (*end != '\0')
+            return false;
+        value = static_cast<unsigned>(res);
+        return true;
+    }
+
+    // Parses optional "name=value" settings of a request starting
+    // at given field
+    void parseSettings(
+        const std::vector<std::string>& fields,
+        size_t first,
+        mp3enc::EncoderSettings& settings) {
+        for (size_t i = first; i < fields.size(); ++i) {
+            const std::string& field = fields[i];
+            const std::string::size_type eq = field.find('=');
+            const std::string name(field, 0, eq);
+            unsigned value = 0;
+            if (eq == std::string::npos || !parseUnsigned(field.substr(eq + 1), value))
+                throw std::runtime_error("Invalid setting: " + field);
+            if (name == "bitrate" && value >= 8 && value <= 320) {
+                settings.bitrate = static_cast<int>(value);
+            } else if (name == "quality" && value <= 9) {
+                settings.quality = static_cast<int>(value);
+            } else {
+                throw std::runtime_error("Invalid setting: " + field);
+            }
+        }
+    }
+
+} // namespace
+
+namespace mp3enc {
+
+// Client connection. It lives while its requests are being read or
+// any of its jobs is pending.
+class Connection {
+    Daemon& _owner;
+    const platform::SocketHandle _socket;
+    // Serializes notifications sent by workers and protects
+    // reference count
+    threading::Mutex _lock;
+    size_t _references;
+
+    Connection(const Connection&);
+    Connection& operator=(const Connection&);
+
+    ~Connection() {
+        platform::socketClose(_socket);
+    }
+
+public:
+    Connection(Daemon& owner, platform::SocketHandle socket)
+    : _owner(owner)
+    , _socket(socket)
+    , _references(1) {
+    }
+
+    Daemon& GetOwner() {
+        return _owner;
+    }
+
+    platform::SocketHandle GetSocket() const {
+        return _socket;
+    }
+
+    void AddRef() {
+        threading::ScopedLock lock(_lock);
+        ++_references;
+    }
+
+    void Release() {
+        bool last = false;
+        {
+            threading::ScopedLock lock(_lock);
+            last = --_references == 0;
+        }
+        if (last) {
+            delete this;
+        }
+    }
+
+    // Sends a line to the client. Failures are ignored, since the
+    // client is free to disconnect without waiting for its jobs.
+    void Send(const std::string& line) {
+        threading::ScopedLock lock(_lock);
+        platform::socketWrite(_socket, line.data(), line.size());
+    }
+}; // class Connection
+
+ClientJob::ClientJob(Connection* connection, const std::string& id)
+: _connection(connection)
+, _id(id)
+, channels(0)
+, sampleRate(0) {
+    _connection->AddRef();
+}
+
+ClientJob::~ClientJob() {
+    _connection->Release();
+}
+
+void ClientJob::Complete(const std::string& error) {
+    if (error.empty()) {
+        _connection->Send(_id + "\tOK\n");
+        return;
+    }
+    // Keep the notification on a single line
+    std::string message(error);
+    std::replace(message.begin(), message.end(), '\n', ' ');
+    std::replace(message.begin(), message.end(), '\t', ' ');
+    _connection->Send(_id + "\tERROR\t" + message + "\n");
+}
+
+Daemon::Daemon(const Options& options)
+: _options(options)
+, _pool(options) {
+}
+
+int Daemon::Run() {
+    const char* path = _options.socket.c_str();
+    const platform::SocketHandle listener = platform::socketListen(path);
+    _pool.Start();
+
+    for (platform::SocketHandle socket;
+         (socket = platform::socketAccept(listener)) != platform::InvalidSocket; ) {
+        Connection* connection = new Connection(*this, socket);
+        threading::ScopedLock lock(_lock);
+        _connections.push_back(connection);
+        pthread_t thread;
+        const int res = pthread_create(&thread, NULL, connectionProc, connection);
+        if (res != 0) {
+            // Same reasoning as in EncoderPool::Start()
+            utils::abort_on_error(res);
+        }
+        pthread_detach(thread);
+    }
+
+    // Stop reading requests, but complete the jobs accepted already
+    {
+        threading::ScopedLock lock(_lock);
+        for (size_t i = 0; i < _connections.size(); ++i) {
+            platform::socketShutdown(_connections[i]->GetSocket());
+        }
+        while (!_connections.empty()) {
+            _idle.Wait(_lock);
+        }
+    }
+    const int status = _pool.Finish();
+    platform::socketRemove(listener, path);
+    return status;
+}
+
+// PTHREAD's thread proc
+void* Daemon::connectionProc(void* arg) {
+    Connection* connection = reinterpret_cast<Connection*>(arg);
+    Daemon& daemon = connection->GetOwner();
+    daemon.serve(*connection);
+    {
+        threading::ScopedLock lock(daemon._lock);
+        daemon._connections.erase(std::find(
+            daemon._connections.begin(), daemon._connections.end(), connection));
+        daemon._idle.Signal();
+    }
+    // Pending jobs keep the connection open
+    connection->Release();
+    return NULL;
+}
+
+void Daemon::serve(Connection& connection) {
+    RequestReader reader(connection.GetSocket());
+    std::vector<std::string> fields;
+    for (std::string line; reader.ReadLine(line); ) {
+        split(line, fields);
+        if (fields[0].empty()) {
+            // Blank line
+            continue;
+        }
+
+        ClientJob* job = new ClientJob(&connection, fields.size() > 1 ? fields[1] : std::string());
+        try {
+            Task task;
+            if (fields[0] == "encode") {
+                // encode <id> <input> <output> [settings]
+                if (fields.size() < 4)
+                    throw std::runtime_error("Invalid request");
+                job->input = fields[2];
+                job->output = fields[3];
+                parseSettings(fields, 4, job->settings);
+                platform::FileInfo info = platform::FileInfo();
+                platform::GetFileInfo(job->input.c_str(), info);
+                task.size = info.size;
+            } else if (fields[0] == "pcm") {
+                // pcm <id> <rate> <channels> <bytes> <output> [settings]
+                // followed by the data
+                unsigned bytes = 0;
+                if (fields.size() < 6 || !parseUnsigned(fields[4], bytes) || bytes > MAX_INLINE_PCM) {
+                    // The data cannot be told from the next request
+                    job->Complete("Invalid request");
+                    delete job;
+                    break;
+                }
+                job->pcm.resize(bytes);
+                if (bytes > 0 && !reader.Read(&job->pcm[0], bytes)) {
+                    delete job;
+                    break;
+                }
+                unsigned sampleRate = 0;
+                unsigned channels = 0;
+                if (!parseUnsigned(fields[2], sampleRate) || !parseUnsigned(fields[3], channels))
+                    throw std::runtime_error("Invalid request");
+                job->sampleRate = static_cast<int>(sampleRate);
+                job->channels = static_cast<int>(channels);
+                job->output = fields[5];
+                parseSettings(fields, 6, job->settings);
+                task.size = bytes;
+            } else {
+                throw std::runtime_error("Unknown request");
+            }
+            task.client = job;
+            _pool.Submit(task);
+        } catch (std::exception& e) {
+            job->Complete(e.what());
+            delete job;
+        }
+    }
+}
+
+} // namespace mp3enc
@@ -0,0 +1,91 @@
+//
+//  daemon.hpp - long-running encoder serving jobs over a local socket
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_DAEMON_HPP
+#define MP3ENC_DAEMON_HPP
+
+#include "encoder-pool.hpp"
+#include "mp3encoder.hpp"
+#include "mutex.hpp"
+#include "options.hpp"
+
+#include <string>
+#include <vector>
+
+namespace mp3enc {
+
+    class Connection;
+
+    // Job submitted by a client of the daemon. The job is owned by its
+    // task: the worker that processes the task reports the outcome with
+    // Complete() and deletes the job.
+    class ClientJob {
+        // Client to be notified
+        Connection* _connection;
+        // Identifier chosen by the client
+        const std::string _id;
+
+        ClientJob(const ClientJob&);
+        ClientJob& operator=(const ClientJob&);
+
+    public:
+        // Input WAV file. If it is empty, 'pcm' holds little-endian
+        // 16-bit PCM data of given format instead.
+        std::string input;
+        std::vector<unsigned char> pcm;
+        int channels;
+        int sampleRate;
+        // Output MP3 file
+        std::string output;
+        EncoderSettings settings;
+
+        ClientJob(Connection* connection, const std::string& id);
+        ~ClientJob();
+
+        const std::string& GetId() const {
+            return _id;
+        }
+
+        // Notifies the client that the job is done. Empty error message
+        // means success.
+        void Complete(const std::string& error);
+    }; // class ClientJob
+
+    // Daemon keeps the encoder pool running, along with LAME encoders
+    // cached by its workers, and accepts jobs from clients connected to
+    // a local socket. Every client connection is served by a thread of
+    // its own that parses requests and submits them to the pool; workers
+    // send completion notifications back to the clients. See README.md
+    // for the protocol.
+    class Daemon {
+        const Options& _options;
+        EncoderPool _pool;
+        // Protects the members below
+        threading::Mutex _lock;
+        // Signals that a connection thread is done
+        threading::Condition _idle;
+        // Connections whose requests are being read
+        std::vector<Connection*> _connections;
+
+        Daemon(const Daemon&);
+        Daemon& operator=(const Daemon&);
+
+    public:
+        Daemon(const Options& options);
+
+        // Serves clients until the process is asked to terminate
+        // (SIGINT, SIGTERM), then completes accepted jobs. Returns
+        // the exit status of the program.
+        int Run();
+
+    private:
+        static void* connectionProc(void* arg);
+        void serve(Connection& connection);
+    }; // class Daemon
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_DAEMON_HPP
@@ -0,0 +1,138 @@
+//
+//  downmix.cpp - mixing of multichannel input down to MP3 channels
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "downmix.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+#include <stdlib.h>
+
+namespace {
+
+    // -3 dB
+    static const float HALF_POWER = 0.70710678f;
+
+    // Left and right coefficients of WAVE speaker positions, in order
+    // of channel mask bits
+    static const float SPEAKERS[][2] = {
+        { 1, 0 },                       // front left
+        { 0, 1 },                       // front right
+        { HALF_POWER, HALF_POWER },     // front centre
+        { 0, 0 },                       // low frequency
+        { HALF_POWER, 0 },              // back left
+        { 0, HALF_POWER },              // back right
+        { 1, 0 },                       // front left of centre
+        { 0, 1 },                       // front right of centre
+        { 0.5f, 0.5f },                 // back centre
+        { HALF_POWER, 0 },              // side left
+        { 0, HALF_POWER },              // side right
+        { HALF_POWER, HALF_POWER },     // top centre
+        { HALF_POWER, 0 },              // top front left
+        { HALF_POWER, HALF_POWER },     // top front centre
+        { 0, HALF_POWER },              // top front right
+        { HALF_POWER, 0 },              // top back left
+        { 0.5f, 0.5f },                 // top back centre
+        { 0, HALF_POWER }               // top back right
+    };
+
+    static const int SPEAKER_COUNT = sizeof(SPEAKERS) / sizeof(SPEAKERS[0]);
+
+    // Default channel masks of WAVE files by channel count
+    static const uint32_t DEFAULT_MASKS[] = {
+        0,
+        0x4,    // mono
+        0x3,    // stereo
+        0x7,    // 3.0
+        0x33,   // quad
+        0x37,   // 5.0
+        0x3F,   // 5.1
+        0x13F,  // 6.1
+        0x63F   // 7.1
+    };
+
+    static const int DEFAULT_MASK_COUNT = sizeof(DEFAULT_MASKS) / sizeof(DEFAULT_MASKS[0]);
+
+    // Parses a row of coefficients up to ';' or the end of the text
+    bool parseRow(const char*& text, std::vector<float>& row) {
+        for (;;) {
+            char* end = NULL;
+            const double value = strtod(text, &end);
+            if (end == text || !(std::fabs(value) <= 1e6))
+                return false;
+            row.push_back(static_cast<float>(value));
+            text = end;
+            if (*text != ',')
+                return true;
+            ++text;
+        }
+    }
+
+} // namespace
+
+namespace mp3enc {
+
+bool DownmixMatrix::Parse(const char* text, DownmixMatrix& matrix) {
+    std::vector<float> left;
+    std::vector<float> right;
+    if (!parseRow(text, left))
+        return false;
+    if (*text == ';') {
+        ++text;
+        if (!parseRow(text, right) || right.size() != left.size())
+            return false;
+    }
+    if (*text != '\0' || left.size() > MAX_CHANNELS)
+        return false;
+
+    matrix._inputs = static_cast<int>(left.size());
+    matrix._outputs = right.empty() ? 1 : 2;
+    matrix._coefficients = left;
+    matrix._coefficients.insert(matrix._coefficients.end(), right.begin(), right.end());
+    return true;
+}
+
+DownmixMatrix DownmixMatrix::ForLayout(int channels, uint32_t channelMask) {
+    if (channels > MAX_CHANNELS)
+        throw std::runtime_error("Unsupported channel layout");
+    if (channelMask == 0 && channels < DEFAULT_MASK_COUNT) {
+        channelMask = DEFAULT_MASKS[channels];
+    }
+
+    // Channels take positions of the mask bits in order
+    DownmixMatrix matrix;
+    matrix._inputs = channels;
+    matrix._outputs = 2;
+    matrix._coefficients.resize(2 * channels);
+    int channel = 0;
+    for (int bit = 0; bit < SPEAKER_COUNT && channel < channels; ++bit) {
+        if (channelMask & (1u << bit)) {
+            matrix._coefficients[channel] = SPEAKERS[bit][0];
+            matrix._coefficients[channels + channel] = SPEAKERS[bit][1];
+            ++channel;
+        }
+    }
+    if (channel < channels)
+        throw std::runtime_error("Unsupported channel layout");
+
+    // Full scale on all channels at once must not exceed full scale
+    float peak = 1;
+    for (int o = 0; o < 2; ++o) {
+        float sum = 0;
+        for (int c = 0; c < channels; ++c) {
+            sum += matrix.Get(o, c);
+        }
+        peak = sum > peak ? sum : peak;
+    }
+    for (size_t i = 0; i < matrix._coefficients.size(); ++i) {
+        matrix._coefficients[i] /= peak;
+    }
+    return matrix;
+}
+
+} // namespace mp3enc
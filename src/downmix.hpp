@@ -0,0 +1,75 @@
+//
+//  downmix.hpp - mixing of multichannel input down to MP3 channels
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_DOWNMIX_HPP
+#define MP3ENC_DOWNMIX_HPP
+
+#include <vector>
+
+#include <stdint.h>
+
+namespace mp3enc {
+
+    // DownmixMatrix maps input channels to the one or two channels an MP3
+    // stream carries: output channel 'o' is the sum of input channels 'c'
+    // multiplied by Get(o, c). Coefficients apply to full scale samples.
+    class DownmixMatrix {
+        int _inputs;
+        int _outputs;
+        // _outputs rows of _inputs coefficients
+        std::vector<float> _coefficients;
+
+    public:
+        // Limit of input channels, which keeps the matrix small enough
+        // to be copied on the stack
+        enum { MAX_CHANNELS = 32 };
+
+        // Empty matrix, which leaves channels as they are
+        DownmixMatrix()
+        : _inputs(0)
+        , _outputs(0) {
+        }
+
+        bool IsEmpty() const {
+            return _outputs == 0;
+        }
+
+        int GetInputs() const {
+            return _inputs;
+        }
+
+        int GetOutputs() const {
+            return _outputs;
+        }
+
+        float Get(int output, int input) const {
+            return _coefficients[output * _inputs + input];
+        }
+
+        bool operator==(const DownmixMatrix& other) const {
+            return _inputs == other._inputs && _outputs == other._outputs &&
+                _coefficients == other._coefficients;
+        }
+
+        // Parses matrix given as one or two rows separated by ';' of
+        // coefficients separated by ',', one per input channel, e.g.
+        // "0.5,0.5" mixes stereo to mono. Returns false if the text is
+        // not a valid matrix.
+        static bool Parse(const char* text, DownmixMatrix& matrix);
+
+        // Stereo downmix of a layout given by WAVE channel mask (speaker
+        // positions of the channels, in order of mask bits), zero for the
+        // default layout of the channel count. Front channels go to their
+        // sides, centre channels to both at -3 dB, surround channels to
+        // their sides at -3 dB and LFE is dropped (ITU-R BS.775), then the
+        // matrix is scaled down so that output cannot clip. Throws if
+        // the layout has fewer positions than channels.
+        static DownmixMatrix ForLayout(int channels, uint32_t channelMask);
+    }; // class DownmixMatrix
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_DOWNMIX_HPP
@@ -7,25 +7,97 @@
 #include <config.h>
 
 #include "encoder-pool.hpp"
+#include "daemon.hpp"
+#include "kernels.hpp"
 #include "mp3encoder.hpp"
+#include "pipeline.hpp"
+#include "segmented-job.hpp"
 #include "wavfile.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <stdexcept>
 #include <vector>
 
 #include <stdint.h>
 #include <stdlib.h>
 
+namespace {
+
+    using mp3enc::WavFile;
+
+    // Files up to this size (about 6 seconds of CD audio) are
+    // batched when batching is enabled
+    static const uint64_t BATCH_FILE_SIZE = 1024 * 1024;
+
+    // Default number of workers per CPU in adaptive mode, most
+    // of them active only while waiting for slow storage
+    static const size_t ADAPTIVE_WORKERS_PER_CPU = 2;
+
+    // Number of CPUs available to the workers
+    size_t availableCpus(const mp3enc::Placement& placement) {
+        const size_t cpus = static_cast<size_t>(mp3enc::platform::CpuCount());
+        return placement.IsEnabled() ? std::min(cpus, placement.GetCpuCount()) : cpus;
+    }
+
+    size_t workerCount(const mp3enc::Options& options, const mp3enc::Placement& placement) {
+        if (options.workers > 0)
+            return options.workers;
+        const size_t cpus = availableCpus(placement);
+        return options.adaptive ? cpus * ADAPTIVE_WORKERS_PER_CPU : cpus;
+    }
+
+    // MP3 file is placed next to WAV file
+    std::string mp3Path(const std::string& wavPath) {
+        std::string path(wavPath);
+        path.replace(path.begin() + path.size() - 3, path.end(), "mp3");
+        return path;
+    }
+
+    // Deletes input file when going out of scope
+    struct InputGuard {
+        WavFile* input;
+
+        InputGuard(WavFile* opened)
+        : input(opened) {
+        }
+
+        ~InputGuard() {
+            delete input;
+        }
+    };
+
+    // Opens input file ahead of encoding and lets the system read the
+    // beginning of its data in background. Returns NULL on failure,
+    // which is then reported once the file is opened for real.
+    WavFile* openAhead(const std::string& file, bool useMapping) {
+        try {
+            WavFile* input = new WavFile(file.c_str(), useMapping);
+            input->Prefetch();
+            return input;
+        } catch (std::exception&) {
+            return NULL;
+        }
+    }
+
+} // namespace
+
 namespace mp3enc {
   
-EncoderPool::EncoderPool(Glob& queue)
-// the mutex is created locked to block the workers
-// until Run() method is called
-: _lockQueue(true)
-, _queue(queue)
-, _workers(platform::CpuCount())
-, _eof(false) {
+EncoderPool::EncoderPool(const Options& options)
+: _options(options)
+, _reporter(options)
+, _incremental(options)
+, _journal(options, _incremental.GetFingerprint())
+, _archive(options)
+, _placement(options.affinity, options.skipSmt)
+, _workers(workerCount(options, _placement))
+, _scheduler(_workers.size())
+, _governor(_scheduler, _workers.size(), availableCpus(_placement)) {
     assert(!_workers.empty());
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        _scheduler.SetGroup(i, _placement.GetGroup(i));
+    }
 }
 
 //
@@ -34,92 +106,418 @@ EncoderPool::EncoderPool(Glob& queue)
 // This method is not thread-safe and it is asusmed that it is called only once
 // per lifetime of EncoderPool object.
 //        
-int EncoderPool::Run() {
+int EncoderPool::Run(DirWalker& queue) {
+    Start();
+
+    int status = 0;
+
+    // Feed workers while the directory tree is being scanned. The input
+    // size estimates encoding cost of a file. Short files are grouped in
+    // batches (--batch), so that a worker takes a number of them at once.
+    Task batch;
+    try {
+        Task task;
+        while (queue.NextFile(task.file, task.size)) {
+            _reporter.Submitted(task.size);
+            if (_options.batchSize < 2 || task.size > BATCH_FILE_SIZE) {
+                _scheduler.Submit(task);
+                continue;
+            }
+            BatchFile file;
+            file.path = task.file;
+            file.size = task.size;
+            batch.batch.push_back(file);
+            batch.size += task.size;
+            if (batch.batch.size() == _options.batchSize) {
+                _scheduler.Submit(batch);
+                batch = Task();
+            }
+        }
+    } catch (std::exception& e) {
+        // Let workers complete submitted files anyway
+        utils::error("Error: %s\n", e.what());
+        status = EXIT_FAILURE;
+    }
+    if (!batch.batch.empty()) {
+        _scheduler.Submit(batch);
+    }
+    _reporter.SubmitFinished();
+
+    const int workerStatus = Finish();
+    return status != 0 ? status : workerStatus;
+}
+
+void EncoderPool::Start() {
+    _reporter.Start();
+
+    if (_options.stats && _options.resume) {
+        utils::error("Resuming: %lu files completed, %lu in progress and %lu failed to be encoded again\n",
+            static_cast<unsigned long>(_journal.GetCompletedCount()),
+            static_cast<unsigned long>(_journal.GetStartedCount()),
+            static_cast<unsigned long>(_journal.GetFailedCount()));
+    }
+
+    if (_options.stats && _placement.IsEnabled()) {
+        utils::error("Workers pinned to CPU/node: %s\n", _placement.Describe(_workers.size()).c_str());
+    }
+    if (_options.adaptive) {
+        _governor.Start();
+    }
+
     // Create worker pool
     for (size_t i = 0; i < _workers.size(); ++i) {
-        const int res = pthread_create(&_workers[i], NULL, threadProc, this);
+        _workers[i].pool = this;
+        _workers[i].index = i;
+        _workers[i].encodersCreated = 0;
+        _workers[i].encodersReused = 0;
+        _workers[i].filesSkipped = 0;
+        const int res = pthread_create(&_workers[i].thread, NULL, threadProc, &_workers[i]);
         if (res != 0) {
             // It is highly unlikely that pthread_create() fails on a healthy system.
             // If it does, the process cannot proceed further, hence abort().
             utils::abort_on_error(res);
         }
     }
+}
 
-    // Release the queue lock and let the workers do their work
-    _lockQueue.Unlock();
-    
+int EncoderPool::Finish() {
     int status = 0;
+    _scheduler.Finish();
+
+    size_t encodersCreated = 0;
+    size_t encodersReused = 0;
+    size_t filesSkipped = 0;
+    StageProfile profile;
     
     // wait until workers finish their tasks
     for (size_t i = 0; i < _workers.size(); ++i) {
         uintptr_t workerStatus = 0;
-        const int res = pthread_join(_workers[i], (void**) &workerStatus);
+        const int res = pthread_join(_workers[i].thread, (void**) &workerStatus);
         assert(res == 0);
         if (workerStatus != 0) {
             status = static_cast<int>(workerStatus);
         }
+        encodersCreated += _workers[i].encodersCreated;
+        encodersReused += _workers[i].encodersReused;
+        filesSkipped += _workers[i].filesSkipped;
+        profile.Add(_workers[i].profile);
+    }
+    if (_archive.IsEnabled() && !_archive.Close()) {
+        utils::error("Error: failed to write archive %s\n", _options.archive.c_str());
+        status = EXIT_FAILURE;
+    }
+    _governor.Stop();
+    _reporter.Stop();
+
+    if (_options.stats) {
+        utils::error("Encoders: %lu created, %lu reused\n",
+            static_cast<unsigned long>(encodersCreated),
+            static_cast<unsigned long>(encodersReused));
+        utils::error("Sample conversion: %s\n", kernels::GetInstructionSet());
+        if (_options.adaptive) {
+            utils::error("Active workers: %lu to %lu of %lu\n",
+                static_cast<unsigned long>(_governor.GetMinActive()),
+                static_cast<unsigned long>(_governor.GetMaxActive()),
+                static_cast<unsigned long>(_workers.size()));
+        }
+        if (_options.incremental) {
+            utils::error("Up-to-date files skipped: %lu\n",
+                static_cast<unsigned long>(filesSkipped));
+        }
+    }
+    if (_options.profile) {
+        profile.Print();
     }
     
     return status;
 }
 // PTHREAD's thread proc
 void* EncoderPool::threadProc(void* arg) {
-    EncoderPool* thisPtr =
-        reinterpret_cast<EncoderPool*>(arg);
-    return reinterpret_cast<void*>(thisPtr->processQueue());
+    Worker* worker =
+        reinterpret_cast<Worker*>(arg);
+    return reinterpret_cast<void*>(worker->pool->processQueue(*worker));
 }
 
-std::string EncoderPool::getFile() {
-    threading::ScopedLock lock(_lockQueue);
-    if (_eof)
-        return std::string();
-        
-    std::string file;
-
-    try {            
-        file = _queue.nextMatch();
-    } catch (...) {
-        // Let only one worker report the error
-        _eof = true;
-        throw;
-    }
-    return file;
-}
-        
-int EncoderPool::processQueue() {
+int EncoderPool::processQueue(Worker& worker) {
     int status = EXIT_SUCCESS;
+    // The I/O thread inherits affinity of the worker at creation and
+    // may run on any CPU of the worker's node. The worker itself then
+    // keeps to its CPU.
+    _placement.PinToNode(worker.index);
+    // Whole files are streamed through the worker's I/O thread
+    Pipeline* pipeline = _options.pipeline ? new Pipeline(_options.asyncIo) : NULL;
+    _placement.PinToCpu(worker.index);
+    // I/O buffers and encoders are allocated by a first call to
+    // encode() function and then re-used for all subsequent files.
+    // Being touched first by the pinned worker, their memory comes
+    // from its node.
+    std::vector<unsigned char> outBuf;
+    std::vector<unsigned char> inBuf;
+    EncoderCache encoders(_options.downmix);
+    Reporter::Results results;
+    for (Task task; _scheduler.Pop(worker.index, task); ) {
+        // Time blocked on a task tells the governor about I/O stalls
+        const uint64_t started = _options.adaptive ? platform::MonotonicTime() : 0;
+        const uint64_t cpuStarted = _options.adaptive ? platform::ThreadCpuTime() : 0;
+        const int res = task.job
+            ? processSegment(encoders, worker.index, task.job, task.segment, inBuf, outBuf, results)
+            : task.client
+            ? processClientJob(encoders, pipeline, worker.index, task.client, inBuf, outBuf, results)
+            : !task.batch.empty()
+            ? processBatch(encoders, pipeline, worker.index, task, inBuf, outBuf, results)
+            : processFile(encoders, pipeline, worker.index, task.file, task.size, NULL,
+                inBuf, outBuf, results);
+        _reporter.Post(results);
+        if (_options.adaptive) {
+            _governor.Record(worker.index, platform::MonotonicTime() - started,
+                platform::ThreadCpuTime() - cpuStarted);
+        }
+        _scheduler.Done();
+        if (res != EXIT_SUCCESS) {
+            status = res;
+        }
+    }
+    delete pipeline;
+    worker.encodersCreated = encoders.GetCreated();
+    worker.encodersReused = encoders.GetReused();
+    return status;
+}
+
+int EncoderPool::processFile(
+    EncoderCache& encoders,
+    Pipeline* pipeline,
+    size_t worker,
+    const std::string& file,
+    uint64_t size,
+    WavFile* opened,
+    std::vector<unsigned char>& inBuf,
+    std::vector<unsigned char>& outBuf,
+    Reporter::Results& results) {
+    const std::string mp3name(mp3Path(file));
+    platform::FileInfo wavInfo = platform::FileInfo();
+    InputGuard guard(opened);
+    const uint64_t startTime = platform::MonotonicTime();
+    FileResult result;
+    result.file = file;
+    result.bytes = size;
     try {
-        // I/O buffers are allocated by a first call to encode()
-        // function and then re-used for all subsequent files
-        std::vector<unsigned char> outBuf;
-        std::vector<unsigned char> inBuf;
-        for (std::string file(getFile()); !file.empty(); file = getFile()) {
-            try {
-                // Open input WAV stream
-                WavFile input(file.c_str());
-
-                // Encode input file to MP3 using default buffer size
-                std::string mp3name(file);
-                mp3name.replace(mp3name.begin() + mp3name.size() - 3, mp3name.end(), "mp3");
-                encode(input, inBuf, outBuf, mp3name.c_str());
-
-                // Report success
-                threading::ScopedLock lock(_lockStdio);
-                printf("%s: OK\n", file.c_str());
-            } catch (std::exception& e) {
-                // Failed to process file
-                threading::ScopedLock lock(_lockStdio);
-                utils::error("%s: %s\n", file.c_str(), e.what());
-                status = EXIT_FAILURE;
+        if (_options.incremental && _incremental.IsUpToDate(file, mp3name, wavInfo)) {
+            ++_workers[worker].filesSkipped;
+            result.status = FileResult::SKIPPED;
+            results.Add(result);
+            return EXIT_SUCCESS;
+        }
+        if (_options.resume && _journal.IsCompleted(file, mp3name)) {
+            ++_workers[worker].filesSkipped;
+            result.status = FileResult::SKIPPED;
+            results.Add(result);
+            return EXIT_SUCCESS;
+        }
+        _journal.Started(file);
+
+        // Open input WAV stream unless it was opened ahead
+        if (!guard.input) {
+            guard.input = new WavFile(file.c_str(), _options.mapInput);
+        }
+        WavFile& input = *guard.input;
+
+        const size_t segmentSamples = static_cast<size_t>(_options.segmentSeconds) * input.GetSampleRate();
+        if (_archive.IsEnabled()) {
+            // The stream is appended to the archive as a whole, hence
+            // neither segments nor the pipeline are of any use
+            // Members get modification times of their WAV files
+            if (!platform::GetFileInfo(file.c_str(), wavInfo))
+                throw std::runtime_error("Failed to get WAV file information");
+            std::vector<unsigned char> mp3;
+            encodeToMemory(encoders, input, inBuf, outBuf, mp3);
+            _archive.Add(file, wavInfo.mtime, mp3);
+        } else if (segmentSamples > 0 && input.GetTotalSamples() >= 2 * segmentSamples) {
+            // Let other workers steal the rest of segments. The first
+            // segment is encoded by the worker that created the job.
+            SegmentedJob* job = new SegmentedJob(file, mp3name, wavInfo, size, input, segmentSamples,
+                _options.mapInput, _options.output);
+            for (size_t i = 1; i < job->GetSegmentCount(); ++i) {
+                Task segment;
+                segment.size = size / job->GetSegmentCount();
+                segment.job = job;
+                segment.segment = i;
+                _scheduler.Push(worker, segment);
             }
+            return processSegment(encoders, worker, job, 0, inBuf, outBuf, results);
+        } else if (pipeline) {
+            // Encode input file to MP3 using default buffer size
+            encode(encoders, *pipeline, input, mp3name.c_str(), EncoderSettings(), _options.output);
+        } else {
+            encode(encoders, input, inBuf, outBuf, mp3name.c_str(), EncoderSettings(), _options.output);
+        }
+        _journal.Completed(file, mp3name);
+        if (_options.incremental) {
+            _incremental.Commit(file, mp3name, wavInfo);
+        }
+        StageProfile profile;
+        if (_options.profile) {
+            encoders.CollectProfile(profile);
+            _workers[worker].profile.Add(profile);
         }
+
+        // Report success
+        if (_options.profile) {
+            result.profile = profile.Summary();
+        }
+        result.seconds = (platform::MonotonicTime() - startTime) / 1e9;
+        results.Add(result);
     } catch (std::exception& e) {
-        // Input queue threw critical error
-        threading::ScopedLock lock(_lockStdio);
-        utils::error("Error: %s\n", e.what());
-        status = EXIT_FAILURE;
+        if (_options.incremental) {
+            _incremental.Discard(mp3name);
+        }
+        _journal.Failed(file, e.what());
+        // Failed to process file
+        result.status = FileResult::FAILED;
+        result.error = e.what();
+        result.seconds = (platform::MonotonicTime() - startTime) / 1e9;
+        results.Add(result);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int EncoderPool::processBatch(
+    EncoderCache& encoders,
+    Pipeline* pipeline,
+    size_t worker,
+    const Task& task,
+    std::vector<unsigned char>& inBuf,
+    std::vector<unsigned char>& outBuf,
+    Reporter::Results& results) {
+    // Every file is opened while the previous one is being encoded, so
+    // that its data is on its way from the disk by the time the encoder
+    // gets to it. Up-to-date checks come first in incremental mode, hence
+    // the files are not opened ahead there.
+    const std::vector<BatchFile>& files = task.batch;
+    const bool ahead = !_options.incremental;
+    int status = EXIT_SUCCESS;
+    WavFile* next = ahead ? openAhead(files[0].path, _options.mapInput) : NULL;
+    for (size_t i = 0; i < files.size(); ++i) {
+        WavFile* input = next;
+        next = ahead && i + 1 < files.size() ? openAhead(files[i + 1].path, _options.mapInput) : NULL;
+        const int res = processFile(encoders, pipeline, worker, files[i].path, files[i].size, input,
+            inBuf, outBuf, results);
+        if (res != EXIT_SUCCESS) {
+            status = res;
+        }
     }
     return status;
 }
 
+int EncoderPool::processClientJob(
+    EncoderCache& encoders,
+    Pipeline* pipeline,
+    size_t worker,
+    ClientJob* job,
+    std::vector<unsigned char>& inBuf,
+    std::vector<unsigned char>& outBuf,
+    Reporter::Results& results) {
+    // Client jobs are expected to be short, hence they are neither
+    // segmented nor checked for being up to date
+    const uint64_t startTime = platform::MonotonicTime();
+    FileResult result;
+    result.file = job->input.empty() ? job->output : job->input;
+    result.bytes = job->pcm.size();
+    std::string error;
+    try {
+        if (job->input.empty()) {
+            // Inline PCM data is encoded in place
+            WavFile input(job->pcm.empty() ? NULL : &job->pcm[0], job->pcm.size(),
+                job->channels, job->sampleRate);
+            encode(encoders, input, inBuf, outBuf, job->output.c_str(), job->settings, _options.output);
+        } else {
+            WavFile input(job->input.c_str(), _options.mapInput);
+            platform::FileInfo info = platform::FileInfo();
+            platform::GetFileInfo(job->input.c_str(), info);
+            result.bytes = info.size;
+            if (pipeline) {
+                encode(encoders, *pipeline, input, job->output.c_str(), job->settings, _options.output);
+            } else {
+                encode(encoders, input, inBuf, outBuf, job->output.c_str(), job->settings, _options.output);
+            }
+        }
+        if (_options.profile) {
+            StageProfile profile;
+            encoders.CollectProfile(profile);
+            _workers[worker].profile.Add(profile);
+            result.profile = profile.Summary();
+        }
+    } catch (std::exception& e) {
+        error = e.what();
+    }
+
+    job->Complete(error);
+    delete job;
+
+    // Failures are reported to the client, they do not
+    // affect the exit status of the daemon
+    if (!error.empty()) {
+        result.status = FileResult::FAILED;
+        result.error = error;
+    }
+    result.seconds = (platform::MonotonicTime() - startTime) / 1e9;
+    results.Add(result);
+    return EXIT_SUCCESS;
+}
+
+int EncoderPool::processSegment(
+    EncoderCache& encoders,
+    size_t worker,
+    SegmentedJob* job,
+    size_t segment,
+    std::vector<unsigned char>& inBuf,
+    std::vector<unsigned char>& outBuf,
+    Reporter::Results& results) {
+    if (!job->ProcessSegment(encoders, segment, inBuf, outBuf)) {
+        // Other segments of the file are still being encoded
+        return EXIT_SUCCESS;
+    }
+
+    // The last segment of the file is done. Report the result
+    // on behalf of the whole job once output file is closed.
+    const std::string file(job->GetInput());
+    const std::string mp3name(job->GetOutput());
+    const platform::FileInfo wavInfo(job->GetInputInfo());
+    std::string error(job->GetError());
+    const StageProfile profile(job->GetProfile());
+    FileResult result;
+    result.file = file;
+    result.bytes = job->GetInputSize();
+    result.seconds = (platform::MonotonicTime() - job->GetStartTime()) / 1e9;
+    delete job;
+
+    if (_options.incremental) {
+        try {
+            if (error.empty()) {
+                _incremental.Commit(file, mp3name, wavInfo);
+            }
+        } catch (std::exception& e) {
+            error = e.what();
+        }
+        if (!error.empty()) {
+            _incremental.Discard(mp3name);
+        }
+    }
+
+    if (!error.empty()) {
+        _journal.Failed(file, error);
+        result.status = FileResult::FAILED;
+        result.error = error;
+        results.Add(result);
+        return EXIT_FAILURE;
+    }
+    _journal.Completed(file, mp3name);
+    if (_options.profile) {
+        _workers[worker].profile.Add(profile);
+        result.profile = profile.Summary();
+    }
+    results.Add(result);
+    return EXIT_SUCCESS;
+}
+
 } // namespace mp3enc
\ No newline at end of file
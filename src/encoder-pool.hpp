@@ -7,29 +7,63 @@
 #ifndef MP3ENC_ENCODER_POOL_H
 #define MP3ENC_ENCODER_POOL_H
 
-#include "glob.hpp"
+#include "archive.hpp"
+#include "governor.hpp"
+#include "incremental.hpp"
+#include "journal.hpp"
 #include "mutex.hpp"
+#include "options.hpp"
+#include "profile.hpp"
+#include "reporter.hpp"
+#include "scheduler.hpp"
+#include "topology.hpp"
+#include "walker.hpp"
 
 #include <vector>
 
 #include <pthread.h>
 
 namespace mp3enc {
+
+    class ClientJob;
+    class EncoderCache;
+    class Pipeline;
+    class WavFile;
+
     // EncoderPool class manages a pool of worker threads
     // that do the actual WAV -> MP3 encoding
     class EncoderPool {
-        // Mutex that serializes access to a queue
-        threading::Mutex _lockQueue;
-        // Mutex that serializes worker's access to standard
-        // output streams to prevent garbled output
-        threading::Mutex _lockStdio;
-        // Input queue stores filenames that match the WAV extension
-        // pattern
-        Glob& _queue;
+        // Worker thread and its position in the scheduler
+        struct Worker {
+            EncoderPool* pool;
+            size_t index;
+            pthread_t thread;
+            // Encoder cache statistics collected by the worker
+            size_t encodersCreated;
+            size_t encodersReused;
+            // Number of files skipped in incremental mode
+            size_t filesSkipped;
+            // Time spent by LAME in the stages of encoding (--profile)
+            StageProfile profile;
+        };
+
+        const Options& _options;
+        // Prints results of processed files posted by the workers
+        Reporter _reporter;
+        // Detects files that need not be encoded again
+        const Incremental _incremental;
+        // Records progress of the run (--journal)
+        Journal _journal;
+        // Collects MP3 streams instead of MP3 files (--archive)
+        Archive _archive;
+        // CPUs the workers are pinned to (--affinity)
+        const Placement _placement;
         // The horde of hard working threads
-        std::vector<pthread_t> _workers;
-        // Flag that signals that queue has been fully consumed
-        bool _eof;
+        std::vector<Worker> _workers;
+        // Per-worker task queues
+        Scheduler _scheduler;
+        // Adjusts number of active workers (--adaptive)
+        Governor _governor;
 
         EncoderPool(const EncoderPool&);
         EncoderPool& operator=(const EncoderPool&);
@@ -37,20 +71,72 @@ namespace mp3enc {
     public:
 
         // The class is designed for usage only within main() function
-        EncoderPool(Glob& queue);
+        // (or by the daemon living there)
+        EncoderPool(const Options& options);
         ~EncoderPool() {};
 
-        // Signals worker threads to start working on tasks. It is assumed
-        // that this method is called only once per lifetime of EncoderPool
-        // object and it's return value becomes the return status of the
-        // program.
-        int Run();
+        // Encodes files produced by the queue while the directory tree
+        // is being scanned. It is assumed that this method is called only
+        // once per lifetime of EncoderPool object and it's return value
+        // becomes the return status of the program.
+        int Run(DirWalker& queue);
+
+        //
+        // Building blocks of Run() for long-running callers that
+        // submit tasks as they come
+        //
+
+        // Starts worker threads
+        void Start();
+        // Queues a task. Blocks while workers are too far behind.
+        // May be called from several threads other than workers.
+        void Submit(const Task& task) {
+            _scheduler.Submit(task);
+        }
+        // Waits until workers complete submitted tasks and stops them.
+        // Returns the exit status of the program.
+        int Finish();
 
     private:
 
         static void* threadProc(void* arg);
-        std::string getFile();
-        int processQueue();
+        int processQueue(Worker& worker);
+        // Takes ownership of 'opened' input file, if any. Otherwise
+        // the file is opened by the method.
+        int processFile(
+            EncoderCache& encoders,
+            Pipeline* pipeline,
+            size_t worker,
+            const std::string& file,
+            uint64_t size,
+            WavFile* opened,
+            std::vector<unsigned char>& inBuf,
+            std::vector<unsigned char>& outBuf,
+            Reporter::Results& results);
+        int processBatch(
+            EncoderCache& encoders,
+            Pipeline* pipeline,
+            size_t worker,
+            const Task& task,
+            std::vector<unsigned char>& inBuf,
+            std::vector<unsigned char>& outBuf,
+            Reporter::Results& results);
+        int processClientJob(
+            EncoderCache& encoders,
+            Pipeline* pipeline,
+            size_t worker,
+            ClientJob* job,
+            std::vector<unsigned char>& inBuf,
+            std::vector<unsigned char>& outBuf,
+            Reporter::Results& results);
+        int processSegment(
+            EncoderCache& encoders,
+            size_t worker,
+            SegmentedJob* job,
+            size_t segment,
+            std::vector<unsigned char>& inBuf,
+            std::vector<unsigned char>& outBuf,
+            Reporter::Results& results);
     }; // class EncoderPool
 } // namespace mp3enc
 
@@ -858,6 +858,56 @@ lame_encode_buffer_interleaved_int(
         const int       mp3buf_size );     /* number of valid octets in this
                                               stream                        */
 
+/*
+ * OPTIONAL:
+ * lame_get_input_buffer and lame_commit_input_buffer let the caller
+ * write planar float samples straight into the encoder's own frame
+ * buffers, which saves the copies lame_encode_buffer_float() makes.
+ * Samples are in the same range as for lame_encode_buffer_float(), or
+ * for lame_encode_buffer_ieee_float() (see below).
+ *
+ * lame_get_input_buffer stores pointers to where the next samples of
+ * the left and right channel go to (the right one is NULL for mono
+ * output) and returns how many samples per channel may be written
+ * there, always at least one frame.  The pointers are only valid until
+ * the next call into the encoder.
+ *
+ * lame_commit_input_buffer encodes the first 'nsamples' samples written
+ * there and returns number of bytes output to mp3buf, as
+ * lame_encode_buffer_float() would do for the same samples.
+ * lame_commit_input_buffer_ieee_float does the same for samples
+ * normalized to +/- 1.0, as lame_encode_buffer_ieee_float() would.
+ *
+ * Scaling set by lame_set_scale() and friends is applied to the
+ * samples in place.  Direct input is possible only if the encoder does
+ * not resample or mix channels (see lame_set_out_samplerate(),
+ * lame_set_mode()).  Otherwise lame_get_input_buffer returns -1 and
+ * samples should be passed to lame_encode_buffer_float() or
+ * lame_encode_buffer_ieee_float() instead.
+ *
+ * return code = number of samples or bytes, negative value on error
+ */
+int CDECL lame_get_input_buffer(
+        lame_t          gfp,
+        float**         pcm_l,             /* where to write left channel  */
+        float**         pcm_r );           /* where to write right channel */
+
+int CDECL lame_commit_input_buffer(
+        lame_t          gfp,
+        const int       nsamples,          /* number of samples per channel
+                                              written                       */
+        unsigned char*  mp3buf,            /* pointer to encoded MP3 stream */
+        const int       mp3buf_size );     /* number of valid octets in this
+                                              stream                        */
+
+int CDECL lame_commit_input_buffer_ieee_float(
+        lame_t          gfp,
+        const int       nsamples,          /* number of samples per channel
+                                              written                       */
+        unsigned char*  mp3buf,            /* pointer to encoded MP3 stream */
+        const int       mp3buf_size );     /* number of valid octets in this
+                                              stream                        */
+
 
 
 /*
@@ -909,6 +959,55 @@ int CDECL lame_encode_flush_nogap(
 int CDECL lame_init_bitstream(
         lame_global_flags *  gfp);    /* global context handle                 */
 
+/*
+ * OPTIONAL:
+ * lame_reset_stream brings the encoder back to the state right after
+ * lame_init_params(), so that a new and independent mp3 stream can be
+ * encoded with the same settings.  Call it after lame_encode_flush();
+ * all tables and buffers are kept, which makes it much cheaper than
+ * lame_close() followed by lame_init() and lame_init_params().
+ * lame_set_num_samples() may be called before it for the new stream.
+ *
+ * return code = 0 on success, negative value on error
+ */
+int CDECL lame_reset_stream(
+        lame_global_flags *  gfp);    /* global context handle                 */
+
+/*
+ * OPTIONAL:
+ * Time spent in the stages of encoding, accumulated by the encoder since
+ * lame_init_params() or the last lame_reset_profile() call.  Time of
+ * nested stages is not included in the time of the enclosing stage,
+ * e.g. Huffman table selection done from the quantization loops counts
+ * towards LAME_STAGE_HUFFMAN only.  Encoders only keep these counters
+ * when the library is configured with --enable-profile.
+ *
+ * return code = 0 on success, -1 if the library is built without
+ * profiling (regardless of the arguments), other negative value on error
+ */
+typedef enum lame_stage_e {
+    LAME_STAGE_INPUT = 0,   /* input conversion, resampling, buffering   */
+    LAME_STAGE_PSYCHO,      /* psychoacoustic model                      */
+    LAME_STAGE_MDCT,        /* polyphase filterbank and MDCT             */
+    LAME_STAGE_QUANTIZE,    /* quantization and noise allocation loops   */
+    LAME_STAGE_HUFFMAN,     /* bit counting and Huffman table selection  */
+    LAME_STAGE_BITSTREAM,   /* frame formatting and output               */
+    LAME_STAGE_OTHER,       /* rest of frame encoding, once per frame    */
+    LAME_STAGE_COUNT
+} lame_stage;
+
+typedef struct {
+    double        seconds[LAME_STAGE_COUNT]; /* time spent in the stage     */
+    unsigned long calls[LAME_STAGE_COUNT];   /* number of times it was run  */
+} lame_profile_t;
+
+int CDECL lame_get_profile(
+        const lame_global_flags *  gfp,  /* global context handle            */
+        lame_profile_t *           profile); /* where to store the counters */
+
+void CDECL lame_reset_profile(
+        lame_global_flags *  gfp);    /* global context handle                 */
+
 
 
 /*
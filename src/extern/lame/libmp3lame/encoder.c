@@ -326,6 +326,8 @@ lame_encode_mp3_frame(       /* Output */
 
     int     ch, gr;
 
+    PROFILE_ENTER(gfc, LAME_STAGE_OTHER);
+
     inbuf[0] = inbuf_l;
     inbuf[1] = inbuf_r;
 
@@ -371,11 +373,15 @@ lame_encode_mp3_frame(       /* Output */
             for (ch = 0; ch < cfg->channels_out; ch++) {
                 bufp[ch] = &inbuf[ch][576 + gr * 576 - FFTOFFSET];
             }
+            PROFILE_ENTER(gfc, LAME_STAGE_PSYCHO);
             ret = L3psycho_anal_vbr(gfc, bufp, gr,
                                     masking_LR, masking_MS,
                                     pe[gr], pe_MS[gr], tot_ener[gr], blocktype);
-            if (ret != 0)
+            PROFILE_LEAVE(gfc);
+            if (ret != 0) {
+                PROFILE_LEAVE(gfc);
                 return -4;
+            }
 
             if (cfg->mode == JOINT_STEREO) {
                 ms_ener_ratio[gr] = tot_ener[gr][2] + tot_ener[gr][3];
@@ -402,7 +408,9 @@ lame_encode_mp3_frame(       /* Output */
     ****************************************/
 
     /* polyphase filtering / mdct */
+    PROFILE_ENTER(gfc, LAME_STAGE_MDCT);
     mdct_sub48(gfc, inbuf[0], inbuf[1]);
+    PROFILE_LEAVE(gfc);
 
 
     /****************************************
@@ -516,6 +524,7 @@ lame_encode_mp3_frame(       /* Output */
             }
         }
     }
+    PROFILE_ENTER(gfc, LAME_STAGE_QUANTIZE);
     switch (cfg->vbr)
     {
     default:
@@ -533,6 +542,7 @@ lame_encode_mp3_frame(       /* Output */
         VBR_new_iteration_loop(gfc, (const FLOAT (*)[2])pe_use, ms_ener_ratio, masking);
         break;
     }
+    PROFILE_LEAVE(gfc);
 
 
     /****************************************
@@ -541,6 +551,7 @@ lame_encode_mp3_frame(       /* Output */
 
 
     /*  write the frame to the bitstream  */
+    PROFILE_ENTER(gfc, LAME_STAGE_BITSTREAM);
     (void) format_bitstream(gfc);
 
     /* copy mp3 bit buffer into array */
@@ -550,6 +561,7 @@ lame_encode_mp3_frame(       /* Output */
     if (cfg->write_lame_tag) {
         AddVbrFrame(gfc);
     }
+    PROFILE_LEAVE(gfc);
 
     if (cfg->analysis && gfc->pinfo != NULL) {
         int     framesize = 576 * cfg->mode_gr;
@@ -570,5 +582,6 @@ lame_encode_mp3_frame(       /* Output */
 
     updateStats(gfc);
 
+    PROFILE_LEAVE(gfc);
     return mp3count;
 }
@@ -1746,14 +1746,18 @@ lame_encode_buffer_sample_t(lame_internal_flags * gfc,
         in_buffer_ptr[0] = in_buffer[0];
         in_buffer_ptr[1] = in_buffer[1];
         /* copy in new samples into mfbuf, with resampling */
+        PROFILE_ENTER(gfc, LAME_STAGE_INPUT);
         fill_buffer(gfc, mfbuf, &in_buffer_ptr[0], nsamples, &n_in, &n_out);
 
         /* compute ReplayGain of resampled input if requested */
         if (cfg->findReplayGain && !cfg->decode_on_the_fly)
             if (AnalyzeSamples
                 (gfc->sv_rpg.rgdata, &mfbuf[0][esv->mf_size], &mfbuf[1][esv->mf_size], n_out,
-                 cfg->channels_out) == GAIN_ANALYSIS_ERROR)
+                 cfg->channels_out) == GAIN_ANALYSIS_ERROR) {
+                PROFILE_LEAVE(gfc);
                 return -6;
+            }
+        PROFILE_LEAVE(gfc);
 
 
 
@@ -1892,13 +1896,17 @@ lame_encode_buffer_template(lame_global_flags * gfp,
                 if (buffer_l == 0 || buffer_r == 0) {
                     return 0;
                 }
+                PROFILE_ENTER(gfc, LAME_STAGE_INPUT);
                 lame_copy_inbuffer(gfc, buffer_l, buffer_r, nsamples, pcm_type, aa, norm);
+                PROFILE_LEAVE(gfc);
             }
             else {
                 if (buffer_l == 0) {
                     return 0;
                 }
+                PROFILE_ENTER(gfc, LAME_STAGE_INPUT);
                 lame_copy_inbuffer(gfc, buffer_l, buffer_l, nsamples, pcm_type, aa, norm);
+                PROFILE_LEAVE(gfc);
             }
 
             return lame_encode_buffer_sample_t(gfc, nsamples, mp3buf, mp3buf_size);
@@ -2020,6 +2028,152 @@ lame_encode_buffer_interleaved_int(lame_t gfp,
 }
 
 
+/* samples can be written straight into mfbuf when fill_buffer() would
+   only copy them there: no resampling and no channel mixing by the
+   pcm_transform matrix.  Scaling is applied in place. */
+static int
+is_direct_input_possible(lame_internal_flags const *gfc)
+{
+    SessionConfig_t const *const cfg = &gfc->cfg;
+    if (sizeof(sample_t) != sizeof(float))
+        return 0;
+    if (isResamplingNecessary(cfg))
+        return 0;
+    if (cfg->channels_in != cfg->channels_out)
+        return 0;
+    if (cfg->pcm_transform[0][1] != 0)
+        return 0;
+    if (cfg->channels_out == 2 && cfg->pcm_transform[1][0] != 0)
+        return 0;
+    return 1;
+}
+
+int
+lame_get_input_buffer(lame_t gfp, float **pcm_l, float **pcm_r)
+{
+    lame_internal_flags *gfc;
+    EncStateVar_t *esv;
+
+    if (!is_lame_global_flags_valid(gfp))
+        return -3;
+    gfc = gfp->internal_flags;
+    if (!is_lame_internal_flags_valid(gfc))
+        return -3;
+    if (pcm_l == 0 || pcm_r == 0)
+        return -3;
+    if (!is_direct_input_possible(gfc))
+        return -1;
+
+    esv = &gfc->sv_enc;
+    *pcm_l = (float *) &esv->mfbuf[0][esv->mf_size];
+    *pcm_r = gfc->cfg.channels_out == 2 ? (float *) &esv->mfbuf[1][esv->mf_size] : 0;
+    return MFSIZE - esv->mf_size;
+}
+
+static int
+lame_commit_input_buffer_template(lame_t gfp, const int nsamples,
+                                  unsigned char *mp3buf, const int mp3buf_size, FLOAT norm)
+{
+    lame_internal_flags *gfc;
+    SessionConfig_t const *cfg;
+    EncStateVar_t *esv;
+    int     pcm_samples_per_frame, mf_needed;
+    int     mp3size = 0, mp3out, ret, i, ch;
+
+    if (!is_lame_global_flags_valid(gfp))
+        return -3;
+    gfc = gfp->internal_flags;
+    if (!is_lame_internal_flags_valid(gfc))
+        return -3;
+    cfg = &gfc->cfg;
+    esv = &gfc->sv_enc;
+    if (!is_direct_input_possible(gfc) || nsamples < 0 || nsamples > MFSIZE - esv->mf_size)
+        return -3;
+
+    if (nsamples == 0)
+        return 0;
+
+    /* copy out any tags that may have been written into bitstream */
+    {   /* if user specifed buffer size = 0, dont check size */
+        int const buf_size = mp3buf_size == 0 ? INT_MAX : mp3buf_size;
+        mp3out = copy_buffer(gfc, mp3buf, buf_size, 0);
+    }
+    if (mp3out < 0)
+        return mp3out;  /* not enough buffer space */
+    mp3buf += mp3out;
+    mp3size += mp3out;
+
+    PROFILE_ENTER(gfc, LAME_STAGE_INPUT);
+    /* apply input normalization and user defined re-scaling with a
+       single multiplication, as lame_copy_inbuffer() does */
+    for (ch = 0; ch < cfg->channels_out; ch++) {
+        FLOAT const m = norm * cfg->pcm_transform[ch][ch];
+        sample_t *const p = &esv->mfbuf[ch][esv->mf_size];
+        if (m != 1)
+            for (i = 0; i < nsamples; i++)
+                p[i] *= m;
+    }
+
+    /* compute ReplayGain of the new samples if requested */
+    if (cfg->findReplayGain && !cfg->decode_on_the_fly)
+        if (AnalyzeSamples
+            (gfc->sv_rpg.rgdata, &esv->mfbuf[0][esv->mf_size], &esv->mfbuf[1][esv->mf_size], nsamples,
+             cfg->channels_out) == GAIN_ANALYSIS_ERROR) {
+            PROFILE_LEAVE(gfc);
+            return -6;
+        }
+    PROFILE_LEAVE(gfc);
+
+    esv->mf_size += nsamples;
+    /* lame_encode_flush may have set gfc->mf_sample_to_encode to 0 */
+    if (esv->mf_samples_to_encode < 1) {
+        esv->mf_samples_to_encode = ENCDELAY + POSTDELAY;
+    }
+    esv->mf_samples_to_encode += nsamples;
+
+    /* encode all complete frames, each sees the same mf_needed samples
+       as it would if the samples came through lame_encode_buffer() */
+    pcm_samples_per_frame = 576 * cfg->mode_gr;
+    mf_needed = calcNeeded(cfg);
+    while (esv->mf_size >= mf_needed) {
+        int     buf_size = mp3buf_size - mp3size;
+        if (mp3buf_size == 0)
+            buf_size = INT_MAX;
+
+        ret = lame_encode_mp3_frame(gfc, esv->mfbuf[0], esv->mfbuf[1], mp3buf, buf_size);
+        if (ret < 0)
+            return ret;
+        mp3buf += ret;
+        mp3size += ret;
+
+        /* shift out old samples */
+        esv->mf_size -= pcm_samples_per_frame;
+        esv->mf_samples_to_encode -= pcm_samples_per_frame;
+        for (ch = 0; ch < cfg->channels_out; ch++)
+            for (i = 0; i < esv->mf_size; i++)
+                esv->mfbuf[ch][i] = esv->mfbuf[ch][i + pcm_samples_per_frame];
+    }
+
+    return mp3size;
+}
+
+int
+lame_commit_input_buffer(lame_t gfp, const int nsamples,
+                         unsigned char *mp3buf, const int mp3buf_size)
+{
+    /* input is assumed to be normalized to +/- 32768 for full scale */
+    return lame_commit_input_buffer_template(gfp, nsamples, mp3buf, mp3buf_size, 1.0);
+}
+
+int
+lame_commit_input_buffer_ieee_float(lame_t gfp, const int nsamples,
+                                    unsigned char *mp3buf, const int mp3buf_size)
+{
+    /* input is assumed to be normalized to +/- 1.0 for full scale */
+    return lame_commit_input_buffer_template(gfp, nsamples, mp3buf, mp3buf_size, 32767.0);
+}
+
+
 
 
 /*****************************************************************
@@ -2083,6 +2237,147 @@ lame_init_bitstream(lame_global_flags * gfp)
 }
 
 
+/* called after lame_encode_flush() to start a new, independent stream
+   with the same settings.  Unlike lame_init_params() this keeps all
+   tables and allocations, it only brings the encoder state back to
+   where lame_init_params() left it */
+int
+lame_reset_stream(lame_global_flags * gfp)
+{
+    lame_internal_flags *gfc;
+    SessionConfig_t const *cfg;
+    EncStateVar_t *esv;
+    int     i;
+
+    if (!is_lame_global_flags_valid(gfp))
+        return -3;
+    gfc = gfp->internal_flags;
+    if (!is_lame_internal_flags_valid(gfc))
+        return -3;
+    cfg = &gfc->cfg;
+    esv = &gfc->sv_enc;
+
+    /* filterbank and MDCT history, primed again by the first frame */
+    gfc->lame_encode_frame_init = 0;
+    memset(esv->sb_sample, 0, sizeof(esv->sb_sample));
+    for (i = 0; i < 19; i++)
+        esv->pefirbuf[i] = 700 * cfg->mode_gr * cfg->channels_out;
+    memset(esv->mfbuf, 0, sizeof(esv->mfbuf));
+    esv->mf_samples_to_encode = ENCDELAY + POSTDELAY;
+    esv->mf_size = ENCDELAY - MDCTDELAY; /* we pad input with this many 0's */
+
+    /* resampler history, reallocated on first use */
+    if (gfc->fill_buffer_resample_init) {
+        for (i = 0; i <= 2 * BPC; ++i) {
+            free(esv->blackfilt[i]);
+            esv->blackfilt[i] = NULL;
+        }
+        free(esv->inbuf_old[0]);
+        free(esv->inbuf_old[1]);
+        esv->inbuf_old[0] = esv->inbuf_old[1] = NULL;
+        gfc->fill_buffer_resample_init = 0;
+    }
+
+    /* padding and bit reservoir */
+    esv->slot_lag = esv->frac_SpF = 0;
+    if (cfg->vbr == vbr_off)
+        esv->slot_lag = esv->frac_SpF
+            = ((cfg->version + 1) * 72000L * cfg->avg_bitrate) % cfg->samplerate_out;
+    esv->ResvSize = 0;
+    esv->ResvMax = 0;
+    esv->ancillary_flag = 0;
+    memset(&gfc->l3_side, 0, sizeof(gfc->l3_side));
+
+    gfc->ov_enc.padding = 0;
+    gfc->ov_enc.mode_ext = 0;
+    gfc->ov_enc.encoder_padding = 0;
+    gfc->ov_enc.encoder_delay = ENCDELAY;
+    if (cfg->vbr != vbr_off)
+        gfc->ov_enc.bitrate_index = 1;
+
+    /* quantizer step adaption */
+    gfc->sv_qnt.OldValue[0] = 180;
+    gfc->sv_qnt.OldValue[1] = 180;
+    gfc->sv_qnt.CurrentStep[0] = 4;
+    gfc->sv_qnt.CurrentStep[1] = 4;
+    gfc->sv_qnt.masking_lower = 1;
+    memset(gfc->sv_qnt.pseudohalf, 0, sizeof(gfc->sv_qnt.pseudohalf));
+
+    psymodel_reset(gfc);
+
+    /* ReplayGain and clipping detection */
+    gfc->ov_rpg.RadioGain = 0;
+    gfc->ov_rpg.noclipGainChange = 0;
+    gfc->ov_rpg.noclipScale = -1.0;
+    if (cfg->findReplayGain)
+        (void) InitGainAnalysis(gfc->sv_rpg.rgdata, cfg->samplerate_out);
+#ifdef DECODE_ON_THE_FLY
+    if (gfc->hip) {
+        hip_decode_exit(gfc->hip);
+        gfc->hip = hip_decode_init();
+        hip_set_errorf(gfc->hip, gfp->report.errorf);
+        hip_set_debugf(gfc->hip, gfp->report.debugf);
+        hip_set_msgf(gfc->hip, gfp->report.msgf);
+    }
+#endif
+    gfc->nMusicCRC = 0;
+
+    /* empty bitstream, then write id3v2 and Xing headers again */
+    memset(esv->header, 0, sizeof(esv->header));
+    esv->h_ptr = esv->w_ptr = 0;
+    gfc->bs.buf_byte_idx = -1;
+    gfc->bs.buf_bit_idx = 0;
+    gfc->bs.totbit = 0;
+
+    return lame_init_bitstream(gfp);
+}
+
+
+/* copies stage counters of the encoder, see lame.h */
+int
+lame_get_profile(const lame_global_flags * gfp, lame_profile_t * profile)
+{
+#ifdef STAGE_PROFILE
+    lame_internal_flags const *gfc;
+    double  tick;
+    int     i;
+
+    if (!is_lame_global_flags_valid(gfp))
+        return -3;
+    gfc = gfp->internal_flags;
+    if (!is_lame_internal_flags_valid(gfc))
+        return -3;
+    tick = profile_tick_seconds();
+    for (i = 0; i < LAME_STAGE_COUNT; i++) {
+        profile->seconds[i] = gfc->profile.ticks[i] * tick;
+        profile->calls[i] = gfc->profile.calls[i];
+    }
+    return 0;
+#else
+    (void) gfp;
+    (void) profile;
+    return -1;
+#endif
+}
+
+
+void
+lame_reset_profile(lame_global_flags * gfp)
+{
+#ifdef STAGE_PROFILE
+    if (is_lame_global_flags_valid(gfp)) {
+        lame_internal_flags *const gfc = gfp->internal_flags;
+        if (is_lame_internal_flags_valid(gfc)) {
+            memset(gfc->profile.ticks, 0, sizeof(gfc->profile.ticks));
+            memset(gfc->profile.calls, 0, sizeof(gfc->profile.calls));
+        }
+    }
+#else
+    (void) gfp;
+#endif
+}
+
+
 /*****************************************************************/
 /* flush internal PCM sample buffers, then mp3 buffers           */
 /* then write id3 v1 tags into bitstream.                        */
@@ -1874,6 +1874,46 @@ init_s3_values(FLOAT ** p, int (*s3ind)[2], int npart,
     return 0;
 }
 
+/* reset the psychoacoustic model to the state of a fresh stream */
+void
+psymodel_reset(lame_internal_flags * gfc)
+{
+    PsyStateVar_t *const psv = &gfc->sv_psy;
+    int     i, j, sb;
+
+    psv->blocktype_old[0] = psv->blocktype_old[1] = NORM_TYPE; /* the vbr header is long blocks */
+
+    for (i = 0; i < 4; ++i) {
+        for (j = 0; j < CBANDS; ++j) {
+            psv->nb_l1[i][j] = 1e20;
+            psv->nb_l2[i][j] = 1e20;
+            psv->nb_s1[i][j] = psv->nb_s2[i][j] = 1.0;
+        }
+        for (sb = 0; sb < SBMAX_l; sb++) {
+            psv->en[i].l[sb] = 1e20;
+            psv->thm[i].l[sb] = 1e20;
+        }
+        for (j = 0; j < 3; ++j) {
+            for (sb = 0; sb < SBMAX_s; sb++) {
+                psv->en[i].s[sb][j] = 1e20;
+                psv->thm[i].s[sb][j] = 1e20;
+            }
+            psv->last_attacks[i] = 0;
+        }
+        for (j = 0; j < 9; j++)
+            psv->last_en_subshort[i][j] = 10.;
+        psv->tot_ener[i] = 0;
+    }
+
+
+    /* init. for loudness approx. -jd 2001 mar 27 */
+    psv->loudness_sq_save[0] = psv->loudness_sq_save[1] = 0.0;
+    memset(&gfc->ov_psy, 0, sizeof(gfc->ov_psy));
+
+    gfc->ATH->adjust_factor = 0.01; /* minimum, for leading low loudness */
+    gfc->ATH->adjust_limit = 1.0; /* on lead, allow adjust up to maximum */
+}
+
 int
 psymodel_init(lame_global_flags const *gfp)
 {
@@ -1904,32 +1944,7 @@ psymodel_init(lame_global_flags const *gfp)
 
     gd->force_short_block_calc = gfp->experimentalZ;
 
-    psv->blocktype_old[0] = psv->blocktype_old[1] = NORM_TYPE; /* the vbr header is long blocks */
-
-    for (i = 0; i < 4; ++i) {
-        for (j = 0; j < CBANDS; ++j) {
-            psv->nb_l1[i][j] = 1e20;
-            psv->nb_l2[i][j] = 1e20;
-            psv->nb_s1[i][j] = psv->nb_s2[i][j] = 1.0;
-        }
-        for (sb = 0; sb < SBMAX_l; sb++) {
-            psv->en[i].l[sb] = 1e20;
-            psv->thm[i].l[sb] = 1e20;
-        }
-        for (j = 0; j < 3; ++j) {
-            for (sb = 0; sb < SBMAX_s; sb++) {
-                psv->en[i].s[sb][j] = 1e20;
-                psv->thm[i].s[sb][j] = 1e20;
-            }
-            psv->last_attacks[i] = 0;
-        }
-        for (j = 0; j < 9; j++)
-            psv->last_en_subshort[i][j] = 10.;
-    }
-
-
-    /* init. for loudness approx. -jd 2001 mar 27 */
-    psv->loudness_sq_save[0] = psv->loudness_sq_save[1] = 0.0;
+    psymodel_reset(gfc);
 
 
 
@@ -2082,8 +2097,6 @@ psymodel_init(lame_global_flags const *gfp)
      */
 #define  frame_duration (576. * cfg->mode_gr / sfreq)
     gfc->ATH->decay = pow(10., -12. / 10. * frame_duration);
-    gfc->ATH->adjust_factor = 0.01; /* minimum, for leading low loudness */
-    gfc->ATH->adjust_limit = 1.0; /* on lead, allow adjust up to maximum */
 #undef  frame_duration
 
     assert(gd->l.bo[SBMAX_l - 1] <= gd->l.npart);
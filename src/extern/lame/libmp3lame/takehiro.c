@@ -651,9 +651,9 @@ choose_table_nonMMX(const int *ix, const int *const end, int *const _s)
 /*************************************************************************/
 /*	      count_bit							 */
 /*************************************************************************/
-int
-noquant_count_bits(lame_internal_flags const *const gfc,
-                   gr_info * const gi, calc_noise_data * prev_noise)
+static int
+noquant_count_bits_body(lame_internal_flags const *const gfc,
+                        gr_info * const gi, calc_noise_data * prev_noise)
 {
     SessionConfig_t const *const cfg = &gfc->cfg;
     int     bits = 0;
@@ -764,6 +764,18 @@ noquant_count_bits(lame_internal_flags const *const gfc,
     return bits;
 }
 
+int
+noquant_count_bits(lame_internal_flags const *const gfc,
+                   gr_info * const gi, calc_noise_data * prev_noise)
+{
+    int     bits;
+
+    PROFILE_ENTER(gfc, LAME_STAGE_HUFFMAN);
+    bits = noquant_count_bits_body(gfc, gi, prev_noise);
+    PROFILE_LEAVE(gfc);
+    return bits;
+}
+
 int
 count_bits(lame_internal_flags const *const gfc,
            const FLOAT * const xr, gr_info * const gi, calc_noise_data * prev_noise)
@@ -881,8 +893,8 @@ recalc_divide_sub(const lame_internal_flags * const gfc,
 
 
 
-void
-best_huffman_divide(const lame_internal_flags * const gfc, gr_info * const gi)
+static void
+best_huffman_divide_body(const lame_internal_flags * const gfc, gr_info * const gi)
 {
     SessionConfig_t const *const cfg = &gfc->cfg;
     int     i, a1, a2;
@@ -956,6 +968,14 @@ best_huffman_divide(const lame_internal_flags * const gfc, gr_info * const gi)
     }
 }
 
+void
+best_huffman_divide(const lame_internal_flags * const gfc, gr_info * const gi)
+{
+    PROFILE_ENTER(gfc, LAME_STAGE_HUFFMAN);
+    best_huffman_divide_body(gfc, gi);
+    PROFILE_LEAVE(gfc);
+}
+
 static const int slen1_n[16] = { 1, 1, 1, 1, 8, 2, 2, 2, 4, 4, 4, 8, 8, 8, 16, 16 };
 static const int slen2_n[16] = { 1, 2, 4, 8, 1, 2, 4, 8, 2, 4, 8, 2, 4, 8, 4, 8 };
 const int slen1_tab[16] = { 0, 0, 0, 0, 3, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4 };
@@ -1013,6 +1013,80 @@ init_log_table(void)
 }
 
 
+#endif
+
+
+#ifdef STAGE_PROFILE
+
+/***********************************************************************
+ *
+ *  stage profiling
+ *
+ *  Every stage switch reads the clock once and charges the time since
+ *  the previous switch to the stage on top of the stack, so the time
+ *  of nested stages is not counted twice.
+ *
+ ***********************************************************************/
+
+#if defined(_WIN32)
+
+static uint64_t
+profile_clock(void)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (uint64_t) now.QuadPart;
+}
+
+double
+profile_tick_seconds(void)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return 1.0 / (double) frequency.QuadPart;
+}
+
+#else
+
+#include <time.h>
+
+static uint64_t
+profile_clock(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+double
+profile_tick_seconds(void)
+{
+    return 1e-9;
+}
+
+#endif
+
+void
+profile_enter(StageProfile_t * profile, int stage)
+{
+    uint64_t const now = profile_clock();
+    assert(profile->depth < PROFILE_MAX_DEPTH);
+    if (profile->depth > 0)
+        profile->ticks[profile->stack[profile->depth - 1]] += now - profile->mark;
+    profile->stack[profile->depth++] = stage;
+    profile->calls[stage]++;
+    profile->mark = now;
+}
+
+void
+profile_leave(StageProfile_t * profile)
+{
+    uint64_t const now = profile_clock();
+    assert(profile->depth > 0);
+    profile->ticks[profile->stack[--profile->depth]] += now - profile->mark;
+    profile->mark = now;
+}
+
 #endif
 
 /* end of util.c */
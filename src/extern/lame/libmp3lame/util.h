@@ -460,6 +460,19 @@ extern  "C" {
     } SessionConfig_t;
 
 
+#ifdef STAGE_PROFILE
+    /* time spent in the stages of encoding, see lame_get_profile() */
+#define PROFILE_MAX_DEPTH 8
+    typedef struct {
+        uint64_t ticks[LAME_STAGE_COUNT]; /* exclusive time of every stage */
+        unsigned long calls[LAME_STAGE_COUNT];
+        int     stack[PROFILE_MAX_DEPTH]; /* stages entered and not left yet */
+        int     depth;
+        uint64_t mark;       /* clock reading at the last stage switch */
+    } StageProfile_t;
+#endif
+
+
     struct lame_internal_flags {
 
   /********************************************************************
@@ -541,6 +554,10 @@ extern  "C" {
         lame_report_function report_msg;
         lame_report_function report_dbg;
         lame_report_function report_err;
+
+#ifdef STAGE_PROFILE
+        StageProfile_t profile;
+#endif
     };
 
 #ifndef lame_internal_flags_defined
@@ -584,6 +601,22 @@ extern  "C" {
                                    size_t len, sample_t pcm_l[], sample_t pcm_r[]);
 
 
+/* stage profiling: time between PROFILE_ENTER and the matching
+   PROFILE_LEAVE is charged to the stage, minus time of the stages
+   entered in between. Both accept const gfc, since the counters
+   are not part of the encoder state. */
+#ifdef STAGE_PROFILE
+    void    profile_enter(StageProfile_t * profile, int stage);
+    void    profile_leave(StageProfile_t * profile);
+    double  profile_tick_seconds(void);
+#define PROFILE_ENTER(gfc, stage) profile_enter((StageProfile_t *) &(gfc)->profile, (stage))
+#define PROFILE_LEAVE(gfc) profile_leave((StageProfile_t *) &(gfc)->profile)
+#else
+#define PROFILE_ENTER(gfc, stage) ((void) 0)
+#define PROFILE_LEAVE(gfc) ((void) 0)
+#endif
+
+
     extern int has_MMX(void);
     extern int has_3DNow(void);
     extern int has_SSE(void);
@@ -11,6 +11,7 @@
 #include "platform.hpp"
 
 #include <cerrno>
+#include <string>
 
 #include <stdio.h>
 
@@ -23,7 +24,9 @@ namespace mp3enc {
         File(const File&);
         File& operator=(const File&);
     public:
-        File(FILE* file) : _file(file) {
+        // Standard streams are wrapped with 'owned' set to false, so
+        // that they are left open
+        File(FILE* file, bool owned = true) : _file(file), _owned(owned) {
             if (!file) {
                 // It is assummed that File() constructor is called from either InputFile
                 // or OutputFile constructors with return value of fopen as it's argument.
@@ -32,11 +35,15 @@ namespace mp3enc {
             }
         }
 
+        // Object that is not associated with any stream
+        File() : _file(NULL), _owned(false) {
+        }
+
         // It is expected that objects of this and derived classes are always placed
         // on the stack and never deleted through pointers. Therefore, it is acceptable
         // to use non-virtual destructor here.
         ~File() {
-            if (_file) {
+            if (_file && _owned) {
                 fclose(_file);
                 _file = NULL;
             }
@@ -49,9 +56,39 @@ namespace mp3enc {
         bool Eof() const {
             return _file && feof(_file) != 0;
         }
+
+        // Set file position relative to the beginning of the file.
+        // Offsets are 64-bit, since RF64 files exceed 4 GB.
+        bool Seek(uint64_t offset) {
+#if defined(_WIN32)
+            return _fseeki64(_file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+            return fseeko(_file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+        }
+
+        // Current file position
+        uint64_t Tell() const {
+#if defined(_WIN32)
+            return static_cast<uint64_t>(_ftelli64(_file));
+#else
+            return static_cast<uint64_t>(ftello(_file));
+#endif
+        }
+
+        // Descriptor of the file for positioned I/O that bypasses
+        // the stream and its buffer
+        int Descriptor() const {
+#if defined(_WIN32)
+            return _fileno(_file);
+#else
+            return fileno(_file);
+#endif
+        }
         
     protected:
         FILE* _file;
+        bool _owned;
     }; // class File
 
     class InputFile : public File {
@@ -62,6 +99,15 @@ namespace mp3enc {
         : File(fopen(path, "rb")) {
         }
 
+        // Reads already open stream, e.g. standard input
+        explicit InputFile(FILE* stream)
+        : File(stream, false) {
+        }
+
+        // Placeholder for data that is already in memory
+        InputFile() {
+        }
+
         ~InputFile() {
         }
 
@@ -74,22 +120,198 @@ namespace mp3enc {
         size_t Read(void* buf, size_t size) {
             return fread(buf, 1, size, _file);
         }
+        // Skip size bytes by reading them, so that non-seekable
+        // streams like pipes can be skipped as well
+        bool Skip(uint64_t size) {
+            char buf[4096];
+            while (size > 0) {
+                const size_t chunk = size < sizeof(buf) ? static_cast<size_t>(size) : sizeof(buf);
+                if (Read(buf, chunk) != chunk)
+                    return false;
+                size -= chunk;
+            }
+            return true;
+        }
     }; // class InputFile
 
+    // How MP3 files are written
+    struct OutputMode {
+        // When file data and its publication are flushed to the disk
+        enum Sync {
+            // Left to the system. A crash of the process never leaves
+            // incomplete files, a crash of the system may.
+            SYNC_NONE,
+            // File data is on the disk before the file is published
+            SYNC_FILE,
+            // Publication is on the disk as well
+            SYNC_FULL
+        };
+
+        // Keep written data out of page cache
+        bool uncached;
+        Sync sync;
+
+        OutputMode()
+        : uncached(false)
+        , sync(SYNC_NONE) {
+        }
+    };
+
     class OutputFile : public File {
+        // Written data is handed to the disk in windows of this size.
+        // Large enough for the disk to write them efficiently.
+        enum { WRITE_BEHIND_WINDOW = 8 * 1024 * 1024 };
+
+        // Keep written data out of page cache
+        bool _uncached;
+        bool _preallocated;
+        OutputMode::Sync _sync;
+        // Final path of a file being written to a temporary
+        // file, empty otherwise
+        std::string _path;
+        std::string _tempPath;
+        // Position of the stream
+        uint64_t _position;
+        // End of written data, end of data the disk is writing
+        // and end of data dropped from page cache
+        uint64_t _end;
+        uint64_t _writtenBack;
+        uint64_t _dropped;
+
         OutputFile(const OutputFile&);
         OutputFile& operator=(const OutputFile&);
     public:
         OutputFile(const char* path) 
-        : File(fopen(path, "wb")) {
+        : File(fopen(path, "wb"))
+        , _uncached(false)
+        , _preallocated(false)
+        , _sync(OutputMode::SYNC_NONE)
+        , _position(0)
+        , _end(0)
+        , _writtenBack(0)
+        , _dropped(0) {
+        }
+
+        // File that appears at its path only when it is complete. Data
+        // is written to a temporary file next to it, which replaces the
+        // file at the path once Publish() is called; if it is not, the
+        // temporary file is removed.
+        //
+        // Uncached output does not fill page cache with data nobody is
+        // going to read soon: written data is handed to the disk behind
+        // the writer and dropped from the cache once it is on the disk.
+        // Disk space for expected size of the file, if known (non-zero),
+        // is reserved up front to avoid fragmentation.
+        OutputFile(const char* path, const OutputMode& mode, uint64_t expectedSize)
+        : _uncached(mode.uncached)
+        , _preallocated(false)
+        , _sync(mode.sync)
+        , _path(path)
+        , _position(0)
+        , _end(0)
+        , _writtenBack(0)
+        , _dropped(0) {
+            _file = platform::CreateTempFile(path, _tempPath);
+            if (!_file)
+                throw CRuntimeError(errno);
+            _owned = true;
+            if (expectedSize > 0) {
+                _preallocated = platform::PreallocateFile(Descriptor(), expectedSize);
+            }
+        }
+
+        // Writes to already open stream, e.g. standard output
+        explicit OutputFile(FILE* stream)
+        : File(stream, false)
+        , _uncached(false)
+        , _preallocated(false)
+        , _sync(OutputMode::SYNC_NONE)
+        , _position(0)
+        , _end(0)
+        , _writtenBack(0)
+        , _dropped(0) {
         }
 
         ~OutputFile() {
+            if (!_file)
+                return;
+            if (!_tempPath.empty()) {
+                // Not published
+                fclose(_file);
+                _file = NULL;
+                remove(_tempPath.c_str());
+                return;
+            }
+            finish();
         }
 
         // Read buffer
         size_t Write(const void* buf, size_t size) {
-            return fwrite(buf, 1, size, _file);
+            const size_t written = fwrite(buf, 1, size, _file);
+            _position += written;
+            Written(_position);
+            return written;
+        }
+        // Pass buffered data to the system
+        bool Flush() {
+            return fflush(_file) == 0;
+        }
+
+        // Set file position relative to the beginning of the file
+        bool Seek(uint64_t offset) {
+            if (!File::Seek(offset))
+                return false;
+            _position = offset;
+            return true;
+        }
+
+        // Completes temporary file and moves it to the final path,
+        // replacing the file that is there. Returns false on error,
+        // in which case the temporary file is removed.
+        bool Publish() {
+            const bool synced = finish() && (_sync == OutputMode::SYNC_NONE || platform::SyncFile(Descriptor()));
+            const bool closed = fclose(_file) == 0;
+            _file = NULL;
+            if (!synced || !closed || !platform::RenameFile(_tempPath.c_str(), _path.c_str())) {
+                remove(_tempPath.c_str());
+                _tempPath.clear();
+                return false;
+            }
+            _tempPath.clear();
+            return _sync != OutputMode::SYNC_FULL || platform::SyncParentDirectory(_path.c_str());
+        }
+
+        // Tells that the file is written up to given offset. Called by
+        // Write() and by those who write to Descriptor() directly.
+        void Written(uint64_t end) {
+            if (end > _end) {
+                _end = end;
+            }
+            if (!_uncached || _end - _writtenBack < WRITE_BEHIND_WINDOW)
+                return;
+            // Let the disk write the new window while the previous
+            // one, which is most likely written by now, is dropped
+            fflush(_file);
+            platform::StartWriteBack(Descriptor(), _writtenBack, _end - _writtenBack);
+            if (_writtenBack > _dropped) {
+                platform::DropCachedRange(Descriptor(), _dropped, _writtenBack - _dropped);
+                _dropped = _writtenBack;
+            }
+            _writtenBack = _end;
+        }
+
+    private:
+        // Passes buffered data to the system and releases resources
+        // held for writing. Returns false if anything failed to write.
+        bool finish() {
+            const bool flushed = fflush(_file) == 0 && !Error();
+            if (_preallocated) {
+                platform::ReleasePreallocation(Descriptor());
+            }
+            if (_uncached) {
+                platform::DropCachedRange(Descriptor(), 0, 0);
+            }
+            return flushed;
         }
     }; // class InputFile
     
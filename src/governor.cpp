@@ -0,0 +1,129 @@
+//
+//  governor.cpp - adaptive number of active workers
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "governor.hpp"
+#include "platform.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace {
+
+    // How often the number of active workers is revised, in milliseconds
+    static const unsigned INTERVAL = 1000;
+
+    // CPUs are considered saturated above this share of their time
+    static const double SATURATED = 0.95;
+    // Workers are added only while CPUs are used below this share...
+    static const double UNDERUSED = 0.85;
+    // ...and workers are blocked for at least this share of their time
+    static const double STALLED = 0.25;
+
+} // namespace
+
+namespace mp3enc {
+
+Governor::Governor(Scheduler& scheduler, size_t workers, size_t cpus)
+: _scheduler(scheduler)
+, _loads(workers)
+, _cpus(std::max<size_t>(cpus, 1))
+, _started(false)
+, _stopping(0)
+, _minActive(0)
+, _maxActive(0) {
+    assert(workers > 0);
+}
+
+Governor::~Governor() {
+    Stop();
+}
+
+void Governor::Start() {
+    const size_t active = std::min(_cpus, _loads.size());
+    _scheduler.SetActive(active);
+    _minActive = active;
+    _maxActive = active;
+    const int res = pthread_create(&_thread, NULL, threadProc, this);
+    if (res != 0) {
+        // Same reasoning as in EncoderPool::Start()
+        utils::abort_on_error(res);
+    }
+    _started = true;
+}
+
+void Governor::Stop() {
+    if (!_started)
+        return;
+    threading::AtomicStore(&_stopping, 1);
+    _parker.Unpark();
+    const int res = pthread_join(_thread, NULL);
+    assert(res == 0);
+    _started = false;
+}
+
+void Governor::Record(size_t worker, uint64_t wallTime, uint64_t cpuTime) {
+    assert(worker < _loads.size());
+    // Only the worker itself updates its totals. They wrap around,
+    // which is harmless since the governor uses differences only.
+    Load& load = _loads[worker];
+    const size_t blocked = wallTime > cpuTime ? static_cast<size_t>((wallTime - cpuTime) / 1000) : 0;
+    threading::AtomicStore(&load.busy, load.busy + static_cast<size_t>(wallTime / 1000));
+    threading::AtomicStore(&load.blocked, load.blocked + blocked);
+}
+
+// PTHREAD's thread proc
+void* Governor::threadProc(void* arg) {
+    reinterpret_cast<Governor*>(arg)->run();
+    return NULL;
+}
+
+void Governor::run() {
+    std::vector<size_t> busy(_loads.size());
+    std::vector<size_t> blocked(_loads.size());
+    uint64_t lastTime = platform::MonotonicTime();
+    uint64_t lastCpuTime = platform::ProcessCpuTime();
+
+    while (threading::AtomicLoad(&_stopping) == 0) {
+        _parker.Park(INTERVAL);
+
+        size_t busyTime = 0;
+        size_t blockedTime = 0;
+        for (size_t i = 0; i < _loads.size(); ++i) {
+            const size_t nowBusy = threading::AtomicLoad(&_loads[i].busy);
+            const size_t nowBlocked = threading::AtomicLoad(&_loads[i].blocked);
+            busyTime += nowBusy - busy[i];
+            blockedTime += nowBlocked - blocked[i];
+            busy[i] = nowBusy;
+            blocked[i] = nowBlocked;
+        }
+        const uint64_t now = platform::MonotonicTime();
+        const uint64_t cpuTime = platform::ProcessCpuTime();
+        const double elapsed = static_cast<double>(now - lastTime);
+        const double usage = elapsed > 0 ? (cpuTime - lastCpuTime) / (elapsed * _cpus) : 0;
+        const double stall = busyTime > 0 ? static_cast<double>(blockedTime) / busyTime : 0;
+        lastTime = now;
+        lastCpuTime = cpuTime;
+
+        // Workers blocked while CPUs are saturated wait for a CPU
+        // rather than for I/O
+        size_t active = _scheduler.GetActive();
+        if (usage >= SATURATED && active > _cpus) {
+            --active;
+        } else if (usage < UNDERUSED && stall >= STALLED && active < _loads.size()) {
+            ++active;
+        } else {
+            continue;
+        }
+        _scheduler.SetActive(active);
+        _minActive = std::min(_minActive, active);
+        _maxActive = std::max(_maxActive, active);
+    }
+}
+
+} // namespace mp3enc
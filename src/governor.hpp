@@ -0,0 +1,85 @@
+//
+//  governor.hpp - adaptive number of active workers
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_GOVERNOR_HPP
+#define MP3ENC_GOVERNOR_HPP
+
+#include "atomic.hpp"
+#include "scheduler.hpp"
+
+#include <vector>
+
+#include <pthread.h>
+#include <stdint.h>
+
+namespace mp3enc {
+
+    // Governor adjusts the number of workers taking tasks (--adaptive).
+    // Once a second it compares CPU time consumed by the process with
+    // the CPUs available to it, and the time workers spent on tasks with
+    // their CPU time. Time a worker is blocked while on a task is mostly
+    // I/O wait: while CPUs are underused and workers stall, one more
+    // worker is activated to keep more I/O in flight; once CPUs are
+    // saturated, workers beyond the number of CPUs are deactivated one
+    // by one.
+    class Governor {
+        // Totals of a worker, in microseconds. Updated by the worker,
+        // read by the governor thread.
+        struct Load {
+            volatile size_t busy;
+            volatile size_t blocked;
+
+            Load()
+            : busy(0)
+            , blocked(0) {
+            }
+        };
+
+        Scheduler& _scheduler;
+        std::vector<Load> _loads;
+        // Number of CPUs the process may use
+        const size_t _cpus;
+        pthread_t _thread;
+        bool _started;
+        volatile size_t _stopping;
+        threading::Parker _parker;
+
+        // Range of active workers seen, for statistics
+        size_t _minActive;
+        size_t _maxActive;
+
+        Governor(const Governor&);
+        Governor& operator=(const Governor&);
+
+    public:
+        Governor(Scheduler& scheduler, size_t workers, size_t cpus);
+        ~Governor();
+
+        // Activates as many workers as there are CPUs and starts the
+        // governor thread
+        void Start();
+        void Stop();
+
+        // Called by a worker when it completes a task, with wall clock
+        // and CPU time it spent on the task, in nanoseconds
+        void Record(size_t worker, uint64_t wallTime, uint64_t cpuTime);
+
+        size_t GetMinActive() const {
+            return _minActive;
+        }
+
+        size_t GetMaxActive() const {
+            return _maxActive;
+        }
+
+    private:
+        static void* threadProc(void* arg);
+        void run();
+    }; // class Governor
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_GOVERNOR_HPP
@@ -0,0 +1,225 @@
+//
+//  incremental.cpp - detection of up-to-date MP3 files
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "incremental.hpp"
+#include "file.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <lame.h>
+
+using mp3enc::platform::FileInfo;
+
+namespace {
+
+    // Version of the sidecar file format
+    static const int STATE_VERSION = 1;
+
+    // Extension appended to MP3 path to get sidecar path
+    static const char* STATE_EXTENSION = ".mp3enc";
+
+    // Block size for hashing file contents
+    static const size_t HASH_BLOCK_SIZE = 1 << 20;
+
+    // 64-bit FNV-1a. Input is consumed in 8-byte words where possible,
+    // which is several times faster than byte at a time and good enough
+    // for change detection.
+    class Hash {
+        uint64_t _value;
+
+    public:
+        Hash()
+        : _value(14695981039346656037ULL) {
+        }
+
+        void Update(const unsigned char* data, size_t size) {
+            static const uint64_t PRIME = 1099511628211ULL;
+            for (; size >= 8; data += 8, size -= 8) {
+                uint64_t word;
+                memcpy(&word, data, sizeof(word));
+                _value = (_value ^ word) * PRIME;
+            }
+            for (; size > 0; ++data, --size) {
+                _value = (_value ^ *data) * PRIME;
+            }
+        }
+
+        uint64_t Value() const {
+            return _value;
+        }
+    }; // class Hash
+
+    uint64_t hashString(const std::string& str) {
+        Hash hash;
+        hash.Update(reinterpret_cast<const unsigned char*>(str.data()), str.size());
+        return hash.Value();
+    }
+
+    uint64_t hashFile(const char* path) {
+        mp3enc::InputFile input(path);
+        std::vector<unsigned char> buf(HASH_BLOCK_SIZE);
+        Hash hash;
+        // Block size is a multiple of 8, so the words are the same
+        // as if the whole file was hashed at once
+        for (size_t read; (read = input.Read(&buf[0], buf.size())) > 0; ) {
+            hash.Update(&buf[0], read);
+        }
+        if (input.Error()) {
+            throw std::runtime_error("Failed to read WAV file");
+        }
+        return hash.Value();
+    }
+
+    // Contents of sidecar file
+    struct State {
+        uint64_t fingerprint;
+        FileInfo wav;
+        FileInfo mp3;
+        uint64_t hash;
+    };
+
+    bool readState(const std::string& path, State& state) {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+
+        int version = 0;
+        unsigned long long fingerprint = 0, wavSize = 0, mp3Size = 0, hash = 0;
+        long long wavTime = 0, mp3Time = 0;
+        const int fields = fscanf(file, "mp3enc %d %llx %llu %lld %llu %lld %llx",
+            &version, &fingerprint, &wavSize, &wavTime, &mp3Size, &mp3Time, &hash);
+        fclose(file);
+        if (fields != 7 || version != STATE_VERSION)
+            return false;
+
+        state.fingerprint = fingerprint;
+        state.wav.size = wavSize;
+        state.wav.mtime = wavTime;
+        state.mp3.size = mp3Size;
+        state.mp3.mtime = mp3Time;
+        state.hash = hash;
+        return true;
+    }
+
+    void writeState(const std::string& path, const State& state) {
+        char line[256];
+        const int len = snprintf(line, sizeof(line), "mp3enc %d %016llx %llu %lld %llu %lld %016llx\n",
+            STATE_VERSION,
+            static_cast<unsigned long long>(state.fingerprint),
+            static_cast<unsigned long long>(state.wav.size),
+            static_cast<long long>(state.wav.mtime),
+            static_cast<unsigned long long>(state.mp3.size),
+            static_cast<long long>(state.mp3.mtime),
+            static_cast<unsigned long long>(state.hash));
+
+        mp3enc::OutputFile output(path.c_str());
+        if (len <= 0 || output.Write(line, len) != static_cast<size_t>(len)) {
+            throw std::runtime_error("Failed to write state file");
+        }
+    }
+
+    bool sameFile(const FileInfo& a, const FileInfo& b) {
+        return a.size == b.size && a.mtime == b.mtime;
+    }
+
+} // namespace
+
+namespace mp3enc {
+
+Incremental::Incremental(const Options& options)
+: _sidecar(options.sidecar)
+, _fingerprint(0) {
+    // Everything that affects produced MP3 stream
+    char settings[256];
+    snprintf(settings, sizeof(settings), "lame %s; segment %u",
+        get_lame_version(), options.segmentSeconds);
+    std::string text = settings;
+    // Left out unless given, so that existing fingerprints stay valid
+    const DownmixMatrix& downmix = options.downmix;
+    for (int o = 0; o < downmix.GetOutputs(); ++o) {
+        text += o == 0 ? "; downmix " : ";";
+        for (int c = 0; c < downmix.GetInputs(); ++c) {
+            snprintf(settings, sizeof(settings), "%s%.9g", c > 0 ? "," : "", downmix.Get(o, c));
+            text += settings;
+        }
+    }
+    _fingerprint = hashString(text);
+}
+
+bool Incremental::IsUpToDate(
+    const std::string& wavPath,
+    const std::string& mp3Path,
+    FileInfo& wavInfo) const {
+    FileInfo mp3Info;
+    if (!platform::GetFileInfo(wavPath.c_str(), wavInfo) ||
+        !platform::GetFileInfo(mp3Path.c_str(), mp3Info) ||
+        mp3Info.size == 0) {
+        return false;
+    }
+
+    if (!_sidecar)
+        return mp3Info.mtime >= wavInfo.mtime;
+
+    const std::string statePath(mp3Path + STATE_EXTENSION);
+    State state;
+    if (!readState(statePath, state) ||
+        state.fingerprint != _fingerprint ||
+        !sameFile(state.mp3, mp3Info) ||
+        state.wav.size != wavInfo.size) {
+        return false;
+    }
+
+    if (state.wav.mtime == wavInfo.mtime)
+        return true;
+
+    // WAV file was touched. Compare contents.
+    if (hashFile(wavPath.c_str()) != state.hash)
+        return false;
+
+    // Remember new modification time to avoid hashing next time
+    state.wav = wavInfo;
+    writeState(statePath, state);
+    return true;
+}
+
+void Incremental::Commit(
+    const std::string& wavPath,
+    const std::string& mp3Path,
+    const FileInfo& wavInfo) const {
+    if (!_sidecar)
+        return;
+
+    const std::string statePath(mp3Path + STATE_EXTENSION);
+    State state;
+    state.fingerprint = _fingerprint;
+    state.wav = wavInfo;
+    state.hash = hashFile(wavPath.c_str());
+
+    FileInfo current;
+    if (!platform::GetFileInfo(wavPath.c_str(), current) || !sameFile(current, wavInfo) ||
+        !platform::GetFileInfo(mp3Path.c_str(), state.mp3)) {
+        // Input changed while being encoded. Let the next run
+        // encode it again.
+        remove(statePath.c_str());
+        return;
+    }
+
+    writeState(statePath, state);
+}
+
+void Incremental::Discard(const std::string& mp3Path) const {
+    if (_sidecar) {
+        remove((mp3Path + STATE_EXTENSION).c_str());
+    }
+}
+
+} // namespace mp3enc
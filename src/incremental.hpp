@@ -0,0 +1,66 @@
+//
+//  incremental.hpp - detection of up-to-date MP3 files
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_INCREMENTAL_HPP
+#define MP3ENC_INCREMENTAL_HPP
+
+#include "options.hpp"
+#include "platform.hpp"
+
+#include <string>
+
+#include <stdint.h>
+
+namespace mp3enc {
+
+    // Incremental class decides whether an MP3 file produced by one of
+    // previous runs can be kept, so that its WAV file is not encoded
+    // again.
+    //
+    // By default the MP3 file is up to date when it is not empty and
+    // not older than the WAV file. In sidecar mode the decision is based
+    // on <name>.mp3.mp3enc file written next to the MP3 after successful
+    // encoding. It records encoder settings fingerprint, sizes and
+    // modification times of both files and a content hash of the WAV
+    // file. The hash lets files that were touched or copied without
+    // changes be skipped as well.
+    class Incremental {
+        bool _sidecar;
+        uint64_t _fingerprint;
+
+    public:
+        Incremental(const Options& options);
+
+        // Fingerprint of settings that affect produced MP3 stream
+        uint64_t GetFingerprint() const {
+            return _fingerprint;
+        }
+
+        // Checks whether MP3 file is up to date. Returns attributes of
+        // WAV file the decision was based on, which are to be passed to
+        // Commit() after encoding.
+        bool IsUpToDate(
+            const std::string& wavPath,
+            const std::string& mp3Path,
+            platform::FileInfo& wavInfo) const;
+
+        // Records state of successfully encoded file. Nothing is recorded
+        // if WAV file was modified since IsUpToDate() call.
+        void Commit(
+            const std::string& wavPath,
+            const std::string& mp3Path,
+            const platform::FileInfo& wavInfo) const;
+
+        // Forgets state of a file whose encoding failed. Its MP3 file is
+        // only replaced once complete, so an existing one is kept; being
+        // older than the WAV file (or without state), it is encoded again
+        // by the next run.
+        void Discard(const std::string& mp3Path) const;
+    }; // class Incremental
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_INCREMENTAL_HPP
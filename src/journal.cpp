@@ -0,0 +1,215 @@
+//
+//  journal.cpp - journal of a run for resuming it after interruption
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "journal.hpp"
+#include "file.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+    // First line of a journal, with format version
+    static const char* JOURNAL_HEADER = "mp3enc-journal 1";
+
+    static const char* STARTED = "started";
+    static const char* DONE = "done";
+    static const char* FAILED = "failed";
+
+    // Reads a line of any length without line terminator
+    bool readLine(FILE* file, std::string& line) {
+        line.clear();
+        char buf[4096];
+        while (fgets(buf, sizeof(buf), file)) {
+            line += buf;
+            if (!line.empty() && *line.rbegin() == '\n') {
+                line.erase(line.size() - 1);
+                return true;
+            }
+        }
+        // Last line may lack terminator, unless it was cut short by
+        // the process being killed mid-write, which makes it invalid
+        // anyway
+        return !line.empty();
+    }
+
+    // Splits off the first tab separated field of 'rest'
+    bool nextField(std::string& rest, std::string& field) {
+        const std::string::size_type tab = rest.find('\t');
+        if (tab == std::string::npos)
+            return false;
+        field.assign(rest, 0, tab);
+        rest.erase(0, tab + 1);
+        return true;
+    }
+
+    std::string formatDone(uint64_t fingerprint, const mp3enc::platform::FileInfo& wav, uint64_t mp3Size) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%s\t%016llx\t%llu\t%lld\t%llu\t", DONE,
+            static_cast<unsigned long long>(fingerprint),
+            static_cast<unsigned long long>(wav.size),
+            static_cast<long long>(wav.mtime),
+            static_cast<unsigned long long>(mp3Size));
+        return buf;
+    }
+
+} // namespace
+
+namespace mp3enc {
+
+Journal::Journal(const Options& options, uint64_t fingerprint)
+: _fingerprint(fingerprint)
+, _started(0)
+, _failed(0)
+, _file(NULL)
+, _broken(false) {
+    if (options.journal.empty())
+        return;
+    const std::string& path = options.journal;
+    if (options.resume) {
+        load(path);
+    }
+
+    // Start from the files completed so far, replacing
+    // the journal at once
+    {
+        OutputFile output(path.c_str(), OutputMode(), 0);
+        std::string text(JOURNAL_HEADER);
+        text += '\n';
+        for (Entries::const_iterator it = _completed.begin(); it != _completed.end(); ++it) {
+            const Entry& entry = it->second;
+            text += formatDone(entry.fingerprint, entry.wav, entry.mp3Size) + it->first + '\n';
+        }
+        if (output.Write(text.data(), text.size()) != text.size() || !output.Publish())
+            throw std::runtime_error("Failed to write journal " + path);
+    }
+
+    _file = fopen(path.c_str(), "ab");
+    if (!_file)
+        throw CRuntimeError(errno);
+}
+
+Journal::~Journal() {
+    if (_file) {
+        fclose(_file);
+    }
+}
+
+bool Journal::IsCompleted(const std::string& wavPath, const std::string& mp3Path) const {
+    const Entries::const_iterator it = _completed.find(wavPath);
+    if (it == _completed.end())
+        return false;
+    const Entry& entry = it->second;
+    platform::FileInfo wav;
+    platform::FileInfo mp3;
+    return platform::GetFileInfo(wavPath.c_str(), wav) &&
+        wav.size == entry.wav.size && wav.mtime == entry.wav.mtime &&
+        platform::GetFileInfo(mp3Path.c_str(), mp3) && mp3.size == entry.mp3Size;
+}
+
+void Journal::Started(const std::string& wavPath) {
+    if (_file) {
+        append(std::string(STARTED) + '\t' + wavPath + '\n');
+    }
+}
+
+void Journal::Completed(const std::string& wavPath, const std::string& mp3Path) {
+    if (!_file)
+        return;
+    platform::FileInfo wav;
+    platform::FileInfo mp3;
+    if (!platform::GetFileInfo(wavPath.c_str(), wav) || !platform::GetFileInfo(mp3Path.c_str(), mp3)) {
+        // Not recorded as done, so it is encoded again on resume
+        return;
+    }
+    append(formatDone(_fingerprint, wav, mp3.size) + wavPath + '\n');
+}
+
+void Journal::Failed(const std::string& wavPath, const std::string& error) {
+    if (!_file)
+        return;
+    // Keep the record on a single line
+    std::string message(error);
+    std::replace(message.begin(), message.end(), '\n', ' ');
+    std::replace(message.begin(), message.end(), '\t', ' ');
+    append(std::string(FAILED) + '\t' + message + '\t' + wavPath + '\n');
+}
+
+void Journal::load(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        // Nothing to resume
+        return;
+    }
+
+    // The last record of a file wins
+    Entries entries;
+    std::string line;
+    if (readLine(file, line) && line == JOURNAL_HEADER) {
+        while (readLine(file, line)) {
+            std::string kind;
+            if (!nextField(line, kind))
+                continue;
+            Entry entry = Entry();
+            if (kind == STARTED) {
+                entry.state = Entry::STARTED;
+            } else if (kind == FAILED) {
+                std::string error;
+                if (!nextField(line, error))
+                    continue;
+                entry.state = Entry::FAILED;
+            } else if (kind == DONE) {
+                std::string fingerprint, wavSize, wavTime, mp3Size;
+                if (!nextField(line, fingerprint) || !nextField(line, wavSize) ||
+                    !nextField(line, wavTime) || !nextField(line, mp3Size))
+                    continue;
+                entry.state = Entry::DONE;
+                entry.fingerprint = strtoull(fingerprint.c_str(), NULL, 16);
+                entry.wav.size = strtoull(wavSize.c_str(), NULL, 10);
+                entry.wav.mtime = strtoll(wavTime.c_str(), NULL, 10);
+                entry.mp3Size = strtoull(mp3Size.c_str(), NULL, 10);
+            } else {
+                continue;
+            }
+            // What is left is the path
+            if (!line.empty()) {
+                entries[line] = entry;
+            }
+        }
+    }
+    fclose(file);
+
+    for (Entries::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+        const Entry& entry = it->second;
+        if (entry.state == Entry::STARTED) {
+            ++_started;
+        } else if (entry.state == Entry::FAILED) {
+            ++_failed;
+        } else if (entry.fingerprint == _fingerprint) {
+            // Files encoded with other settings are encoded again
+            _completed.insert(*it);
+        }
+    }
+}
+
+void Journal::append(const std::string& line) {
+    threading::ScopedLock lock(_lock);
+    if (_broken)
+        return;
+    if (fwrite(line.data(), 1, line.size(), _file) != line.size() || fflush(_file) != 0) {
+        // Encoding goes on, only resuming suffers
+        utils::error("Failed to write journal: %s\n", strerror(errno));
+        _broken = true;
+    }
+}
+
+} // namespace mp3enc
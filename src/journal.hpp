@@ -0,0 +1,100 @@
+//
+//  journal.hpp - journal of a run for resuming it after interruption
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_JOURNAL_HPP
+#define MP3ENC_JOURNAL_HPP
+
+#include "mutex.hpp"
+#include "options.hpp"
+#include "platform.hpp"
+
+#include <map>
+#include <string>
+
+#include <stdint.h>
+#include <stdio.h>
+
+namespace mp3enc {
+
+    // Journal records files a run has started, completed and failed to
+    // encode, a line per event, in a file given with --journal. Lines
+    // are flushed as they are written, so the journal survives the
+    // process being killed.
+    //
+    // With --resume, files completed by the previous run are skipped if
+    // both the WAV file and the MP3 file are as they were left (same
+    // size and, for WAV file, modification time) and the run used the
+    // same settings. Files that were in progress or failed are encoded
+    // again. The journal is compacted to completed files at start.
+    class Journal {
+        struct Entry {
+            enum State {
+                STARTED,
+                DONE,
+                FAILED
+            };
+
+            State state;
+            uint64_t fingerprint;
+            platform::FileInfo wav;
+            uint64_t mp3Size;
+        };
+
+        typedef std::map<std::string, Entry> Entries;
+
+        const uint64_t _fingerprint;
+        // Files completed by the previous run (read-only once loaded)
+        Entries _completed;
+        // Numbers of files of the previous run by their last state
+        size_t _started;
+        size_t _failed;
+
+        threading::Mutex _lock;
+        FILE* _file;
+        // Set after the first write error, which is reported once
+        bool _broken;
+
+        Journal(const Journal&);
+        Journal& operator=(const Journal&);
+
+    public:
+        // Loads the journal of the previous run in resume mode and starts
+        // a new one. 'fingerprint' identifies encoder settings.
+        Journal(const Options& options, uint64_t fingerprint);
+        ~Journal();
+
+        bool IsEnabled() const {
+            return _file != NULL;
+        }
+
+        // Checks whether the file was completed by the previous run
+        bool IsCompleted(const std::string& wavPath, const std::string& mp3Path) const;
+
+        void Started(const std::string& wavPath);
+        void Completed(const std::string& wavPath, const std::string& mp3Path);
+        void Failed(const std::string& wavPath, const std::string& error);
+
+        // Statistics of the previous run
+        size_t GetCompletedCount() const {
+            return _completed.size();
+        }
+
+        size_t GetStartedCount() const {
+            return _started;
+        }
+
+        size_t GetFailedCount() const {
+            return _failed;
+        }
+
+    private:
+        void load(const std::string& path);
+        void append(const std::string& line);
+    }; // class Journal
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_JOURNAL_HPP
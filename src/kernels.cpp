@@ -0,0 +1,554 @@
+//
+//  kernels.cpp - vectorized conversion of PCM samples for the encoder
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "kernels.hpp"
+
+#include <string.h>
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define MP3ENC_KERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// Functions using instructions beyond the baseline of the build are
+// compiled for them individually and only called if the CPU has them
+#if defined(__GNUC__)
+#define MP3ENC_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MP3ENC_TARGET(isa)
+#endif
+
+using mp3enc::kernels::SampleType;
+
+namespace {
+
+    typedef void (*Kernel)(const void*, SampleType, bool, int, size_t, float, float*, float*);
+    typedef void (*MixKernel)(const void*, SampleType, bool, int, size_t, const float*, int, float*, float*);
+
+    //
+    // Scalar code, used on its own and for the tails of vectorized loops
+    //
+
+    inline uint16_t swap16(uint16_t value) {
+        return static_cast<uint16_t>(value >> 8 | value << 8);
+    }
+
+    inline uint32_t swap32(uint32_t value) {
+        return value >> 24 | (value >> 8 & 0xFF00) | (value << 8 & 0xFF0000) | value << 24;
+    }
+
+    inline float toFloat(const int16_t* in, size_t i, bool swap) {
+        const uint16_t bits = static_cast<uint16_t>(in[i]);
+        return static_cast<float>(static_cast<int16_t>(swap ? swap16(bits) : bits));
+    }
+
+    inline float toFloat(const int32_t* in, size_t i, bool swap) {
+        const uint32_t bits = static_cast<uint32_t>(in[i]);
+        return static_cast<float>(static_cast<int32_t>(swap ? swap32(bits) : bits));
+    }
+
+    inline float toFloat(const float* in, size_t i, bool swap) {
+        if (!swap)
+            return in[i];
+        uint32_t bits = 0;
+        memcpy(&bits, in + i, sizeof(bits));
+        bits = swap32(bits);
+        float value = 0;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // Converts frames from 'begin' to 'end'
+    template <class T>
+    void convert(
+        const T* in, bool swap, int channels, size_t begin, size_t end,
+        float scale, float* left, float* right) {
+        if (channels == 1) {
+            for (size_t i = begin; i < end; ++i) {
+                left[i] = toFloat(in, i, swap) * scale;
+            }
+            return;
+        }
+        for (size_t i = begin; i < end; ++i) {
+            left[i] = toFloat(in, 2 * i, swap) * scale;
+            right[i] = toFloat(in, 2 * i + 1, swap) * scale;
+        }
+    }
+
+    void convertTail(
+        const void* samples, SampleType type, bool swap, int channels, size_t begin, size_t end,
+        float scale, float* left, float* right) {
+        switch (type) {
+        case mp3enc::kernels::INT16:
+            convert(static_cast<const int16_t*>(samples), swap, channels, begin, end, scale, left, right);
+            break;
+        case mp3enc::kernels::INT32:
+            convert(static_cast<const int32_t*>(samples), swap, channels, begin, end, scale, left, right);
+            break;
+        case mp3enc::kernels::FLOAT32:
+            convert(static_cast<const float*>(samples), swap, channels, begin, end, scale, left, right);
+            break;
+        }
+    }
+
+    // Mixes frames from 'begin' to 'end'
+    template <class T>
+    void mix(
+        const T* in, bool swap, int channels, size_t begin, size_t end,
+        const float* matrix, int outputs, float* left, float* right) {
+        const float* leftRow = matrix;
+        const float* rightRow = matrix + channels;
+        for (size_t i = begin; i < end; ++i) {
+            const T* frame = in + i * channels;
+            const float first = toFloat(frame, 0, swap);
+            float l = first * leftRow[0];
+            if (outputs == 1) {
+                for (int c = 1; c < channels; ++c) {
+                    l += toFloat(frame, c, swap) * leftRow[c];
+                }
+                left[i] = l;
+                continue;
+            }
+            float r = first * rightRow[0];
+            for (int c = 1; c < channels; ++c) {
+                const float x = toFloat(frame, c, swap);
+                l += x * leftRow[c];
+                r += x * rightRow[c];
+            }
+            left[i] = l;
+            right[i] = r;
+        }
+    }
+
+    void mixTail(
+        const void* samples, SampleType type, bool swap, int channels, size_t begin, size_t end,
+        const float* matrix, int outputs, float* left, float* right) {
+        switch (type) {
+        case mp3enc::kernels::INT16:
+            mix(static_cast<const int16_t*>(samples), swap, channels, begin, end, matrix, outputs, left, right);
+            break;
+        case mp3enc::kernels::INT32:
+            mix(static_cast<const int32_t*>(samples), swap, channels, begin, end, matrix, outputs, left, right);
+            break;
+        case mp3enc::kernels::FLOAT32:
+            mix(static_cast<const float*>(samples), swap, channels, begin, end, matrix, outputs, left, right);
+            break;
+        }
+    }
+
+    void downmixScalar(
+        const void* samples, SampleType type, bool swap, int channels, size_t frames,
+        const float* matrix, int outputs, float* left, float* right) {
+        mixTail(samples, type, swap, channels, 0, frames, matrix, outputs, left, right);
+    }
+
+    void deinterleaveScalar(
+        const void* samples, SampleType type, bool swap, int channels, size_t frames,
+        float scale, float* left, float* right) {
+        convertTail(samples, type, swap, channels, 0, frames, scale, left, right);
+    }
+
+#if defined(MP3ENC_KERNELS_X86)
+
+    //
+    // SSE2: 4 frames of stereo and 8 (16-bit) or 4 (32-bit) frames
+    // of mono input per iteration
+    //
+
+    MP3ENC_TARGET("sse2")
+    inline __m128i swap16Sse2(__m128i x) {
+        return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+    }
+
+    MP3ENC_TARGET("sse2")
+    inline __m128i swap32Sse2(__m128i x) {
+        x = swap16Sse2(x);
+        x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+        return _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+    }
+
+    // Four 32-bit samples as floats
+    MP3ENC_TARGET("sse2")
+    inline __m128 load32Sse2(const void* in, SampleType type, bool swap) {
+        __m128i x = _mm_loadu_si128(static_cast<const __m128i*>(in));
+        if (swap) {
+            x = swap32Sse2(x);
+        }
+        return type == mp3enc::kernels::FLOAT32 ? _mm_castsi128_ps(x) : _mm_cvtepi32_ps(x);
+    }
+
+    MP3ENC_TARGET("sse2")
+    void deinterleaveSse2(
+        const void* samples, SampleType type, bool swap, int channels, size_t frames,
+        float scale, float* left, float* right) {
+        const __m128 s = _mm_set1_ps(scale);
+        size_t i = 0;
+        if (type == mp3enc::kernels::INT16) {
+            const int16_t* in = static_cast<const int16_t*>(samples);
+            if (channels == 1) {
+                for (; i + 8 <= frames; i += 8) {
+                    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+                    if (swap) {
+                        x = swap16Sse2(x);
+                    }
+                    // Sign extend by shifting samples duplicated into both halves
+                    const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+                    const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+                    _mm_storeu_ps(left + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), s));
+                    _mm_storeu_ps(left + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), s));
+                }
+            } else {
+                for (; i + 4 <= frames; i += 4) {
+                    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i));
+                    if (swap) {
+                        x = swap16Sse2(x);
+                    }
+                    // Left samples are in the lower halves of 32-bit lanes
+                    const __m128i l = _mm_srai_epi32(_mm_slli_epi32(x, 16), 16);
+                    const __m128i r = _mm_srai_epi32(x, 16);
+                    _mm_storeu_ps(left + i, _mm_mul_ps(_mm_cvtepi32_ps(l), s));
+                    _mm_storeu_ps(right + i, _mm_mul_ps(_mm_cvtepi32_ps(r), s));
+                }
+            }
+        } else {
+            const int32_t* in = static_cast<const int32_t*>(samples);
+            if (channels == 1) {
+                for (; i + 4 <= frames; i += 4) {
+                    _mm_storeu_ps(left + i, _mm_mul_ps(load32Sse2(in + i, type, swap), s));
+                }
+            } else {
+                for (; i + 4 <= frames; i += 4) {
+                    const __m128 a = load32Sse2(in + 2 * i, type, swap);
+                    const __m128 b = load32Sse2(in + 2 * i + 4, type, swap);
+                    const __m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+                    const __m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+                    _mm_storeu_ps(left + i, _mm_mul_ps(l, s));
+                    _mm_storeu_ps(right + i, _mm_mul_ps(r, s));
+                }
+            }
+        }
+        convertTail(samples, type, swap, channels, i, frames, scale, left, right);
+    }
+
+    // Channel 'c' of 4 frames from 'i'
+    template <class T>
+    MP3ENC_TARGET("sse2")
+    inline __m128 channelSse2(const T* in, int channels, size_t i, int c, bool swap) {
+        const T* frame = in + i * channels + c;
+        return _mm_setr_ps(
+            toFloat(frame, 0, swap),
+            toFloat(frame, channels, swap),
+            toFloat(frame, 2 * channels, swap),
+            toFloat(frame, 3 * channels, swap));
+    }
+
+    template <class T>
+    MP3ENC_TARGET("sse2")
+    size_t mixSse2(
+        const T* in, bool swap, int channels, size_t frames,
+        const float* matrix, int outputs, float* left, float* right) {
+        const float* rightRow = matrix + channels;
+        size_t i = 0;
+        for (; i + 4 <= frames; i += 4) {
+            const __m128 first = channelSse2(in, channels, i, 0, swap);
+            __m128 l = _mm_mul_ps(first, _mm_set1_ps(matrix[0]));
+            __m128 r = outputs == 2 ? _mm_mul_ps(first, _mm_set1_ps(rightRow[0])) : l;
+            for (int c = 1; c < channels; ++c) {
+                const __m128 x = channelSse2(in, channels, i, c, swap);
+                l = _mm_add_ps(l, _mm_mul_ps(x, _mm_set1_ps(matrix[c])));
+                if (outputs == 2) {
+                    r = _mm_add_ps(r, _mm_mul_ps(x, _mm_set1_ps(rightRow[c])));
+                }
+            }
+            _mm_storeu_ps(left + i, l);
+            if (outputs == 2) {
+                _mm_storeu_ps(right + i, r);
+            }
+        }
+        return i;
+    }
+
+    // Vectorizes across frames, so any number of channels takes the same
+    // path; deinterleaving is left to scalar loads
+    MP3ENC_TARGET("sse2")
+    void downmixSse2(
+        const void* samples, SampleType type, bool swap, int channels, size_t frames,
+        const float* matrix, int outputs, float* left, float* right) {
+        size_t i = 0;
+        switch (type) {
+        case mp3enc::kernels::INT16:
+            i = mixSse2(static_cast<const int16_t*>(samples), swap, channels, frames, matrix, outputs, left, right);
+            break;
+        case mp3enc::kernels::INT32:
+            i = mixSse2(static_cast<const int32_t*>(samples), swap, channels, frames, matrix, outputs, left, right);
+            break;
+        case mp3enc::kernels::FLOAT32:
+            i = mixSse2(static_cast<const float*>(samples), swap, channels, frames, matrix, outputs, left, right);
+            break;
+        }
+        mixTail(samples, type, swap, channels, i, frames, matrix, outputs, left, right);
+    }
+
+    //
+    // AVX2: 8 frames per iteration
+    //
+
+    MP3ENC_TARGET("avx2")
+    inline __m256i swap16Avx2(__m256i x) {
+        return _mm256_or_si256(_mm256_slli_epi16(x, 8), _mm256_srli_epi16(x, 8));
+    }
+
+    // Eight 32-bit samples as floats
+    MP3ENC_TARGET("avx2")
+    inline __m256 load32Avx2(const void* in, SampleType type, bool swap) {
+        __m256i x = _mm256_loadu_si256(static_cast<const __m256i*>(in));
+        if (swap) {
+            const __m256i order = _mm256_setr_epi8(
+                3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+            x = _mm256_shuffle_epi8(x, order);
+        }
+        return type == mp3enc::kernels::FLOAT32 ? _mm256_castsi256_ps(x) : _mm256_cvtepi32_ps(x);
+    }
+
+    MP3ENC_TARGET("avx2")
+    void deinterleaveAvx2(
+        const void* samples, SampleType type, bool swap, int channels, size_t frames,
+        float scale, float* left, float* right) {
+        const __m256 s = _mm256_set1_ps(scale);
+        size_t i = 0;
+        if (type == mp3enc::kernels::INT16) {
+            const int16_t* in = static_cast<const int16_t*>(samples);
+            if (channels == 1) {
+                for (; i + 8 <= frames; i += 8) {
+                    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+                    if (swap) {
+                        x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+                    }
+                    const __m256i v = _mm256_cvtepi16_epi32(x);
+                    _mm256_storeu_ps(left + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), s));
+                }
+            } else {
+                for (; i + 8 <= frames; i += 8) {
+                    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 2 * i));
+                    if (swap) {
+                        x = swap16Avx2(x);
+                    }
+                    const __m256i l = _mm256_srai_epi32(_mm256_slli_epi32(x, 16), 16);
+                    const __m256i r = _mm256_srai_epi32(x, 16);
+                    _mm256_storeu_ps(left + i, _mm256_mul_ps(_mm256_cvtepi32_ps(l), s));
+                    _mm256_storeu_ps(right + i, _mm256_mul_ps(_mm256_cvtepi32_ps(r), s));
+                }
+            }
+        } else {
+            const int32_t* in = static_cast<const int32_t*>(samples);
+            if (channels == 1) {
+                for (; i + 8 <= frames; i += 8) {
+                    _mm256_storeu_ps(left + i, _mm256_mul_ps(load32Avx2(in + i, type, swap), s));
+                }
+            } else {
+                for (; i + 8 <= frames; i += 8) {
+                    const __m256 a = load32Avx2(in + 2 * i, type, swap);
+                    const __m256 b = load32Avx2(in + 2 * i + 8, type, swap);
+                    // Shuffles work within 128-bit lanes, which leaves
+                    // pairs of frames 0 1 4 5 2 3 6 7 to be reordered
+                    const __m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+                    const __m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+                    const int order = _MM_SHUFFLE(3, 1, 2, 0);
+                    _mm256_storeu_ps(left + i, _mm256_mul_ps(_mm256_castpd_ps(
+                        _mm256_permute4x64_pd(_mm256_castps_pd(l), order)), s));
+                    _mm256_storeu_ps(right + i, _mm256_mul_ps(_mm256_castpd_ps(
+                        _mm256_permute4x64_pd(_mm256_castps_pd(r), order)), s));
+                }
+            }
+        }
+        convertTail(samples, type, swap, channels, i, frames, scale, left, right);
+    }
+
+    // Channel 'c' of 8 frames from 'i', gathered by 'offsets' of frames
+    MP3ENC_TARGET("avx2")
+    inline __m256 channelAvx2(
+        const void* samples, SampleType type, bool swap, int channels, size_t i, int c,
+        __m256i offsets) {
+        if (type == mp3enc::kernels::INT16) {
+            // Gathers 32-bit words starting at the samples, so the upper
+            // halves hold the next samples and get shifted out
+            const int16_t* in = static_cast<const int16_t*>(samples) + i * channels + c;
+            __m256i x = _mm256_i32gather_epi32(reinterpret_cast<const int*>(in), offsets, 2);
+            if (swap) {
+                x = swap16Avx2(x);
+            }
+            return _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(x, 16), 16));
+        }
+        const int32_t* in = static_cast<const int32_t*>(samples) + i * channels + c;
+        __m256i x = _mm256_i32gather_epi32(reinterpret_cast<const int*>(in), offsets, 4);
+        if (swap) {
+            const __m256i order = _mm256_setr_epi8(
+                3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+            x = _mm256_shuffle_epi8(x, order);
+        }
+        return type == mp3enc::kernels::FLOAT32 ? _mm256_castsi256_ps(x) : _mm256_cvtepi32_ps(x);
+    }
+
+    MP3ENC_TARGET("avx2")
+    void downmixAvx2(
+        const void* samples, SampleType type, bool swap, int channels, size_t frames,
+        const float* matrix, int outputs, float* left, float* right) {
+        const float* rightRow = matrix + channels;
+        const __m256i offsets = _mm256_mullo_epi32(
+            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(channels));
+        // 16-bit gathers read a sample past the last one, so the last
+        // frame is left to scalar code
+        const size_t extra = type == mp3enc::kernels::INT16 ? 1 : 0;
+        size_t i = 0;
+        for (; i + 8 + extra <= frames; i += 8) {
+            const __m256 first = channelAvx2(samples, type, swap, channels, i, 0, offsets);
+            __m256 l = _mm256_mul_ps(first, _mm256_set1_ps(matrix[0]));
+            __m256 r = outputs == 2 ? _mm256_mul_ps(first, _mm256_set1_ps(rightRow[0])) : l;
+            for (int c = 1; c < channels; ++c) {
+                const __m256 x = channelAvx2(samples, type, swap, channels, i, c, offsets);
+                l = _mm256_add_ps(l, _mm256_mul_ps(x, _mm256_set1_ps(matrix[c])));
+                if (outputs == 2) {
+                    r = _mm256_add_ps(r, _mm256_mul_ps(x, _mm256_set1_ps(rightRow[c])));
+                }
+            }
+            _mm256_storeu_ps(left + i, l);
+            if (outputs == 2) {
+                _mm256_storeu_ps(right + i, r);
+            }
+        }
+        mixTail(samples, type, swap, channels, i, frames, matrix, outputs, left, right);
+    }
+
+#endif // #if defined(MP3ENC_KERNELS_X86)
+
+    //
+    // Detection of CPU features
+    //
+
+    bool hasScalar() {
+        return true;
+    }
+
+#if defined(MP3ENC_KERNELS_X86)
+#if defined(_MSC_VER)
+
+    bool hasSse2() {
+        int info[4];
+        __cpuid(info, 1);
+        return (info[3] & (1 << 26)) != 0;
+    }
+
+    bool hasAvx2() {
+        int info[4];
+        __cpuid(info, 1);
+        // The system must save AVX registers on context switches
+        const bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 &&
+            (_xgetbv(0) & 6) == 6;
+        if (!avx)
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }
+
+#else
+
+    bool hasSse2() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    }
+
+    bool hasAvx2() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+
+#endif
+#endif // #if defined(MP3ENC_KERNELS_X86)
+
+    struct InstructionSet {
+        const char* name;
+        Kernel kernel;
+        MixKernel mix;
+        bool (*supported)();
+    };
+
+    // In order of preference
+    static const InstructionSet INSTRUCTION_SETS[] = {
+#if defined(MP3ENC_KERNELS_X86)
+        { "avx2", deinterleaveAvx2, downmixAvx2, hasAvx2 },
+        { "sse2", deinterleaveSse2, downmixSse2, hasSse2 },
+#endif
+        { "scalar", deinterleaveScalar, downmixScalar, hasScalar }
+    };
+
+    static const size_t INSTRUCTION_SET_COUNT = sizeof(INSTRUCTION_SETS) / sizeof(INSTRUCTION_SETS[0]);
+
+    const InstructionSet* selectBest() {
+        for (size_t i = 0; i < INSTRUCTION_SET_COUNT; ++i) {
+            if (INSTRUCTION_SETS[i].supported())
+                return &INSTRUCTION_SETS[i];
+        }
+        return &INSTRUCTION_SETS[INSTRUCTION_SET_COUNT - 1];
+    }
+
+    // Selected before main() starts, hence before any worker thread
+    const InstructionSet* selected = selectBest();
+
+} // namespace
+
+namespace mp3enc {
+namespace kernels {
+
+void Deinterleave(
+    const void* samples,
+    SampleType type,
+    bool swap,
+    int channels,
+    size_t frames,
+    float scale,
+    float* left,
+    float* right) {
+    selected->kernel(samples, type, swap, channels, frames, scale, left, right);
+}
+
+void Downmix(
+    const void* samples,
+    SampleType type,
+    bool swap,
+    int channels,
+    size_t frames,
+    const float* matrix,
+    int outputs,
+    float* left,
+    float* right) {
+    selected->mix(samples, type, swap, channels, frames, matrix, outputs, left, right);
+}
+
+const char* GetInstructionSet() {
+    return selected->name;
+}
+
+bool SetInstructionSet(const char* name) {
+    for (size_t i = 0; i < INSTRUCTION_SET_COUNT; ++i) {
+        if (0 == strcmp(INSTRUCTION_SETS[i].name, name) && INSTRUCTION_SETS[i].supported()) {
+            selected = &INSTRUCTION_SETS[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace kernels
+} // namespace mp3enc
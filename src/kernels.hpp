@@ -0,0 +1,66 @@
+//
+//  kernels.hpp - vectorized conversion of PCM samples for the encoder
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_KERNELS_HPP
+#define MP3ENC_KERNELS_HPP
+
+#include <stddef.h>
+
+namespace mp3enc {
+namespace kernels {
+
+    // Type of interleaved input samples
+    enum SampleType {
+        INT16,
+        INT32,
+        FLOAT32
+    };
+
+    // Converts 'frames' interleaved frames of one or two channels to
+    // planar floats multiplied by 'scale', swapping bytes of samples
+    // first if 'swap' is true. Byte swapping, deinterleaving and type
+    // conversion are done in a single pass. 'right' is not written for
+    // mono input. Results are exactly those of scalar C++ code, so the
+    // encoded streams do not depend on the instruction set in use.
+    void Deinterleave(
+        const void* samples,
+        SampleType type,
+        bool swap,
+        int channels,
+        size_t frames,
+        float scale,
+        float* left,
+        float* right);
+
+    // Mixes 'frames' interleaved frames of 'channels' channels down to
+    // one or two ('outputs') planar float channels, swapping bytes of
+    // samples first if 'swap' is true, in a single pass. 'matrix' holds
+    // a row of 'channels' coefficients per output channel, with scale of
+    // samples applied. Products are summed in channel order, so results
+    // do not depend on the instruction set either.
+    void Downmix(
+        const void* samples,
+        SampleType type,
+        bool swap,
+        int channels,
+        size_t frames,
+        const float* matrix,
+        int outputs,
+        float* left,
+        float* right);
+
+    // Instruction set the kernels use: "avx2", "sse2" or "scalar". The
+    // best one the CPU supports is picked on start-up.
+    const char* GetInstructionSet();
+
+    // Makes the kernels use given instruction set (e.g. to compare them
+    // in benchmarks). Returns false if the CPU does not support it.
+    bool SetInstructionSet(const char* name);
+
+} // namespace kernels
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_KERNELS_HPP
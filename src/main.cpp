@@ -18,43 +18,141 @@
 
 #include <config.h>
 
-#include "glob.hpp"
-#include "platform.hpp"
-
+#include "daemon.hpp"
 #include "encoder-pool.hpp"
+#include "mp3encoder.hpp"
+#include "options.hpp"
+#include "profile.hpp"
 #include "utils.hpp"
+#include "walker.hpp"
 
 #include <stdio.h>
 
 using namespace mp3enc;
 
 void usage() {
-    puts("Usage: mp3enc <directory>");
+    puts("Usage: mp3enc [options] <directory>");
+    puts("       mp3enc [options] - < input.wav > output.mp3");
+    puts("       mp3enc [options] --daemon <socket>");
+    puts("");
+    puts("Options:");
+    puts("  -b, --batch <count>      let workers take short files (up to 1 MB)");
+    puts("                           in batches of given size");
+    puts("  -i, --incremental        skip files with up-to-date MP3 files");
+    puts("  --sidecar                track MP3 files in sidecar files with");
+    puts("                           settings fingerprint and WAV content hash");
+    puts("                           (implies --incremental)");
+    puts("  --journal <file>         record started, completed and failed files");
+    puts("  --resume                 skip files completed according to the journal");
+    puts("  --archive <file>         write MP3 streams into a single tar archive");
+    puts("                           instead of separate MP3 files");
+    puts("  --downmix <matrix>       mix input of as many channels as a row has");
+    puts("                           coefficients with given matrix, e.g. '0.5,0.5'");
+    puts("                           for stereo to mono or rows 'l,..;r,..' for");
+    puts("                           stereo output (default: surround to stereo)");
+    puts("  -j, --jobs <count>       number of worker threads (default: one per CPU)");
+    puts("  --adaptive               vary number of active workers with CPU usage");
+    puts("                           and I/O stalls (default jobs: two per CPU)");
+    puts("  -q, --quiet              report failed files only");
+    puts("  --report <format>        report results as 'text' lines (default),");
+    puts("                           'json' lines or periodic 'progress' summary");
+    puts("  -r, --recursive          encode files in subdirectories as well");
+    puts("  -s, --segment <seconds>  split files longer than twice the given");
+    puts("                           length into segments encoded in parallel");
+    puts("  --no-mmap                read input files with regular I/O instead");
+    puts("                           of memory mapping them");
+    puts("  --no-pipeline            read and write files on worker threads instead");
+    puts("                           of dedicated I/O threads");
+    puts("  --no-async-io            use blocking I/O on I/O threads instead of");
+    puts("                           io_uring");
+    puts("  --no-cache               keep written MP3 files out of page cache and");
+    puts("                           preallocate them");
+    puts("  --sync <policy>          flush MP3 files to the disk before publishing");
+    puts("                           them: 'none' (default), 'file' or 'full'");
+    puts("  --affinity               pin workers to CPUs, spread over NUMA nodes");
+    puts("  --no-smt                 pin workers to distinct physical cores only");
+    puts("                           (default jobs: one per core)");
+    puts("  --stats                  print encoder statistics when done");
+    puts("  --profile                print time spent in LAME encoding stages");
+    puts("                           (requires ./configure --enable-profile)");
+    puts("");
+    puts("Streaming mode options:");
+    puts("  --raw                    standard input is headerless little-endian");
+    puts("                           16-bit PCM instead of WAV");
+    puts("  --rate <hz>              sample rate of raw input (default: 44100)");
+    puts("  --channels <count>       number of channels of raw input (default: 2)");
+    puts("");
+    puts("Daemon mode options:");
+    puts("  --daemon <socket>        keep workers running and encode jobs submitted");
+    puts("                           to the local socket until terminated");
+}
+
+// Streaming mode: encode standard input to standard output
+int encodeStandardStreams(const Options& options) {
+    platform::SetBinaryMode(stdin);
+    platform::SetBinaryMode(stdout);
+    StageProfile profile;
+    try {
+        OutputFile output(stdout);
+        if (options.rawInput) {
+            WavFile input(stdin, static_cast<int>(options.rawChannels),
+                static_cast<int>(options.rawSampleRate));
+            encodeStream(input, output, &profile, options.downmix);
+        } else {
+            WavFile input(stdin);
+            encodeStream(input, output, &profile, options.downmix);
+        }
+    } catch (std::exception& e) {
+        utils::error("Error: %s\n", e.what());
+        return 1;
+    }
+
+    if (options.profile) {
+        profile.Print();
+    }
+    return 0;
 }
 
 int main(int argc, const char* argv[]) {
     
-    if (argc != 2) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
         usage();
         return 1;
     }
+    if (options.profile && !StageProfile::Available()) {
+        utils::error("Error: LAME is built without stage profiling, "
+            "reconfigure with --enable-profile\n");
+        return 1;
+    }
+    if (options.directory == "-") {
+        return encodeStandardStreams(options);
+    }
 
     int status = 0;
 
+    if (!options.socket.empty()) {
+        try {
+            Daemon daemon(options);
+            status = daemon.Run();
+        } catch (std::exception& e) {
+            utils::error("Error: %s\n", e.what());
+            status = 1;
+        }
+        return status;
+    }
+
     try {
-        // Find all .wav files in a given directory using file globbing.
-        // In case target platform supports case sensitive file systems,
-        // use extended globbing pattern syntax.
-        std::string pattern(
-            utils::NormalizeDirectory(argv[1]) +
-            (platform::CaseSensitiveGlob ? "*.[wW][aA][vV]" : "*.wav"));
-    
-        Glob wavFiles(pattern.c_str());
-        
+        // Find .wav files in a given directory (and its subdirectories
+        // in recursive mode) regardless of the extension case
+        DirWalker wavFiles(options.directory.c_str(), ".wav", options.recursive);
+
         // Initialize and run encoder worker pool on given directory
-        // using all available CPU cores
-        EncoderPool pool(wavFiles);
-        status = pool.Run();
+        // using all available CPU cores (or as many workers as requested
+        // with --jobs). Encoding starts while the directory is still
+        // being scanned.
+        EncoderPool pool(options);
+        status = pool.Run(wavFiles);
     } catch(std::exception& e) {
         utils::error("Error: %s\n", e.what());
         status = 1;
@@ -0,0 +1,116 @@
+//
+//  mapping-posix.cpp - POSIX file mapping
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include "config.h"
+
+#include "mapping.hpp"
+
+#include <cassert>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    struct PosixMapping {
+        void* _data;
+        size_t _size;
+
+        PosixMapping(void* data, size_t size)
+        : _data(data)
+        , _size(size) {
+        }
+
+        ~PosixMapping() {
+            munmap(_data, _size);
+        }
+    }; // struct PosixMapping
+
+    size_t pageSize() {
+        static const long size = sysconf(_SC_PAGESIZE);
+        return size > 0 ? static_cast<size_t>(size) : 4096;
+    }
+
+} // namespace
+
+namespace mp3enc {
+namespace platform {
+
+MappingHandle mappingInit(const char* path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    void* data = MAP_FAILED;
+    // Empty files cannot be mapped, and files that do not fit into
+    // address space are read using regular I/O
+    if (fstat(fd, &st) == 0 && st.st_size > 0 &&
+        static_cast<uint64_t>(st.st_size) == static_cast<size_t>(st.st_size)) {
+        data = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+    if (data != MAP_FAILED) {
+        // Double the readahead window of the file
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
+
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return 0;
+
+#if defined(MADV_SEQUENTIAL)
+    // Pages are read once in order: read them ahead aggressively
+    // and free them soon after they are accessed
+    madvise(data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+#endif
+
+    return reinterpret_cast<MappingHandle>(new PosixMapping(data, static_cast<size_t>(st.st_size)));
+}
+
+const unsigned char* mappingData(MappingHandle handle) {
+    assert(handle);
+    return reinterpret_cast<const unsigned char*>(reinterpret_cast<PosixMapping*>(handle)->_data);
+}
+
+uint64_t mappingSize(MappingHandle handle) {
+    assert(handle);
+    return reinterpret_cast<PosixMapping*>(handle)->_size;
+}
+
+void mappingPrefetch(MappingHandle handle, uint64_t offset, size_t size) {
+    assert(handle);
+#if defined(MADV_WILLNEED)
+    PosixMapping* mapping = reinterpret_cast<PosixMapping*>(handle);
+    if (offset >= mapping->_size)
+        return;
+    if (size > mapping->_size - offset)
+        size = static_cast<size_t>(mapping->_size - offset);
+
+    // madvise() requires page aligned address
+    const size_t aligned = static_cast<size_t>(offset) & ~(pageSize() - 1);
+    madvise(static_cast<char*>(mapping->_data) + aligned,
+        size + static_cast<size_t>(offset) - aligned, MADV_WILLNEED);
+#else
+    (void) handle;
+    (void) offset;
+    (void) size;
+#endif
+}
+
+void mappingClose(MappingHandle handle) {
+    assert(handle);
+    delete reinterpret_cast<PosixMapping*>(handle);
+}
+
+} // namspace platform
+} // namespace mp3enc
@@ -0,0 +1,104 @@
+//
+//  mapping-win32.cpp - Windows file mapping
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "mapping.hpp"
+
+#include <windows.h>
+
+#include <cassert>
+
+namespace {
+
+    struct Win32Mapping {
+        const void* _data;
+        uint64_t _size;
+
+        Win32Mapping(const void* data, uint64_t size)
+        : _data(data)
+        , _size(size) {
+        }
+
+        ~Win32Mapping() {
+            UnmapViewOfFile(_data);
+        }
+    }; // struct Win32Mapping
+
+} // namespace
+
+namespace mp3enc {
+namespace platform {
+
+MappingHandle mappingInit(const char* path) {
+    // Sequential scan flag makes cache manager read ahead more aggressively
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return 0;
+
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    // Empty files cannot be mapped, and files that do not fit into
+    // address space are read using regular I/O
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0 &&
+        static_cast<uint64_t>(size.QuadPart) == static_cast<SIZE_T>(size.QuadPart)) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+
+    const void* data = NULL;
+    if (mapping) {
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        // The view keeps mapping object alive
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+
+    if (!data)
+        return 0;
+
+    return reinterpret_cast<MappingHandle>(new Win32Mapping(data, size.QuadPart));
+}
+
+const unsigned char* mappingData(MappingHandle handle) {
+    assert(handle);
+    return reinterpret_cast<const unsigned char*>(reinterpret_cast<Win32Mapping*>(handle)->_data);
+}
+
+uint64_t mappingSize(MappingHandle handle) {
+    assert(handle);
+    return reinterpret_cast<Win32Mapping*>(handle)->_size;
+}
+
+void mappingPrefetch(MappingHandle handle, uint64_t offset, size_t size) {
+    assert(handle);
+#if _WIN32_WINNT >= 0x0602
+    Win32Mapping* mapping = reinterpret_cast<Win32Mapping*>(handle);
+    if (offset >= mapping->_size)
+        return;
+    if (size > mapping->_size - offset)
+        size = static_cast<size_t>(mapping->_size - offset);
+
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = const_cast<char*>(static_cast<const char*>(mapping->_data)) + offset;
+    range.NumberOfBytes = size;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+    // PrefetchVirtualMemory() is not available before Windows 8.
+    // Rely on sequential scan read ahead.
+    (void) handle;
+    (void) offset;
+    (void) size;
+#endif
+}
+
+void mappingClose(MappingHandle handle) {
+    assert(handle);
+    delete reinterpret_cast<Win32Mapping*>(handle);
+}
+
+} // namspace platform
+} // namespace mp3enc
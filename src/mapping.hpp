@@ -0,0 +1,82 @@
+//
+//  mapping.hpp - cross platform read-only file mapping
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_MAPPING_HPP
+#define MP3ENC_MAPPING_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mp3enc {
+    namespace platform {
+        //
+        // Platform-specific file mapping handle
+        //
+        typedef void* MappingHandle;
+
+        //
+        // The following functions are implemented in platform-
+        // specific files (mapping-posix.cpp, mapping-win32.cpp, etc)
+        //
+
+        // Maps the whole file into memory for sequential reading. Returns
+        // NULL if the file cannot be mapped, in which case the caller
+        // is expected to fall back to regular I/O.
+        MappingHandle mappingInit(const char* path);
+        const unsigned char* mappingData(MappingHandle handle);
+        uint64_t mappingSize(MappingHandle handle);
+        // Hints the system that given range is going to be read soon
+        void mappingPrefetch(MappingHandle handle, uint64_t offset, size_t size);
+        void mappingClose(MappingHandle handle);
+
+    } // namespace platform
+
+    class FileMapping {
+        platform::MappingHandle _handle;
+        // Objects of this class must not be copied
+        FileMapping(const FileMapping&);
+        FileMapping& operator=(const FileMapping&);
+
+    public:
+        FileMapping()
+        : _handle(0) {
+        }
+        ~FileMapping() {
+            Close();
+        }
+
+        bool Open(const char* path) {
+            Close();
+            _handle = platform::mappingInit(path);
+            return _handle != 0;
+        }
+
+        void Close() {
+            if (_handle) {
+                platform::mappingClose(_handle);
+                _handle = 0;
+            }
+        }
+
+        bool IsOpen() const {
+            return _handle != 0;
+        }
+
+        const unsigned char* Data() const {
+            return platform::mappingData(_handle);
+        }
+
+        uint64_t Size() const {
+            return platform::mappingSize(_handle);
+        }
+
+        void Prefetch(uint64_t offset, size_t size) {
+            platform::mappingPrefetch(_handle, offset, size);
+        }
+    }; // class FileMapping
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_MAPPING_HPP
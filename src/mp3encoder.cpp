@@ -8,11 +8,18 @@
 
 #include "mp3encoder.hpp"
 #include "file.hpp"
+#include "kernels.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 
 #include <lame.h>
 
+using mp3enc::DownmixMatrix;
+using mp3enc::WavFile;
+
 namespace {
 
     static const char* WRITE_ERROR = "Failed to write MP3 stream"; 
@@ -49,76 +56,562 @@ namespace {
             return _lame;
         }
     }; // class Lame;
-} // namespace
 
-namespace mp3enc {
-    // Encode WAV PCM data to MP3 stream
-    void encode(
-        WavFile& input,
-        std::vector<unsigned char>& inBuf,
-        std::vector<unsigned char>& outBuf,
-        const char* outpath) {
+    // Number of MP3 frames fed to the segment encoder in front of and
+    // after the segment. MDCT needs one granule of overlap and the
+    // psychoacoustic model looks one frame ahead for attack detection;
+    // a few extra frames let the model's smoothing state settle as well.
+    static const size_t PREROLL_FRAMES = 8;
+    static const size_t POSTROLL_FRAMES = 2;
 
-        OutputFile output(outpath);
+    // Number of samples read from input file at once
+    static const size_t SAMPLES_TO_READ = 16384;
 
-        const size_t samplesToRead = 16384;
-        outBuf.resize(size_t(1.25 * samplesToRead + 7200));
+    // Number of samples converted for LAME at once, few enough for the
+    // converted samples to stay in L1 cache
+    static const size_t SAMPLES_TO_CONVERT = 1024;
 
-        // Prepare codec parameters (use default quality settings)
-        Lame encoder;
-        lame_set_num_channels(encoder, input.GetChannels());
+    // Worst case size of MP3 data produced for SAMPLES_TO_READ samples
+    // as estimated by LAME documentation
+    static const size_t OUTPUT_BUFFER_SIZE = size_t(1.25 * SAMPLES_TO_READ + 7200);
+
+    // Number of encoders kept by EncoderCache. A directory rarely holds
+    // files of more than a couple of formats, and each encoder takes a
+    // few hundred kilobytes.
+    static const size_t MAX_CACHED_ENCODERS = 4;
+
+    // Bitrate in kbps LAME encodes CD audio at unless told otherwise.
+    // Lower sample rates get lower bitrates, so it is an upper bound.
+    static const unsigned DEFAULT_BITRATE = 128;
+
+    // Matrix input is mixed down with: the custom one if it fits input
+    // channels, the default one for more than two channels, otherwise
+    // none (channels are encoded as they are)
+    DownmixMatrix selectDownmix(const WavFile& input, const DownmixMatrix& custom) {
+        if (!custom.IsEmpty() && custom.GetInputs() == input.GetChannels())
+            return custom;
+        if (input.GetChannels() > 2)
+            return DownmixMatrix::ForLayout(input.GetChannels(), input.GetChannelMask());
+        return DownmixMatrix();
+    }
+
+    // Value of LAME's number of samples meaning the length is unknown
+    static const unsigned long UNKNOWN_NUM_SAMPLES = 0xFFFFFFFFul;
+
+    // Tells encoder the length of input stream, as far as it is known
+    void setNumSamples(Lame& encoder, const WavFile& input) {
+        lame_set_num_samples(encoder,
+            input.IsLengthKnown() ? static_cast<unsigned long>(input.GetTotalSamples()) : UNKNOWN_NUM_SAMPLES);
+    }
+
+    // Sets encoder parameters for given input stream
+    void initEncoder(
+        Lame& encoder,
+        WavFile& input,
+        const DownmixMatrix& downmix,
+        bool disableReservoir,
+        const mp3enc::EncoderSettings& settings = mp3enc::EncoderSettings()) {
+        lame_set_num_channels(encoder, downmix.IsEmpty() ? input.GetChannels() : downmix.GetOutputs());
         lame_set_in_samplerate(encoder, input.GetSampleRate());
         lame_set_out_samplerate(encoder, input.GetSampleRate());
-        lame_set_num_samples(encoder, input.GetTotalSamples());
+        setNumSamples(encoder, input);
+        if (disableReservoir) {
+            lame_set_disable_reservoir(encoder, 1);
+        }
+        if (settings.bitrate > 0) {
+            lame_set_VBR(encoder, vbr_off);
+            lame_set_brate(encoder, settings.bitrate);
+        }
+        if (settings.quality >= 0) {
+            lame_set_quality(encoder, settings.quality);
+        }
 
         const int res = lame_init_params(encoder);
         if (res < 0) {
             throw std::runtime_error("lame_init_params() failed");
         }
+    }
 
-        // Allocate input buffer of sufficient size
-        const size_t requiredSize = input.GetChannels() * samplesToRead * input.GetBitsPerSample() / 8;
-        if (inBuf.size() < requiredSize) {
+    // Prepare I/O buffers of sufficient size
+    void initBuffers(
+        WavFile& input,
+        std::vector<unsigned char>& inBuf,
+        std::vector<unsigned char>& outBuf) {
+        outBuf.resize(OUTPUT_BUFFER_SIZE);
+
+        // Memory mapped input is encoded in place
+        const size_t requiredSize = input.GetChannels() * SAMPLES_TO_READ * input.GetSampleSize();
+        if (!input.IsMapped() && inBuf.size() < requiredSize) {
             inBuf.resize(requiredSize);
         }
+    }
 
-        // Encode all input samples to output stream
-        const bool mono = input.GetChannels() == 1;
-        size_t read = 0;
-        while ((read = input.ReadSamples(&inBuf[0], samplesToRead)) > 0) {
+    // Fetch up to num samples from input stream. Memory mapped
+    // streams are read in place, others are read to input buffer.
+    size_t readSamples(
+        WavFile& input,
+        std::vector<unsigned char>& inBuf,
+        size_t num,
+        const void*& samples) {
+        if (input.IsMapped()) {
+            return input.MapSamples(samples, num);
+        }
+        samples = &inBuf[0];
+        return input.ReadSamples(&inBuf[0], num);
+    }
+
+    // Encode 'count' PCM samples, mixed down by 'downmix' unless it is
+    // empty, and return number of bytes written to output buffer
+    int encodeBuffer(
+        Lame& encoder,
+        WavFile& input,
+        const DownmixMatrix& downmix,
+        const void* samples,
+        size_t count,
+        unsigned char* outBuf,
+        size_t outSize) {
+        // Samples are byte swapped, deinterleaved and converted to
+        // floats at 16-bit scale in one pass, a block at a time. Scales
+        // match those LAME applies to integer input; being powers of two,
+        // they do not round. Float samples are kept at their scale and
+        // passed to the IEEE float entry points, so that LAME scales them
+        // with its own scaling in a single multiplication, as it does
+        // for float input anyway.
+        mp3enc::kernels::SampleType type = mp3enc::kernels::INT16;
+        float scale = 1.0f;
+        bool ieeeFloat = false;
+        switch (input.GetSampleFormat()) {
+        case WavFile::PCM_16:
+            break;
+        case WavFile::PCM_24:
+        case WavFile::PCM_32:
+            type = mp3enc::kernels::INT32;
+            scale = 1.0f / 65536;
+            break;
+        case WavFile::FLOAT_32:
+            type = mp3enc::kernels::FLOAT32;
+            ieeeFloat = true;
+            break;
+        }
+
+        const int channels = input.GetChannels();
+        const size_t frameSize = channels * input.GetSampleSize();
+        const bool swap = !input.IsNativeOrder();
+        const unsigned char* pcm = reinterpret_cast<const unsigned char*>(samples);
+
+        // Downmix coefficients are scaled along with the samples
+        const int outputs = downmix.IsEmpty() ? channels : downmix.GetOutputs();
+        float matrix[2 * DownmixMatrix::MAX_CHANNELS];
+        for (int o = 0; o < outputs && !downmix.IsEmpty(); ++o) {
+            for (int c = 0; c < channels; ++c) {
+                matrix[o * channels + c] = downmix.Get(o, c) * scale;
+            }
+        }
+
+        // Samples are written straight into the encoder's frame buffer
+        // when it takes them as they are, otherwise they are converted
+        // to a block on the stack and copied by LAME
+        float left[SAMPLES_TO_CONVERT];
+        float right[SAMPLES_TO_CONVERT];
+        size_t total = 0;
+        for (size_t done = 0; done < count; ) {
+            float* outLeft = NULL;
+            float* outRight = NULL;
+            const int room = lame_get_input_buffer(encoder, &outLeft, &outRight);
+            const bool direct = room > 0;
+            if (!direct) {
+                outLeft = left;
+                outRight = right;
+            }
+            const size_t num = std::min(count - done, direct ? static_cast<size_t>(room) : SAMPLES_TO_CONVERT);
+            if (downmix.IsEmpty()) {
+                mp3enc::kernels::Deinterleave(pcm + done * frameSize, type, swap, channels, num, scale, outLeft, outRight);
+            } else {
+                mp3enc::kernels::Downmix(pcm + done * frameSize, type, swap, channels, num, matrix, outputs, outLeft, outRight);
+            }
+            const int size = static_cast<int>(outSize - total);
             int encoded = 0;
-            if (mono) {
-                encoded = lame_encode_buffer(
-                    encoder,
-                    reinterpret_cast<short*>(&inBuf[0]),
-                    reinterpret_cast<short*>(&inBuf[0]),
-                    read,
-                    &outBuf[0],
-                    static_cast<int>(outBuf.size()));
+            if (direct) {
+                encoded = ieeeFloat
+                    ? lame_commit_input_buffer_ieee_float(encoder, static_cast<int>(num), outBuf + total, size)
+                    : lame_commit_input_buffer(encoder, static_cast<int>(num), outBuf + total, size);
             } else {
-                encoded = lame_encode_buffer_interleaved(
-                    encoder,
-                    reinterpret_cast<short*>(&inBuf[0]),
-                    read,
-                    &outBuf[0],
-                    static_cast<int>(outBuf.size()));
+                const float* pcmRight = outputs == 1 ? left : right;
+                encoded = ieeeFloat
+                    ? lame_encode_buffer_ieee_float(encoder, left, pcmRight, static_cast<int>(num), outBuf + total, size)
+                    : lame_encode_buffer_float(encoder, left, pcmRight, static_cast<int>(num), outBuf + total, size);
             }
             if (encoded < 0) {
                 throw std::runtime_error("lame_encode_buffer() failed");
             }
-            if (encoded != output.Write(&outBuf[0], encoded)) {
-                throw std::runtime_error(WRITE_ERROR);
-            }
+            total += encoded;
+            done += num;
         }
+        return static_cast<int>(total);
+    }
 
-        // Flush last mp3 frame
-        const int encoded = lame_encode_flush(encoder, &outBuf[0], outBuf.size());
+    // Flush last mp3 frame and return number of bytes
+    // written to output buffer
+    int flushEncoder(Lame& encoder, unsigned char* outBuf, size_t outSize) {
+        const int encoded = lame_encode_flush(encoder, outBuf, static_cast<int>(outSize));
         if (encoded < 0) {
             throw std::runtime_error("lame_encode_flush() failed");
         }
+        return encoded;
+    }
+
+    // Passes blocks taken from the pipeline back to it when going out
+    // of scope, also if encoding fails. MP3 block is queued for writing.
+    struct BlockGuard {
+        mp3enc::Pipeline& pipeline;
+        mp3enc::Pipeline::Block* pcm;
+        mp3enc::Pipeline::Block* mp3;
+
+        BlockGuard(mp3enc::Pipeline& owner, mp3enc::Pipeline::Block* input)
+        : pipeline(owner)
+        , pcm(input)
+        , mp3(NULL) {
+        }
+
+        ~BlockGuard() {
+            if (pcm) {
+                pipeline.Release(pcm);
+            }
+            if (mp3) {
+                pipeline.Write(mp3);
+            }
+        }
+    };
+} // namespace
+
+namespace mp3enc {
+    struct EncoderCache::Entry {
+        // Cache key
+        int channels;
+        int sampleRate;
+        bool disableReservoir;
+        EncoderSettings settings;
+        DownmixMatrix downmix;
+
+        Lame encoder;
+
+        Entry(
+            WavFile& input,
+            bool reservoirDisabled,
+            const EncoderSettings& encoderSettings,
+            const DownmixMatrix& inputDownmix)
+        : channels(input.GetChannels())
+        , sampleRate(input.GetSampleRate())
+        , disableReservoir(reservoirDisabled)
+        , settings(encoderSettings)
+        , downmix(inputDownmix) {
+        }
+    }; // struct EncoderCache::Entry
+
+    EncoderCache::EncoderCache(const DownmixMatrix& downmix)
+    : _downmix(downmix)
+    , _created(0)
+    , _reused(0) {
+    }
+
+    EncoderCache::~EncoderCache() {
+        for (size_t i = 0; i < _entries.size(); ++i) {
+            delete _entries[i];
+        }
+    }
+
+    EncoderCache::Entry& EncoderCache::Acquire(
+        WavFile& input,
+        bool disableReservoir,
+        const EncoderSettings& settings) {
+        const DownmixMatrix downmix = selectDownmix(input, _downmix);
+        for (size_t i = 0; i < _entries.size(); ++i) {
+            Entry* entry = _entries[i];
+            if (entry->channels != input.GetChannels() ||
+                entry->sampleRate != input.GetSampleRate() ||
+                entry->disableReservoir != disableReservoir ||
+                !(entry->settings == settings) ||
+                !(entry->downmix == downmix)) {
+                continue;
+            }
 
+            // The encoder could have been left in the middle of a stream
+            // if previous file failed, so it is reset unconditionally.
+            // Length of the previous stream must not be carried over.
+            setNumSamples(entry->encoder, input);
+            if (lame_reset_stream(entry->encoder) < 0) {
+                throw std::runtime_error("lame_reset_stream() failed");
+            }
+            lame_reset_profile(entry->encoder);
+
+            _entries.erase(_entries.begin() + i);
+            _entries.insert(_entries.begin(), entry);
+            ++_reused;
+            return *entry;
+        }
+
+        Entry* entry = new Entry(input, disableReservoir, settings, downmix);
+        try {
+            initEncoder(entry->encoder, input, downmix, disableReservoir, settings);
+        } catch (...) {
+            delete entry;
+            throw;
+        }
+
+        // Evict least recently used encoder
+        if (_entries.size() == MAX_CACHED_ENCODERS) {
+            delete _entries.back();
+            _entries.pop_back();
+        }
+        _entries.insert(_entries.begin(), entry);
+        ++_created;
+        return *entry;
+    }
+
+    void EncoderCache::CollectProfile(StageProfile& profile) const {
+        if (!_entries.empty()) {
+            profile.Collect(_entries.front()->encoder);
+        }
+    }
+
+    // Encode WAV PCM data to MP3 stream
+    void encode(
+        EncoderCache& encoders,
+        WavFile& input,
+        std::vector<unsigned char>& inBuf,
+        std::vector<unsigned char>& outBuf,
+        const char* outpath,
+        const EncoderSettings& settings,
+        const OutputMode& outputMode) {
+
+        OutputFile output(outpath, outputMode, outputMode.uncached ? estimateMp3Size(input, settings) : 0);
+
+        // Prepare codec parameters
+        EncoderCache::Entry& entry = encoders.Acquire(input, false, settings);
+        Lame& encoder = entry.encoder;
+        initBuffers(input, inBuf, outBuf);
+
+        // Encode all input samples to output stream
+        const void* samples = NULL;
+        size_t read = 0;
+        while ((read = readSamples(input, inBuf, SAMPLES_TO_READ, samples)) > 0) {
+            const int encoded = encodeBuffer(encoder, input, entry.downmix, samples, read, &outBuf[0], outBuf.size());
+            if (encoded != output.Write(&outBuf[0], encoded)) {
+                throw std::runtime_error(WRITE_ERROR);
+            }
+        }
+
+        const int encoded = flushEncoder(encoder, &outBuf[0], outBuf.size());
         if (encoded != output.Write(&outBuf[0], encoded)) {
             throw std::runtime_error(WRITE_ERROR);
         }
+
+        // Replace dummy LAME tag frame in the beginning of the stream
+        // with the actual one
+        const size_t tagSize = lame_get_lametag_frame(encoder, &outBuf[0], outBuf.size());
+        if (tagSize > 0 && tagSize <= outBuf.size()) {
+            if (!output.Seek(0) || tagSize != output.Write(&outBuf[0], tagSize)) {
+                throw std::runtime_error(WRITE_ERROR);
+            }
+        }
+        if (!output.Publish()) {
+            throw std::runtime_error(WRITE_ERROR);
+        }
+    }
+
+    // Encode WAV PCM data to MP3 stream with file I/O done by the
+    // pipeline's I/O thread
+    void encode(
+        EncoderCache& encoders,
+        Pipeline& pipeline,
+        WavFile& input,
+        const char* outpath,
+        const EncoderSettings& settings,
+        const OutputMode& outputMode) {
+
+        OutputFile output(outpath, outputMode, outputMode.uncached ? estimateMp3Size(input, settings) : 0);
+
+        // Prepare codec parameters
+        EncoderCache::Entry& entry = encoders.Acquire(input, false, settings);
+        Lame& encoder = entry.encoder;
+
+        pipeline.Begin(input, output, SAMPLES_TO_READ, OUTPUT_BUFFER_SIZE);
+        try {
+            // Encode all input samples to output stream
+            for (;;) {
+                BlockGuard blocks(pipeline, pipeline.Read());
+                if (blocks.pcm->size == 0)
+                    break;
+                blocks.mp3 = pipeline.Allocate();
+                blocks.mp3->size = encodeBuffer(encoder, input, entry.downmix, blocks.pcm->data, blocks.pcm->size,
+                    &blocks.mp3->buffer[0], blocks.mp3->buffer.size());
+            }
+
+            {
+                BlockGuard blocks(pipeline, NULL);
+                blocks.mp3 = pipeline.Allocate();
+                blocks.mp3->size = flushEncoder(encoder, &blocks.mp3->buffer[0], blocks.mp3->buffer.size());
+            }
+
+            // Replace dummy LAME tag frame in the beginning of the stream
+            // with the actual one
+            Pipeline::Block* tag = pipeline.Allocate();
+            tag->size = lame_get_lametag_frame(encoder, &tag->buffer[0], tag->buffer.size());
+            if (tag->size > tag->buffer.size()) {
+                tag->size = 0;
+            }
+            pipeline.Write(tag, tag->size > 0 ? Pipeline::Block::REWRITE : Pipeline::Block::APPEND);
+        } catch (...) {
+            pipeline.End();
+            throw;
+        }
+
+        if (!pipeline.End() || !output.Publish()) {
+            throw std::runtime_error(WRITE_ERROR);
+        }
+    }
+
+    // Encode WAV PCM data to MP3 stream in memory
+    void encodeToMemory(
+        EncoderCache& encoders,
+        WavFile& input,
+        std::vector<unsigned char>& inBuf,
+        std::vector<unsigned char>& outBuf,
+        std::vector<unsigned char>& mp3,
+        const EncoderSettings& settings) {
+
+        mp3.clear();
+        if (input.IsLengthKnown()) {
+            // Avoid reallocations as the stream grows
+            mp3.reserve(static_cast<size_t>(estimateMp3Size(input, settings)));
+        }
+
+        EncoderCache::Entry& entry = encoders.Acquire(input, false, settings);
+        Lame& encoder = entry.encoder;
+        initBuffers(input, inBuf, outBuf);
+
+        const void* samples = NULL;
+        size_t read = 0;
+        while ((read = readSamples(input, inBuf, SAMPLES_TO_READ, samples)) > 0) {
+            const int encoded = encodeBuffer(encoder, input, entry.downmix, samples, read, &outBuf[0], outBuf.size());
+            mp3.insert(mp3.end(), outBuf.begin(), outBuf.begin() + encoded);
+        }
+
+        const int encoded = flushEncoder(encoder, &outBuf[0], outBuf.size());
+        mp3.insert(mp3.end(), outBuf.begin(), outBuf.begin() + encoded);
+
+        // Replace dummy LAME tag frame in the beginning of the stream
+        // with the actual one
+        const size_t tagSize = lame_get_lametag_frame(encoder, &outBuf[0], outBuf.size());
+        if (tagSize > 0 && tagSize <= outBuf.size() && tagSize <= mp3.size()) {
+            std::copy(outBuf.begin(), outBuf.begin() + tagSize, mp3.begin());
+        }
+    }
+
+    // Encode PCM stream to MP3 stream, both read and written sequentially
+    void encodeStream(
+        WavFile& input,
+        OutputFile& output,
+        StageProfile* profile,
+        const DownmixMatrix& custom) {
+
+        Lame encoder;
+        // Dummy LAME tag frame could not be replaced later
+        lame_set_bWriteVbrTag(encoder, 0);
+        const DownmixMatrix downmix = selectDownmix(input, custom);
+        initEncoder(encoder, input, downmix, false);
+
+        std::vector<unsigned char> inBuf;
+        std::vector<unsigned char> outBuf;
+        initBuffers(input, inBuf, outBuf);
+
+        const void* samples = NULL;
+        size_t read = 0;
+        while ((read = readSamples(input, inBuf, SAMPLES_TO_READ, samples)) > 0) {
+            const int encoded = encodeBuffer(encoder, input, downmix, samples, read, &outBuf[0], outBuf.size());
+            // Pass complete frames on right away rather than when
+            // the stream buffer fills up
+            if (encoded > 0 && (encoded != output.Write(&outBuf[0], encoded) || !output.Flush())) {
+                throw std::runtime_error(WRITE_ERROR);
+            }
+        }
+
+        const int encoded = flushEncoder(encoder, &outBuf[0], outBuf.size());
+        if (encoded != output.Write(&outBuf[0], encoded) || !output.Flush()) {
+            throw std::runtime_error(WRITE_ERROR);
+        }
+
+        if (profile) {
+            profile->Collect(encoder);
+        }
+    }
+
+    size_t mp3FrameSamples(int sampleRate) {
+        // MPEG-1 Layer III frame has 1152 samples, MPEG-2 and MPEG-2.5
+        // frames (sample rates below 32 kHz) have half as much
+        return sampleRate >= 32000 ? 1152 : 576;
+    }
+
+    uint64_t estimateMp3Size(const WavFile& input, const EncoderSettings& settings) {
+        if (!input.IsLengthKnown() || input.GetSampleRate() <= 0)
+            return 0;
+        const uint64_t bitrate = settings.bitrate > 0 ? settings.bitrate : DEFAULT_BITRATE;
+        const uint64_t frameSamples = mp3FrameSamples(input.GetSampleRate());
+        // Encoder delay and padding take up to two frames more,
+        // LAME tag frame is one more
+        const uint64_t frames = (input.GetTotalSamples() + frameSamples - 1) / frameSamples + 3;
+        return frames * frameSamples * bitrate * 1000 / 8 / input.GetSampleRate();
+    }
+
+    void encodeSegment(
+        EncoderCache& encoders,
+        WavFile& input,
+        size_t first,
+        size_t count,
+        std::vector<unsigned char>& inBuf,
+        std::vector<unsigned char>& outBuf,
+        EncodedSegment& segment) {
+
+        EncoderCache::Entry& entry = encoders.Acquire(input, true);
+        Lame& encoder = entry.encoder;
+        initBuffers(input, inBuf, outBuf);
+
+        const size_t frameSamples = lame_get_framesize(encoder);
+        const size_t total = input.GetTotalSamples();
+
+        // Output frame N of the encoder always covers the same input samples
+        // relative to the first sample fed to it. Hence, starting on a frame
+        // boundary keeps segment's frames aligned with the frames of other
+        // segments.
+        segment.prerollFrames = first < PREROLL_FRAMES ? first : PREROLL_FRAMES;
+        const size_t begin = (first - segment.prerollFrames) * frameSamples;
+        size_t end = (first + count + POSTROLL_FRAMES) * frameSamples;
+        if (end > total) {
+            end = total;
+        }
+
+        input.Seek(begin);
+        segment.stream.clear();
+        for (size_t left = end - begin; left > 0; ) {
+            const void* samples = NULL;
+            const size_t read = readSamples(
+                input, inBuf, left < SAMPLES_TO_READ ? left : SAMPLES_TO_READ, samples);
+            if (read == 0) {
+                throw std::runtime_error("Unexpected end of WAV stream");
+            }
+            left -= read;
+
+            const int encoded = encodeBuffer(encoder, input, entry.downmix, samples, read, &outBuf[0], outBuf.size());
+            segment.stream.insert(segment.stream.end(), outBuf.begin(), outBuf.begin() + encoded);
+        }
+
+        const int encoded = flushEncoder(encoder, &outBuf[0], outBuf.size());
+        segment.stream.insert(segment.stream.end(), outBuf.begin(), outBuf.begin() + encoded);
+
+        const size_t tagSize = lame_get_lametag_frame(encoder, &outBuf[0], outBuf.size());
+        if (tagSize > outBuf.size()) {
+            throw std::runtime_error("lame_get_lametag_frame() failed");
+        }
+        segment.tag.assign(outBuf.begin(), outBuf.begin() + tagSize);
     }
 } // namespace mp3enc
@@ -7,24 +7,174 @@
 #ifndef MP3ENC_MP3ENCODER_HPP
 #define MP3ENC_MP3ENCODER_HPP
 
+#include "downmix.hpp"
 #include "wavfile.hpp"
 
 #include <vector>
 
 namespace mp3enc {
 
+    class Pipeline;
+    class StageProfile;
+
+    // Encoding settings that may vary from file to file (e.g. between
+    // daemon jobs). Default values keep LAME defaults.
+    struct EncoderSettings {
+        // Constant bitrate in kbps, zero for LAME default
+        int bitrate;
+        // Quality of LAME algorithms from 0 (best, slowest) to 9 (worst,
+        // fastest), -1 for LAME default
+        int quality;
+
+        EncoderSettings()
+        : bitrate(0)
+        , quality(-1) {
+        }
+
+        bool operator==(const EncoderSettings& other) const {
+            return bitrate == other.bitrate && quality == other.quality;
+        }
+    };
+
+    // EncoderCache keeps initialized LAME encoders of a worker thread
+    // between files. Setting up an encoder computes a lot of tables,
+    // which is noticeable when many short files are encoded. Encoders
+    // are keyed by input format and settings and are reset to a clean
+    // stream state when they are taken from the cache.
+    //
+    // The cache is not thread-safe, each worker owns its own instance.
+    class EncoderCache {
+    public:
+        // Cached encoder, defined in mp3encoder.cpp
+        struct Entry;
+
+        // 'downmix' is used for input of as many channels as it has
+        // inputs, other input with more than two channels is mixed down
+        // to stereo by DownmixMatrix::ForLayout()
+        explicit EncoderCache(const DownmixMatrix& downmix = DownmixMatrix());
+        ~EncoderCache();
+
+        // Returns encoder ready to encode given input stream
+        Entry& Acquire(
+            WavFile& input,
+            bool disableReservoir,
+            const EncoderSettings& settings = EncoderSettings());
+
+        // Number of encoders created from scratch
+        size_t GetCreated() const {
+            return _created;
+        }
+
+        // Number of times a cached encoder was reused
+        size_t GetReused() const {
+            return _reused;
+        }
+
+        // Adds stage times of the encoder acquired last, that is the one
+        // used by the last encode() or encodeSegment() call, to 'profile'
+        void CollectProfile(StageProfile& profile) const;
+
+    private:
+        // Most recently used entries go first
+        std::vector<Entry*> _entries;
+        DownmixMatrix _downmix;
+        size_t _created;
+        size_t _reused;
+
+        EncoderCache(const EncoderCache&);
+        EncoderCache& operator=(const EncoderCache&);
+    }; // class EncoderCache
+
     // "Sometimes, the elegant implementation is just a function.
     //  Not a method.  Not a class.  Not a framework.  Just a function."
     //  © John Carmack
  
     // encode() function encodes WAV input file to MP3 taking care of
-    // input/outbut buffers. The input/outbut buffers can be re-used
-    // between encode() calls.
+    // input/outbut buffers. The input/outbut buffers and the encoder
+    // cache can be re-used between encode() calls.
     void encode(
+        EncoderCache& encoders,
+        WavFile& input,
+        std::vector<unsigned char>& inBuf,
+        std::vector<unsigned char>& outBuf,
+        const char* outpath,
+        const EncoderSettings& settings = EncoderSettings(),
+        const OutputMode& outputMode = OutputMode());
+
+    // Pipelined version of encode(). Reading and writing are done by
+    // I/O thread of the pipeline while the calling thread encodes.
+    void encode(
+        EncoderCache& encoders,
+        Pipeline& pipeline,
+        WavFile& input,
+        const char* outpath,
+        const EncoderSettings& settings = EncoderSettings(),
+        const OutputMode& outputMode = OutputMode());
+
+    // Version of encode() that produces MP3 stream in memory, for
+    // archives. 'mp3' is replaced with the stream.
+    void encodeToMemory(
+        EncoderCache& encoders,
+        WavFile& input,
+        std::vector<unsigned char>& inBuf,
+        std::vector<unsigned char>& outBuf,
+        std::vector<unsigned char>& mp3,
+        const EncoderSettings& settings = EncoderSettings());
+
+    // Streaming version of encode() for pipes. Input is read until its
+    // end and MP3 frames are written to the output as soon as they are
+    // produced, so that memory use does not depend on stream length.
+    // The stream has no LAME tag, because the beginning of the output
+    // cannot be rewritten. Stage times of the encoder are added to
+    // 'profile' if it is not NULL. 'downmix' is applied as by
+    // EncoderCache.
+    void encodeStream(
+        WavFile& input,
+        OutputFile& output,
+        StageProfile* profile = NULL,
+        const DownmixMatrix& downmix = DownmixMatrix());
+
+    // Number of PCM samples (per channel) in a single MP3 frame
+    // produced for given input sample rate
+    size_t mp3FrameSamples(int sampleRate);
+
+    // Estimated size of MP3 stream encoded from given input with given
+    // settings (exact for constant bitrate), zero if input length is
+    // not known
+    uint64_t estimateMp3Size(const WavFile& input, const EncoderSettings& settings);
+
+    // Raw result of encodeSegment() call
+    struct EncodedSegment {
+        // MP3 stream as produced by the encoder. It starts with LAME
+        // tag frame followed by pre-roll frames, the frames of the
+        // segment itself and, unless segment is the last one,
+        // post-roll frames.
+        std::vector<unsigned char> stream;
+        // Number of pre-roll frames that follow the tag frame
+        size_t prerollFrames;
+        // Final LAME tag frame for the encoded stream
+        std::vector<unsigned char> tag;
+
+        EncodedSegment()
+        : prerollFrames(0) {
+        }
+    };
+
+    // encodeSegment() encodes the range of 'count' MP3 frames starting at
+    // frame 'first' of WAV input file. The encoder is fed with a few frames
+    // before and after the range so that psychoacoustic model and MDCT
+    // overlap converge by the time the first frame of the segment is
+    // encoded. Bit reservoir is disabled, thus frames of the segment do not
+    // depend on the frames around it and can be stitched with the frames of
+    // neighbouring segments encoded by other encoder instances.
+    void encodeSegment(
+        EncoderCache& encoders,
         WavFile& input,
+        size_t first,
+        size_t count,
         std::vector<unsigned char>& inBuf,
         std::vector<unsigned char>& outBuf,
-        const char* outpath);
+        EncodedSegment& segment);
     
 } // namespace mp3enc
 
@@ -10,6 +10,7 @@
 #include "utils.hpp"
 
 #include <cassert>
+#include <cerrno>
 
 #include <pthread.h>
 
@@ -20,6 +21,8 @@ namespace threading {
     class Mutex {
         pthread_mutex_t _mutex;
         
+        friend class Condition;
+
         Mutex(const Mutex&);
         Mutex& operator=(const Mutex&);
     public:
@@ -69,6 +72,52 @@ namespace threading {
             _mutex.Unlock();
         }
     }; // class ScopedLock
+
+    // Condition variable - implements default PTHREAD condition
+    class Condition {
+        pthread_cond_t _cond;
+
+        Condition(const Condition&);
+        Condition& operator=(const Condition&);
+    public:
+        Condition() {
+            const int res = pthread_cond_init(&_cond, NULL);
+            if (res != 0) {
+                // Same reasoning as in Mutex constructor
+                utils::abort_on_error(res);
+            }
+        }
+
+        ~Condition() {
+            const int res = pthread_cond_destroy(&_cond);
+            assert(res == 0);
+        }
+
+        // Atomically releases the mutex and waits for a signal.
+        // The mutex must be locked by the calling thread.
+        void Wait(Mutex& mutex) {
+            const int res = pthread_cond_wait(&_cond, &mutex._mutex);
+            assert(res == 0);
+        }
+
+        // Same as Wait(), but gives up at given (CLOCK_REALTIME) time.
+        // Returns false on timeout.
+        bool WaitUntil(Mutex& mutex, const timespec& deadline) {
+            const int res = pthread_cond_timedwait(&_cond, &mutex._mutex, &deadline);
+            assert(res == 0 || res == ETIMEDOUT);
+            return res == 0;
+        }
+
+        void Signal() {
+            const int res = pthread_cond_signal(&_cond);
+            assert(res == 0);
+        }
+
+        void Broadcast() {
+            const int res = pthread_cond_broadcast(&_cond);
+            assert(res == 0);
+        }
+    }; // class Condition
     
 } // namespace threading
 } // namespace mp3enc
@@ -0,0 +1,145 @@
+//
+//  options.cpp - command line options
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "options.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+    // Parses non-negative decimal number
+    bool parseUnsigned(const char* str, unsigned& value) {
+        if (!str || !*str)
+            return false;
+        char* end = NULL;
+        const unsigned long res = strtoul(str, &end, 10);
+        if (*end != '\0' || str[0] == '-')
+            return false;
+        value = static_cast<unsigned>(res);
+        return true;
+    }
+
+} // namespace
+
+namespace mp3enc {
+
+bool ParseOptions(int argc, const char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (0 == strcmp(arg, "-b") || 0 == strcmp(arg, "--batch")) {
+            if (++i == argc || !parseUnsigned(argv[i], options.batchSize))
+                return false;
+        } else if (0 == strcmp(arg, "-i") || 0 == strcmp(arg, "--incremental")) {
+            options.incremental = true;
+        } else if (0 == strcmp(arg, "--sidecar")) {
+            options.incremental = true;
+            options.sidecar = true;
+        } else if (0 == strcmp(arg, "--journal")) {
+            if (++i == argc || !*argv[i])
+                return false;
+            options.journal = argv[i];
+        } else if (0 == strcmp(arg, "--resume")) {
+            options.resume = true;
+        } else if (0 == strcmp(arg, "--archive")) {
+            if (++i == argc || !*argv[i])
+                return false;
+            options.archive = argv[i];
+        } else if (0 == strcmp(arg, "--downmix")) {
+            if (++i == argc || !DownmixMatrix::Parse(argv[i], options.downmix))
+                return false;
+        } else if (0 == strcmp(arg, "-j") || 0 == strcmp(arg, "--jobs")) {
+            if (++i == argc || !parseUnsigned(argv[i], options.workers))
+                return false;
+        } else if (0 == strcmp(arg, "-q") || 0 == strcmp(arg, "--quiet")) {
+            options.quiet = true;
+        } else if (0 == strcmp(arg, "--report")) {
+            if (++i == argc)
+                return false;
+            if (0 == strcmp(argv[i], "text")) {
+                options.report = Options::REPORT_TEXT;
+            } else if (0 == strcmp(argv[i], "json")) {
+                options.report = Options::REPORT_JSON;
+            } else if (0 == strcmp(argv[i], "progress")) {
+                options.report = Options::REPORT_PROGRESS;
+            } else {
+                return false;
+            }
+        } else if (0 == strcmp(arg, "-r") || 0 == strcmp(arg, "--recursive")) {
+            options.recursive = true;
+        } else if (0 == strcmp(arg, "-s") || 0 == strcmp(arg, "--segment")) {
+            if (++i == argc || !parseUnsigned(argv[i], options.segmentSeconds))
+                return false;
+        } else if (0 == strcmp(arg, "--no-mmap")) {
+            options.mapInput = false;
+        } else if (0 == strcmp(arg, "--no-pipeline")) {
+            options.pipeline = false;
+        } else if (0 == strcmp(arg, "--no-async-io")) {
+            options.asyncIo = false;
+        } else if (0 == strcmp(arg, "--no-cache")) {
+            options.output.uncached = true;
+        } else if (0 == strcmp(arg, "--sync")) {
+            if (++i == argc)
+                return false;
+            if (0 == strcmp(argv[i], "none")) {
+                options.output.sync = OutputMode::SYNC_NONE;
+            } else if (0 == strcmp(argv[i], "file")) {
+                options.output.sync = OutputMode::SYNC_FILE;
+            } else if (0 == strcmp(argv[i], "full")) {
+                options.output.sync = OutputMode::SYNC_FULL;
+            } else {
+                return false;
+            }
+        } else if (0 == strcmp(arg, "--adaptive")) {
+            options.adaptive = true;
+        } else if (0 == strcmp(arg, "--affinity")) {
+            options.affinity = true;
+        } else if (0 == strcmp(arg, "--no-smt")) {
+            options.affinity = true;
+            options.skipSmt = true;
+        } else if (0 == strcmp(arg, "--stats")) {
+            options.stats = true;
+        } else if (0 == strcmp(arg, "--profile")) {
+            options.profile = true;
+        } else if (0 == strcmp(arg, "--daemon")) {
+            if (++i == argc || !*argv[i])
+                return false;
+            options.socket = argv[i];
+        } else if (0 == strcmp(arg, "--raw")) {
+            options.rawInput = true;
+        } else if (0 == strcmp(arg, "--rate")) {
+            if (++i == argc || !parseUnsigned(argv[i], options.rawSampleRate))
+                return false;
+        } else if (0 == strcmp(arg, "--channels")) {
+            if (++i == argc || !parseUnsigned(argv[i], options.rawChannels))
+                return false;
+        } else if (arg[0] == '-' && arg[1] != '\0') {
+            // Unknown option
+            return false;
+        } else if (options.directory.empty()) {
+            options.directory = arg;
+        } else {
+            // Only one directory is expected
+            return false;
+        }
+    }
+    // Resuming needs a journal, which is kept for directories only
+    if (options.resume && options.journal.empty())
+        return false;
+    if (!options.journal.empty() && (options.directory.empty() || options.directory == "-"))
+        return false;
+    // Archive replaces MP3 files, which incremental mode and journal
+    // rely on, and is written for directories only
+    if (!options.archive.empty() && (options.directory.empty() || options.directory == "-" ||
+        options.incremental || !options.journal.empty()))
+        return false;
+    // Daemon takes jobs from clients instead of a directory
+    return options.directory.empty() != options.socket.empty();
+}
+
+} // namespace mp3enc
@@ -0,0 +1,117 @@
+//
+//  options.hpp - command line options
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_OPTIONS_HPP
+#define MP3ENC_OPTIONS_HPP
+
+#include "downmix.hpp"
+#include "file.hpp"
+
+#include <string>
+
+namespace mp3enc {
+
+    // Program settings collected from the command line
+    struct Options {
+        // Presentation of results
+        enum ReportFormat {
+            // Line per file, "<file>: OK" or "<file>: <error>"
+            REPORT_TEXT,
+            // JSON object per file
+            REPORT_JSON,
+            // Periodic summary with rates and estimated time left
+            REPORT_PROGRESS
+        };
+
+        // Directory with input WAV files, "-" for streaming from
+        // standard input to standard output
+        std::string directory;
+        // Path of the local socket to serve jobs at (daemon mode)
+        std::string socket;
+        // Look for input files in subdirectories too
+        bool recursive;
+        // Minimal length of a segment (in seconds) for intra-file
+        // parallel encoding. Zero disables segmented mode.
+        unsigned segmentSeconds;
+        // Read input files through memory mappings
+        bool mapInput;
+        // Move file I/O of every worker to a separate thread
+        bool pipeline;
+        // Let I/O threads use asynchronous I/O where available
+        bool asyncIo;
+        // How MP3 files are written
+        OutputMode output;
+        // Number of worker threads, zero means one per CPU (two per CPU
+        // in adaptive mode)
+        unsigned workers;
+        // Adjust number of active workers to CPU usage and I/O stalls
+        bool adaptive;
+        // Pin workers to CPUs, spreading them over NUMA nodes
+        bool affinity;
+        // Place workers on distinct physical cores only (implies
+        // affinity)
+        bool skipSmt;
+        // Number of short files a worker takes at once, values
+        // below 2 disable batching
+        unsigned batchSize;
+        // Do not report successfully encoded files
+        bool quiet;
+        ReportFormat report;
+        // Print run statistics to standard error when done
+        bool stats;
+        // Print time spent in LAME encoding stages per file and in total
+        bool profile;
+        // Standard input carries headerless PCM data of given format
+        // (streaming mode only)
+        bool rawInput;
+        unsigned rawSampleRate;
+        unsigned rawChannels;
+        // Skip files whose MP3 files are up to date
+        bool incremental;
+        // Track state of MP3 files in sidecar files (implies
+        // incremental mode)
+        bool sidecar;
+        // Journal recording progress of the run
+        std::string journal;
+        // Skip files completed according to the journal
+        bool resume;
+        // Tar archive collecting all MP3 streams instead of MP3 files
+        // next to the inputs
+        std::string archive;
+        // Custom downmix of input with matching channel count
+        DownmixMatrix downmix;
+
+        Options()
+        : recursive(false)
+        , segmentSeconds(0)
+        , mapInput(true)
+        , pipeline(true)
+        , asyncIo(true)
+        , workers(0)
+        , adaptive(false)
+        , affinity(false)
+        , skipSmt(false)
+        , batchSize(0)
+        , quiet(false)
+        , report(REPORT_TEXT)
+        , stats(false)
+        , profile(false)
+        , rawInput(false)
+        , rawSampleRate(44100)
+        , rawChannels(2)
+        , incremental(false)
+        , sidecar(false)
+        , resume(false) {
+        }
+    }; // struct Options
+
+    // Parses command line arguments. Returns false if arguments
+    // are invalid and usage information should be printed.
+    bool ParseOptions(int argc, const char* argv[], Options& options);
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_OPTIONS_HPP
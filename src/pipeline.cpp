@@ -0,0 +1,444 @@
+//
+//  pipeline.cpp - I/O stages of a worker running on a separate thread
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "pipeline.hpp"
+#include "exception.hpp"
+#include "utils.hpp"
+
+#include <cassert>
+#include <exception>
+#include <stdexcept>
+
+namespace {
+
+    // Granularity of touching mapped pages
+    static const size_t PAGE_SIZE = 4096;
+
+    // Makes sure pages of the mapped block are resident, so that the
+    // worker does not stall on page faults
+    void touchPages(const void* data, size_t size) {
+        const volatile unsigned char* bytes = static_cast<const volatile unsigned char*>(data);
+        for (size_t offset = 0; offset < size; offset += PAGE_SIZE) {
+            (void) bytes[offset];
+        }
+        if (size > 0) {
+            (void) bytes[size - 1];
+        }
+    }
+
+} // namespace
+
+namespace mp3enc {
+
+Pipeline::Pipeline(bool asyncIo)
+: _emptyInput(INPUT_RING_SIZE)
+, _filledInput(INPUT_RING_SIZE)
+, _encodedOutput(OUTPUT_RING_SIZE)
+, _writtenOutput(OUTPUT_RING_SIZE)
+, _inputBlocks(INPUT_BLOCKS)
+, _outputBlocks(OUTPUT_BLOCKS)
+, _buffersChanged(false)
+, _input(NULL)
+, _output(NULL)
+, _blockSamples(0) {
+    for (size_t i = 0; i < _inputBlocks.size(); ++i) {
+        _inputBlocks[i].kind = Block::READ;
+        _inputBlocks[i].index = static_cast<int>(i);
+        const bool pushed = _emptyInput.Push(&_inputBlocks[i]);
+        assert(pushed);
+        (void) pushed;
+    }
+    for (size_t i = 0; i < _outputBlocks.size(); ++i) {
+        _outputBlocks[i].index = static_cast<int>(_inputBlocks.size() + i);
+        _idleOutput.push_back(&_outputBlocks[i]);
+    }
+    _begin.kind = Block::BEGIN;
+    _end.kind = Block::END;
+    _quit.kind = Block::QUIT;
+
+    if (asyncIo) {
+        _async.Open(IO_QUEUE_DEPTH);
+    }
+
+    const int res = pthread_create(&_thread, NULL, threadProc, this);
+    if (res != 0) {
+        // Same reasoning as in EncoderPool::Run()
+        utils::abort_on_error(res);
+    }
+}
+
+Pipeline::~Pipeline() {
+    Write(&_quit, Block::QUIT);
+    const int res = pthread_join(_thread, NULL);
+    assert(res == 0);
+    (void) res;
+}
+
+void Pipeline::Begin(WavFile& input, OutputFile& output, size_t blockSamples, size_t outBlockSize) {
+    // The I/O thread is idle at this point, blocks can be resized safely
+    const size_t inBlockSize = blockSamples * input.GetChannels() * input.GetSampleSize();
+    for (size_t i = 0; i < _inputBlocks.size(); ++i) {
+        // Memory mapped input is encoded in place. Registered buffers
+        // must not be empty though.
+        if ((!input.IsMapped() || _async.IsOpen()) && _inputBlocks[i].buffer.size() < inBlockSize) {
+            _inputBlocks[i].buffer.resize(inBlockSize);
+            _buffersChanged = true;
+        }
+    }
+    for (size_t i = 0; i < _outputBlocks.size(); ++i) {
+        if (_outputBlocks[i].buffer.size() != outBlockSize) {
+            _outputBlocks[i].buffer.resize(outBlockSize);
+            _buffersChanged = true;
+        }
+    }
+
+    _input = &input;
+    _output = &output;
+    _blockSamples = blockSamples;
+    Write(&_begin, Block::BEGIN);
+}
+
+Pipeline::Block* Pipeline::Read() {
+    Block* block = NULL;
+    while (!_filledInput.Pop(block)) {
+        _worker.Park();
+    }
+    if (!block->error.empty()) {
+        const std::runtime_error error(block->error);
+        Release(block);
+        throw error;
+    }
+    return block;
+}
+
+void Pipeline::Release(Block* block) {
+    const bool pushed = _emptyInput.Push(block);
+    assert(pushed);
+    (void) pushed;
+    _io.Unpark();
+}
+
+Pipeline::Block* Pipeline::Allocate() {
+    while (_idleOutput.empty()) {
+        Block* block = NULL;
+        if (_writtenOutput.Pop(block)) {
+            _idleOutput.push_back(block);
+        } else {
+            _worker.Park();
+        }
+    }
+    Block* block = _idleOutput.back();
+    _idleOutput.pop_back();
+    block->size = 0;
+    return block;
+}
+
+void Pipeline::Write(Block* block, Block::Kind kind) {
+    block->kind = kind;
+    const bool pushed = _encodedOutput.Push(block);
+    assert(pushed);
+    (void) pushed;
+    _io.Unpark();
+}
+
+bool Pipeline::End() {
+    Write(&_end, Block::END);
+    for (;;) {
+        Block* block = NULL;
+        if (!_writtenOutput.Pop(block)) {
+            _worker.Park();
+        } else if (block == &_end) {
+            break;
+        } else {
+            _idleOutput.push_back(block);
+        }
+    }
+
+    // The I/O thread does not read past END, return blocks read ahead
+    // of a failed or abandoned stream
+    for (Block* block = NULL; _filledInput.Pop(block); ) {
+        Release(block);
+    }
+    _input = NULL;
+    _output = NULL;
+    return !_end.failed;
+}
+
+// PTHREAD's thread proc
+void* Pipeline::threadProc(void* arg) {
+    Pipeline* pipeline = reinterpret_cast<Pipeline*>(arg);
+    if (pipeline->_async.IsOpen()) {
+        pipeline->runAsync();
+    } else {
+        pipeline->run();
+    }
+    return NULL;
+}
+
+void Pipeline::run() {
+    // Whether the current stream has more blocks to read
+    bool reading = false;
+    bool failed = false;
+    for (;;) {
+        bool busy = false;
+
+        // Writes go first so that the worker gets MP3 blocks back
+        // as soon as possible
+        for (Block* block = NULL; _encodedOutput.Pop(block); ) {
+            busy = true;
+            switch (block->kind) {
+            case Block::BEGIN:
+                reading = true;
+                failed = false;
+                continue;
+            case Block::QUIT:
+                return;
+            case Block::READ:
+                assert(false);
+                break;
+            case Block::END:
+                reading = false;
+                block->failed = failed || _output->Error();
+                break;
+            case Block::REWRITE:
+                failed = failed || !_output->Seek(0);
+                // fall through
+            case Block::APPEND:
+                if (!failed && _output->Write(&block->buffer[0], block->size) != block->size) {
+                    // Following blocks are dropped, the stream
+                    // is broken anyway
+                    failed = true;
+                }
+                break;
+            }
+            const bool pushed = _writtenOutput.Push(block);
+            assert(pushed);
+            (void) pushed;
+            _worker.Unpark();
+        }
+
+        // Read one block ahead at a time and look for
+        // encoded blocks again
+        Block* block = NULL;
+        if (reading && _emptyInput.Pop(block)) {
+            busy = true;
+            read(block);
+            // Nothing is read after the end of stream or an error
+            reading = block->size > 0;
+            const bool pushed = _filledInput.Push(block);
+            assert(pushed);
+            (void) pushed;
+            _worker.Unpark();
+        }
+
+        if (!busy) {
+            _io.Park();
+        }
+    }
+}
+
+void Pipeline::read(Block* block) {
+    block->error.clear();
+    try {
+        if (_input->IsMapped()) {
+            block->size = _input->MapSamples(block->data, _blockSamples);
+            touchPages(block->data, block->size * _input->GetChannels() * _input->GetBitsPerSample() / 8);
+        } else {
+            block->data = &block->buffer[0];
+            block->size = _input->ReadSamples(&block->buffer[0], _blockSamples);
+        }
+    } catch (std::exception& e) {
+        block->size = 0;
+        block->error = e.what();
+        if (block->error.empty()) {
+            block->error = "Failed to read WAV stream";
+        }
+    }
+}
+
+void Pipeline::runAsync() {
+    // Whether the current stream has more blocks to read
+    bool reading = false;
+    bool failed = false;
+    bool quit = false;
+    // Output file offset of the next appended block
+    uint64_t outputOffset = 0;
+    size_t inFlight = 0;
+    // END block waiting for operations in flight
+    Block* end = NULL;
+    for (;;) {
+        bool busy = false;
+
+        for (Block* block = NULL; !quit && _encodedOutput.Pop(block); ) {
+            busy = true;
+            switch (block->kind) {
+            case Block::BEGIN:
+                // Nothing is in flight between streams
+                if (_buffersChanged) {
+                    registerBuffers();
+                    _buffersChanged = false;
+                }
+                reading = true;
+                failed = false;
+                outputOffset = 0;
+                break;
+            case Block::QUIT:
+                quit = true;
+                break;
+            case Block::END:
+                reading = false;
+                end = block;
+                break;
+            case Block::READ:
+                assert(false);
+                break;
+            case Block::APPEND:
+            case Block::REWRITE:
+                if (failed || block->size == 0) {
+                    const bool pushed = _writtenOutput.Push(block);
+                    assert(pushed);
+                    (void) pushed;
+                    _worker.Unpark();
+                    break;
+                }
+                // Rewrite of the beginning of the stream must not
+                // overtake the first append
+                block->offset = block->kind == Block::REWRITE ? 0 : outputOffset;
+                if (block->kind == Block::APPEND) {
+                    outputOffset += block->size;
+                }
+                _async.Write(_output->Descriptor(), block->offset, &block->buffer[0], block->size,
+                    block->index, block->kind == Block::REWRITE, block);
+                ++inFlight;
+                break;
+            }
+        }
+
+        // Read into all empty blocks at once
+        for (Block* block = NULL; reading && _emptyInput.Pop(block); ) {
+            busy = true;
+            if (_input->IsMapped()) {
+                // Mapped pages are touched rather than read
+                read(block);
+                reading = block->size > 0;
+                _reads.push_back(block);
+                continue;
+            }
+            block->error.clear();
+            block->data = &block->buffer[0];
+            size_t bytes = 0;
+            block->size = _input->ReserveSamples(_blockSamples, block->offset, bytes);
+            block->pending = bytes;
+            _reads.push_back(block);
+            if (bytes == 0) {
+                // Empty block marks the end of stream
+                reading = false;
+                continue;
+            }
+            _async.Read(_input->GetDescriptor(), block->offset, &block->buffer[0], bytes, block->index, block);
+            ++inFlight;
+        }
+
+        if (inFlight > 0) {
+            // Wait for completions only if there is nothing else to do
+            _async.Submit(!busy);
+            void* tag = NULL;
+            long result = 0;
+            while (_async.Complete(tag, result)) {
+                --inFlight;
+                Block* block = static_cast<Block*>(tag);
+                if (block->kind == Block::READ) {
+                    completeRead(block, result, reading);
+                    if (block->pending > 0) {
+                        ++inFlight;
+                    }
+                    continue;
+                }
+                if (result < 0 || static_cast<size_t>(result) != block->size) {
+                    failed = true;
+                } else {
+                    _output->Written(block->offset + block->size);
+                }
+                const bool pushed = _writtenOutput.Push(block);
+                assert(pushed);
+                (void) pushed;
+                _worker.Unpark();
+            }
+        }
+
+        // PCM blocks go to the worker in stream order
+        while (!_reads.empty() && _reads.front()->pending == 0) {
+            const bool pushed = _filledInput.Push(_reads.front());
+            assert(pushed);
+            (void) pushed;
+            _reads.pop_front();
+            _worker.Unpark();
+        }
+
+        if (inFlight == 0) {
+            if (end) {
+                end->failed = failed || _output->Error();
+                const bool pushed = _writtenOutput.Push(end);
+                assert(pushed);
+                (void) pushed;
+                end = NULL;
+                _worker.Unpark();
+            }
+            if (quit)
+                return;
+            if (!busy) {
+                _io.Park();
+            }
+        }
+    }
+}
+
+void Pipeline::registerBuffers() {
+    std::vector<void*> buffers;
+    std::vector<size_t> sizes;
+    for (size_t i = 0; i < _inputBlocks.size(); ++i) {
+        buffers.push_back(&_inputBlocks[i].buffer[0]);
+        sizes.push_back(_inputBlocks[i].buffer.size());
+    }
+    for (size_t i = 0; i < _outputBlocks.size(); ++i) {
+        buffers.push_back(&_outputBlocks[i].buffer[0]);
+        sizes.push_back(_outputBlocks[i].buffer.size());
+    }
+    // Operations on unregistered buffers work as well, only slower
+    _async.Register(&buffers[0], &sizes[0], static_cast<unsigned>(buffers.size()));
+}
+
+void Pipeline::completeRead(Block* block, long result, bool& reading) {
+    if (result <= 0) {
+        block->error = result == 0
+            ? "Unexpected end of WAV stream"
+            : CRuntimeError(static_cast<int>(-result)).what();
+        block->size = 0;
+        block->pending = 0;
+        // Nothing is read after an error
+        reading = false;
+        return;
+    }
+
+    const size_t bytes = static_cast<size_t>(result);
+    if (bytes < block->pending) {
+        // Short read, ask for the rest
+        const size_t done = block->size * _input->GetChannels() * _input->GetBitsPerSample() / 8
+            - block->pending + bytes;
+        block->offset += bytes;
+        block->pending -= bytes;
+        _async.Read(_input->GetDescriptor(), block->offset, &block->buffer[done], block->pending,
+            block->index, block);
+        return;
+    }
+
+    block->pending = 0;
+    _input->ConvertSamples(&block->buffer[0], block->size);
+}
+
+} // namespace mp3enc
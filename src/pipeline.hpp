@@ -0,0 +1,166 @@
+//
+//  pipeline.hpp - I/O stages of a worker running on a separate thread
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_PIPELINE_HPP
+#define MP3ENC_PIPELINE_HPP
+
+#include "async-io.hpp"
+#include "atomic.hpp"
+#include "file.hpp"
+#include "wavfile.hpp"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+namespace mp3enc {
+
+    // Pipeline splits encoding of a file into three stages: reading PCM
+    // blocks, encoding them and writing MP3 blocks. Reading and writing
+    // are done by an I/O thread that belongs to the pipeline, encoding
+    // is done by the worker thread that owns the pipeline. The stages
+    // exchange blocks through bounded lock-free rings, so the worker
+    // never waits for the disk as long as the I/O thread keeps up, and
+    // the I/O thread reads ahead while the worker encodes.
+    //
+    // Blocks are allocated once and circulate between the threads. Where
+    // the system supports asynchronous I/O (io_uring on Linux), the I/O
+    // thread issues all reads and writes that can be done at the moment
+    // with a single system call, and blocks are registered with the
+    // kernel as fixed buffers. Otherwise it falls back to blocking I/O.
+    //
+    // All methods are to be called by the owning worker thread only.
+    class Pipeline {
+    public:
+        struct Block {
+            enum Kind {
+                // MP3 data appended to output file
+                APPEND,
+                // MP3 data written at the beginning of output file
+                REWRITE,
+                // Control blocks, see Begin(), End() and ~Pipeline()
+                BEGIN,
+                END,
+                QUIT,
+                // PCM block read from input file
+                READ
+            };
+
+            Kind kind;
+            std::vector<unsigned char> buffer;
+            // PCM blocks: samples, either in buffer or in file mapping
+            const void* data;
+            // PCM blocks: samples per channel, MP3 blocks: bytes
+            size_t size;
+            // Read error message (PCM blocks) or write failure flag
+            // (END block)
+            std::string error;
+            bool failed;
+            // Index of the buffer registered for asynchronous I/O
+            int index;
+            // Asynchronous I/O in flight: file offset and the number
+            // of bytes not transferred yet
+            uint64_t offset;
+            size_t pending;
+
+            Block()
+            : kind(APPEND)
+            , data(NULL)
+            , size(0)
+            , failed(false)
+            , index(-1)
+            , offset(0)
+            , pending(0) {
+            }
+        };
+
+        // Asynchronous I/O is used if asyncIo is set and the
+        // system supports it
+        Pipeline(bool asyncIo);
+        ~Pipeline();
+
+        // Starts streaming input file to output file. PCM blocks hold up
+        // to blockSamples samples, MP3 blocks hold up to outBlockSize
+        // bytes. Both files must stay open until End() returns.
+        void Begin(WavFile& input, OutputFile& output, size_t blockSamples, size_t outBlockSize);
+
+        // Waits for the next PCM block. Empty block signals end of
+        // stream. Throws if the input file could not be read. The block
+        // must be passed back with Release() once encoded.
+        Block* Read();
+        void Release(Block* block);
+
+        // Waits for an unused MP3 block. The block is empty and must
+        // be passed back with Write() even if nothing is to be written.
+        Block* Allocate();
+        // Queues MP3 block for writing. REWRITE blocks must go last.
+        void Write(Block* block, Block::Kind kind = Block::APPEND);
+
+        // Stops reading and waits until queued blocks are written.
+        // Returns false if writing failed.
+        bool End();
+
+    private:
+        // Number of blocks that circulate in each direction
+        static const size_t INPUT_BLOCKS = 4;
+        static const size_t OUTPUT_BLOCKS = 8;
+        // Rings are large enough to hold all blocks, so pushing
+        // never fails
+        static const size_t INPUT_RING_SIZE = 4;
+        static const size_t OUTPUT_RING_SIZE = 16;
+        // Every block has at most one operation in flight
+        static const unsigned IO_QUEUE_DEPTH = 16;
+
+        pthread_t _thread;
+        threading::Parker _worker;
+        threading::Parker _io;
+
+        // PCM blocks: empty ones go to the I/O thread, filled ones go
+        // to the worker
+        threading::SpscRing<Block*> _emptyInput;
+        threading::SpscRing<Block*> _filledInput;
+        // MP3 and control blocks: encoded ones go to the I/O thread,
+        // written ones come back to the worker
+        threading::SpscRing<Block*> _encodedOutput;
+        threading::SpscRing<Block*> _writtenOutput;
+
+        std::vector<Block> _inputBlocks;
+        std::vector<Block> _outputBlocks;
+        // MP3 blocks available to the worker
+        std::vector<Block*> _idleOutput;
+        Block _begin;
+        Block _end;
+        Block _quit;
+
+        AsyncIo _async;
+        // Set by Begin() when block buffers were reallocated and
+        // have to be registered again
+        bool _buffersChanged;
+        // PCM blocks being read, in stream order
+        std::deque<Block*> _reads;
+
+        // Stream passed by Begin(). Owned by the I/O thread between
+        // BEGIN and END blocks.
+        WavFile* _input;
+        OutputFile* _output;
+        size_t _blockSamples;
+
+        Pipeline(const Pipeline&);
+        Pipeline& operator=(const Pipeline&);
+
+        static void* threadProc(void* arg);
+        void run();
+        void read(Block* block);
+        void runAsync();
+        void registerBuffers();
+        void completeRead(Block* block, long result, bool& reading);
+    }; // class Pipeline
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_PIPELINE_HPP
@@ -8,13 +8,93 @@
 
 #include "platform.hpp"
 
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace {
+
+#if defined(__linux__)
+
+    // Number of CPUs allowed by CPU quota (cgroup v2 'cpu.max') of the
+    // process's cgroup and its ancestors, zero if there is no quota.
+    // Fractional quotas are rounded down, since running more threads
+    // than the quota allows gets the whole cgroup throttled.
+    int cgroupCpuLimit() {
+        FILE* file = fopen("/proc/self/cgroup", "r");
+        if (!file)
+            return 0;
+        // The unified hierarchy is listed as "0::<path>"
+        std::string path;
+        char line[4096];
+        while (fgets(line, sizeof(line), file)) {
+            if (strncmp(line, "0::", 3) == 0) {
+                path = line + 3;
+                path.erase(path.find_last_not_of("\r\n") + 1);
+                break;
+            }
+        }
+        fclose(file);
+        if (path.empty() || path[0] != '/')
+            return 0;
+
+        int limit = 0;
+        for (std::string dir = "/sys/fs/cgroup" + path; ; ) {
+            if (*dir.rbegin() == '/') {
+                dir.erase(dir.size() - 1);
+            }
+            FILE* max = fopen((dir + "/cpu.max").c_str(), "r");
+            if (max) {
+                // Either "max <period>" or "<quota> <period>"
+                long quota = 0;
+                long period = 0;
+                if (fscanf(max, "%ld %ld", &quota, &period) == 2 && quota > 0 && period > 0) {
+                    const long cpus = quota >= period ? quota / period : 1;
+                    if (limit == 0 || cpus < limit) {
+                        limit = static_cast<int>(cpus);
+                    }
+                }
+                fclose(max);
+            }
+            const std::string::size_type slash = dir.rfind('/');
+            if (dir == "/sys/fs/cgroup" || slash == std::string::npos)
+                break;
+            dir.erase(slash);
+        }
+        return limit;
+    }
+
+#endif // #if defined(__linux__)
+
+    // Splits path into directory (with trailing separator, if any)
+    // and file name
+    void splitPath(const char* path, std::string& dir, std::string& name) {
+        const char* slash = strrchr(path, '/');
+        dir.assign(path, slash ? slash + 1 - path : 0);
+        name = slash ? slash + 1 : path;
+    }
+
+    uint64_t clockTime(clockid_t clock) {
+        struct timespec now;
+        clock_gettime(clock, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+    }
+
+} // namespace
+
 namespace mp3enc {
 namespace platform {
 
 const char PathSeparator = '/';
-const bool CaseSensitiveGlob = true;
 
 #ifdef WORDS_BIGENDIAN
 const bool BigEndian = true;
@@ -23,7 +103,161 @@ const bool BigEndian = false;
 #endif
 
 int CpuCount() {
-    return static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+    int count = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+#if defined(__linux__)
+    // CPUs the process is restricted to (taskset, cpusets)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 0) {
+        count = CPU_COUNT(&allowed);
+    }
+    const int limit = cgroupCpuLimit();
+    if (limit > 0 && limit < count) {
+        count = limit;
+    }
+#endif
+    return count > 0 ? count : 1;
+}
+
+bool GetFileInfo(const char* path, FileInfo& info) {
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return false;
+    info.size = static_cast<uint64_t>(st.st_size);
+#if defined(__APPLE__)
+    const struct timespec& mtime = st.st_mtimespec;
+#else
+    const struct timespec& mtime = st.st_mtim;
+#endif
+    info.mtime = static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+    return true;
+}
+
+void SetBinaryMode(FILE*) {
+    // There is no text mode on POSIX systems
+}
+
+bool MakeDirectory(const char* path) {
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+}
+
+FILE* CreateTempFile(const char* path, std::string& tempPath) {
+    // Hidden name in the same directory, so that the file is renamed
+    // within a file system and is not taken for a finished one
+    std::string dir;
+    std::string name;
+    splitPath(path, dir, name);
+    for (unsigned attempt = 0; ; ++attempt) {
+        char suffix[48];
+        snprintf(suffix, sizeof(suffix), ".%ld.%u.tmp", static_cast<long>(getpid()), attempt);
+        tempPath = dir + "." + name + suffix;
+        // Unlike mkstemp(), keeps permissions given by umask
+        const int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd >= 0) {
+            FILE* file = fdopen(fd, "wb");
+            if (!file) {
+                const int error = errno;
+                close(fd);
+                unlink(tempPath.c_str());
+                errno = error;
+            }
+            return file;
+        }
+        // Another thread writes the same file
+        if (errno != EEXIST || attempt == 1000)
+            return NULL;
+    }
+}
+
+bool RenameFile(const char* from, const char* to) {
+    return rename(from, to) == 0;
+}
+
+bool SyncFile(int fd) {
+#if defined(__linux__)
+    return fdatasync(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+bool SyncParentDirectory(const char* path) {
+    std::string dir;
+    std::string name;
+    splitPath(path, dir, name);
+    const int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    const bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+bool PreallocateFile(int fd, uint64_t size) {
+#if defined(__linux__)
+    // Blocks beyond the end of file are released by
+    // ReleasePreallocation() once the file is complete
+    return size > 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size)) == 0;
+#else
+    (void)fd;
+    (void)size;
+    return false;
+#endif
+}
+
+void ReleasePreallocation(int fd) {
+    // Truncation to the current size frees blocks beyond it. Failure
+    // wastes some space, but leaves the file intact.
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        const int res = ftruncate(fd, st.st_size);
+        (void)res;
+    }
+}
+
+void StartWriteBack(int fd, uint64_t offset, uint64_t size) {
+#if defined(__linux__)
+    sync_file_range(fd, static_cast<off_t>(offset), static_cast<off_t>(size), SYNC_FILE_RANGE_WRITE);
+#else
+    (void)fd;
+    (void)offset;
+    (void)size;
+#endif
+}
+
+void DropCachedRange(int fd, uint64_t offset, uint64_t size) {
+#if defined(__linux__)
+    // Only clean pages can be dropped
+    sync_file_range(fd, static_cast<off_t>(offset), static_cast<off_t>(size),
+        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(size), POSIX_FADV_DONTNEED);
+#else
+    (void)fd;
+    (void)offset;
+    (void)size;
+#endif
+}
+
+uint64_t MonotonicTime() {
+    return clockTime(CLOCK_MONOTONIC);
+}
+
+uint64_t ThreadCpuTime() {
+    return clockTime(CLOCK_THREAD_CPUTIME_ID);
+}
+
+uint64_t ProcessCpuTime() {
+    return clockTime(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void RealTimeAfter(unsigned milliseconds, timespec& time) {
+    clock_gettime(CLOCK_REALTIME, &time);
+    time.tv_sec += milliseconds / 1000;
+    time.tv_nsec += static_cast<long>(milliseconds % 1000) * 1000000;
+    if (time.tv_nsec >= 1000000000) {
+        time.tv_nsec -= 1000000000;
+        ++time.tv_sec;
+    }
 }
 
 } // namespace platform
@@ -10,11 +10,18 @@
 
 #include <Windows.h>
 
+#include <direct.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <io.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
 namespace mp3enc {
 namespace platform {
 
 const char PathSeparator = '\\';
-const bool CaseSensitiveGlob = false;
 
 // Cannot imagine a better way of detecting
 // machine endianness on Windows...
@@ -27,7 +34,156 @@ const bool BigEndian = true;
 int CpuCount() {
     SYSTEM_INFO info;
     GetSystemInfo(&info);
-    return info.dwNumberOfProcessors;
+    int count = info.dwNumberOfProcessors;
+    // CPUs the process is restricted to
+    DWORD_PTR processMask = 0;
+    DWORD_PTR systemMask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask) && processMask != 0) {
+        count = 0;
+        for (; processMask != 0; processMask &= processMask - 1) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+bool GetFileInfo(const char* path, FileInfo& info) {
+    struct _stati64 st;
+    if (_stati64(path, &st) != 0)
+        return false;
+    info.size = static_cast<uint64_t>(st.st_size);
+    // Windows CRT reports modification time with one second precision
+    info.mtime = static_cast<int64_t>(st.st_mtime) * 1000000000;
+    return true;
+}
+
+void SetBinaryMode(FILE* stream) {
+    _setmode(_fileno(stream), _O_BINARY);
+}
+
+bool MakeDirectory(const char* path) {
+    return _mkdir(path) == 0 || errno == EEXIST;
+}
+
+uint64_t MonotonicTime() {
+    static LARGE_INTEGER frequency;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    // Split to avoid overflow of the multiplication
+    const uint64_t ticks = static_cast<uint64_t>(now.QuadPart);
+    const uint64_t freq = static_cast<uint64_t>(frequency.QuadPart);
+    return ticks / freq * 1000000000 + ticks % freq * 1000000000 / freq;
+}
+
+FILE* CreateTempFile(const char* path, std::string& tempPath) {
+    // Hidden name in the same directory, so that the file is renamed
+    // within a volume and is not taken for a finished one
+    const char* slash = strrchr(path, '\\');
+    const char* altSlash = strrchr(path, '/');
+    if (!slash || (altSlash && altSlash > slash)) {
+        slash = altSlash;
+    }
+    const std::string dir(path, slash ? slash + 1 - path : 0);
+    const std::string name(slash ? slash + 1 : path);
+    for (unsigned attempt = 0; ; ++attempt) {
+        char suffix[48];
+        snprintf(suffix, sizeof(suffix), ".%lu.%u.tmp", GetCurrentProcessId(), attempt);
+        tempPath = dir + "." + name + suffix;
+        const int fd = _open(tempPath.c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+        if (fd >= 0) {
+            FILE* file = _fdopen(fd, "wb");
+            if (!file) {
+                const int error = errno;
+                _close(fd);
+                _unlink(tempPath.c_str());
+                errno = error;
+            }
+            return file;
+        }
+        // Another thread writes the same file
+        if (errno != EEXIST || attempt == 1000)
+            return NULL;
+    }
+}
+
+bool RenameFile(const char* from, const char* to) {
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+bool SyncFile(int fd) {
+    return _commit(fd) == 0;
+}
+
+bool SyncParentDirectory(const char*) {
+    // NTFS commits renames to its journal, and directories
+    // cannot be flushed through CRT descriptors
+    return true;
+}
+
+bool PreallocateFile(int fd, uint64_t size) {
+    // Allocation beyond the end of file is released when
+    // the file is closed
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+    HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(fd));
+    return size > 0 && handle != INVALID_HANDLE_VALUE &&
+        SetFileInformationByHandle(handle, FileAllocationInfo, &info, sizeof(info)) != 0;
+}
+
+void ReleasePreallocation(int) {
+    // Done by the system on close
+}
+
+void StartWriteBack(int, uint64_t, uint64_t) {
+    // Lazy writer of the cache manager does it anyway
+}
+
+void DropCachedRange(int, uint64_t, uint64_t) {
+    // Not supported for files opened with buffering
+}
+
+namespace {
+
+    // Sum of kernel and user times in nanoseconds
+    uint64_t cpuTime(const FILETIME& kernel, const FILETIME& user) {
+        ULARGE_INTEGER k;
+        k.LowPart = kernel.dwLowDateTime;
+        k.HighPart = kernel.dwHighDateTime;
+        ULARGE_INTEGER u;
+        u.LowPart = user.dwLowDateTime;
+        u.HighPart = user.dwHighDateTime;
+        // FILETIME counts 100 nanosecond intervals
+        return (k.QuadPart + u.QuadPart) * 100;
+    }
+
+} // namespace
+
+uint64_t ThreadCpuTime() {
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0;
+    return cpuTime(kernel, user);
+}
+
+uint64_t ProcessCpuTime() {
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+        return 0;
+    return cpuTime(kernel, user);
+}
+
+void RealTimeAfter(unsigned milliseconds, timespec& time) {
+    // pthreads-win32 takes deadlines of timed waits in UTC
+    timespec_get(&time, TIME_UTC);
+    time.tv_sec += milliseconds / 1000;
+    time.tv_nsec += static_cast<long>(milliseconds % 1000) * 1000000;
+    if (time.tv_nsec >= 1000000000) {
+        time.tv_nsec -= 1000000000;
+        ++time.tv_sec;
+    }
 }
 
 } // namespace platform
@@ -7,17 +7,67 @@
 #ifndef MP3ENC_PLATFORM_HPP
 #define MP3ENC_PLATFORM_HPP
 
+#include <string>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
 namespace mp3enc {
 namespace platform {
 
+    // File attributes used to detect modifications
+    struct FileInfo {
+        uint64_t size;
+        // Modification time in nanoseconds since the epoch
+        int64_t mtime;
+    };
+
     // Path separator character
     extern const char PathSeparator;
     // Is target platform big endian?
     extern const bool BigEndian;
-    // Does target platform support case sensitive glob masks?
-    extern const bool CaseSensitiveGlob;
-    // Determine number of CPUs
+    // Determine number of CPUs the process may use, which is limited by
+    // its affinity mask and, on Linux, by cgroup v2 CPU quota
     int CpuCount();
+    // Get size and modification time of a file. Returns false on error.
+    bool GetFileInfo(const char* path, FileInfo& info);
+    // Switch stream (e.g. standard input) to binary mode, so that
+    // PCM and MP3 data pass through it unchanged
+    void SetBinaryMode(FILE* stream);
+    // Create a directory unless it exists. Returns false on error.
+    bool MakeDirectory(const char* path);
+    // Creates a new hidden file for writing next to given path and
+    // stores its path to 'tempPath'. Returns NULL with errno set on
+    // failure.
+    FILE* CreateTempFile(const char* path, std::string& tempPath);
+    // Atomically replaces file at path 'to' (if any) with file 'from'
+    bool RenameFile(const char* from, const char* to);
+    // Flushes data of the file to the disk
+    bool SyncFile(int fd);
+    // Flushes the directory containing given path to the disk, so that
+    // entries created or renamed in it are persistent
+    bool SyncParentDirectory(const char* path);
+    // Reserves disk space for a file of given size without changing
+    // the size of the file. Returns false if not supported.
+    bool PreallocateFile(int fd, uint64_t size);
+    // Releases space reserved beyond the end of the file
+    void ReleasePreallocation(int fd);
+    // Starts writing given range of the file to the disk
+    void StartWriteBack(int fd, uint64_t offset, uint64_t size);
+    // Waits until given range of the file is on the disk and drops
+    // it from the page cache. Zero size means up to the end of file.
+    // Does nothing where not supported.
+    void DropCachedRange(int fd, uint64_t offset, uint64_t size);
+    // Monotonic clock reading in nanoseconds, for measuring intervals
+    uint64_t MonotonicTime();
+    // CPU time consumed by the calling thread and by the whole
+    // process, in nanoseconds
+    uint64_t ThreadCpuTime();
+    uint64_t ProcessCpuTime();
+    // Wall clock time given number of milliseconds from now, for
+    // deadlines of timed waits
+    void RealTimeAfter(unsigned milliseconds, timespec& time);
 
 } // namespace platform
 } // namespace mp3enc
@@ -0,0 +1,94 @@
+//
+//  profile.cpp - breakdown of encoding time by LAME stages
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "profile.hpp"
+#include "utils.hpp"
+
+#include <stdio.h>
+
+namespace {
+
+    // Indexed by lame_stage values
+    static const char* STAGE_NAMES[LAME_STAGE_COUNT] = {
+        "input",
+        "psycho",
+        "mdct",
+        "quantize",
+        "huffman",
+        "bitstream",
+        "other"
+    };
+
+} // namespace
+
+namespace mp3enc {
+
+StageProfile::StageProfile() {
+    for (int i = 0; i < LAME_STAGE_COUNT; ++i) {
+        _seconds[i] = 0;
+        _calls[i] = 0;
+    }
+}
+
+bool StageProfile::Available() {
+    // The result does not depend on arguments if profiling
+    // is compiled out
+    lame_profile_t profile;
+    return lame_get_profile(NULL, &profile) != -1;
+}
+
+void StageProfile::Collect(const lame_global_flags* encoder) {
+    lame_profile_t profile;
+    if (lame_get_profile(encoder, &profile) != 0)
+        return;
+    for (int i = 0; i < LAME_STAGE_COUNT; ++i) {
+        _seconds[i] += profile.seconds[i];
+        _calls[i] += profile.calls[i];
+    }
+}
+
+void StageProfile::Add(const StageProfile& other) {
+    for (int i = 0; i < LAME_STAGE_COUNT; ++i) {
+        _seconds[i] += other._seconds[i];
+        _calls[i] += other._calls[i];
+    }
+}
+
+double StageProfile::GetTotal() const {
+    double total = 0;
+    for (int i = 0; i < LAME_STAGE_COUNT; ++i) {
+        total += _seconds[i];
+    }
+    return total;
+}
+
+std::string StageProfile::Summary() const {
+    const double total = GetTotal();
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.3f s", total);
+    std::string summary(buf);
+    for (int i = 0; i < LAME_STAGE_COUNT; ++i) {
+        snprintf(buf, sizeof(buf), "%s %s %.1f%%", i == 0 ? ":" : ",",
+            STAGE_NAMES[i], total > 0 ? 100 * _seconds[i] / total : 0.0);
+        summary += buf;
+    }
+    return summary;
+}
+
+void StageProfile::Print() const {
+    const double total = GetTotal();
+    utils::error("%-12s %12s %8s %14s\n", "Stage", "Time, s", "Share", "Calls");
+    for (int i = 0; i < LAME_STAGE_COUNT; ++i) {
+        utils::error("%-12s %12.3f %7.1f%% %14llu\n", STAGE_NAMES[i], _seconds[i],
+            total > 0 ? 100 * _seconds[i] / total : 0.0,
+            static_cast<unsigned long long>(_calls[i]));
+    }
+    utils::error("%-12s %12.3f\n", "total", total);
+}
+
+} // namespace mp3enc
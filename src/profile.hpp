@@ -0,0 +1,48 @@
+//
+//  profile.hpp - breakdown of encoding time by LAME stages
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_PROFILE_HPP
+#define MP3ENC_PROFILE_HPP
+
+#include <string>
+
+#include <stdint.h>
+
+#include <lame.h>
+
+namespace mp3enc {
+
+    // StageProfile accumulates time spent by LAME encoders in the stages
+    // of encoding (psychoacoustic model, MDCT, quantization, etc). LAME
+    // collects the counters only if it is configured with
+    // --enable-profile, otherwise profiles stay empty.
+    class StageProfile {
+        double _seconds[LAME_STAGE_COUNT];
+        uint64_t _calls[LAME_STAGE_COUNT];
+
+    public:
+        StageProfile();
+
+        // Whether the LAME library collects stage counters
+        static bool Available();
+
+        // Adds counters of the encoder to the profile
+        void Collect(const lame_global_flags* encoder);
+        void Add(const StageProfile& other);
+
+        // Total time of all stages in seconds
+        double GetTotal() const;
+
+        // One line breakdown, e.g. "1.25 s: input 2.1%, psycho 37.5%, ..."
+        std::string Summary() const;
+        // Prints time, share and number of calls of every stage to
+        // standard error
+        void Print() const;
+    }; // class StageProfile
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_PROFILE_HPP
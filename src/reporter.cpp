@@ -0,0 +1,281 @@
+//
+//  reporter.cpp - reporting of results by a dedicated thread
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "reporter.hpp"
+#include "platform.hpp"
+#include "utils.hpp"
+
+#include <cassert>
+
+#include <stdio.h>
+
+namespace {
+
+    // How often the reporter looks for new results, in milliseconds
+    static const unsigned POLL_INTERVAL = 100;
+
+    // How often progress summary is printed, in milliseconds
+    static const unsigned PROGRESS_INTERVAL = 1000;
+
+    static const double NANOSECONDS = 1e9;
+    static const double MEGABYTE = 1024.0 * 1024.0;
+
+    // Appends string to JSON output as a quoted literal
+    void appendJsonString(std::string& out, const std::string& value) {
+        out += '"';
+        for (size_t i = 0; i < value.size(); ++i) {
+            const unsigned char c = static_cast<unsigned char>(value[i]);
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += static_cast<char>(c);
+            } else if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+        out += '"';
+    }
+
+    const char* statusName(mp3enc::FileResult::Status status) {
+        switch (status) {
+        case mp3enc::FileResult::ENCODED:
+            return "ok";
+        case mp3enc::FileResult::SKIPPED:
+            return "skipped";
+        case mp3enc::FileResult::FAILED:
+            return "failed";
+        }
+        return "unknown";
+    }
+
+    // Formats duration as [h:]mm:ss
+    std::string formatDuration(double seconds) {
+        const unsigned long total = static_cast<unsigned long>(seconds + 0.5);
+        char buf[32];
+        if (total >= 3600) {
+            snprintf(buf, sizeof(buf), "%lu:%02lu:%02lu", total / 3600, total / 60 % 60, total % 60);
+        } else {
+            snprintf(buf, sizeof(buf), "%lu:%02lu", total / 60, total % 60);
+        }
+        return buf;
+    }
+
+} // namespace
+
+namespace mp3enc {
+
+Reporter::Results::~Results() {
+    // Results that were never posted
+    while (_first) {
+        Queue::Node* next = reinterpret_cast<Queue::Node*>(_first->next);
+        delete _first;
+        _first = next;
+    }
+}
+
+void Reporter::Results::Add(const FileResult& result) {
+    Queue::Node* node = new Queue::Node;
+    node->value = result;
+    if (_last) {
+        _last->next = reinterpret_cast<size_t>(node);
+    } else {
+        _first = node;
+    }
+    _last = node;
+}
+
+Reporter::Reporter(const Options& options)
+: _options(options)
+, _started(false)
+, _stopping(0)
+, _submittedFiles(0)
+, _submittedBytes(0)
+, _submitFinished(false)
+, _files(0)
+, _failed(0)
+, _skipped(0)
+, _bytes(0)
+, _startTime(0)
+, _progressTime(0) {
+}
+
+Reporter::~Reporter() {
+    Stop();
+}
+
+void Reporter::Start() {
+    _startTime = platform::MonotonicTime();
+    _progressTime = _startTime;
+    const int res = pthread_create(&_thread, NULL, threadProc, this);
+    if (res != 0) {
+        // Same reasoning as in EncoderPool::Start()
+        utils::abort_on_error(res);
+    }
+    _started = true;
+}
+
+void Reporter::Post(Results& results) {
+    if (!results._first)
+        return;
+    _queue.Push(results._first, results._last);
+    results._first = NULL;
+    results._last = NULL;
+}
+
+void Reporter::Submitted(uint64_t bytes) {
+    threading::ScopedLock lock(_lock);
+    ++_submittedFiles;
+    _submittedBytes += bytes;
+}
+
+void Reporter::SubmitFinished() {
+    threading::ScopedLock lock(_lock);
+    _submitFinished = true;
+}
+
+void Reporter::Stop() {
+    if (!_started)
+        return;
+    threading::AtomicStore(&_stopping, 1);
+    _parker.Unpark();
+    const int res = pthread_join(_thread, NULL);
+    assert(res == 0);
+    _started = false;
+}
+
+// PTHREAD's thread proc
+void* Reporter::threadProc(void* arg) {
+    reinterpret_cast<Reporter*>(arg)->run();
+    return NULL;
+}
+
+void Reporter::run() {
+    const bool progress = _options.report == Options::REPORT_PROGRESS;
+    for (;;) {
+        // All results are posted by the time Stop() is called, hence
+        // the queue is complete once the flag is seen
+        const bool stopping = threading::AtomicLoad(&_stopping) != 0;
+
+        FileResult result;
+        bool printed = false;
+        while (_queue.Pop(result)) {
+            print(result);
+            printed = true;
+        }
+        if (printed) {
+            fflush(stdout);
+        }
+
+        const uint64_t now = platform::MonotonicTime();
+        if (stopping) {
+            if (progress) {
+                printSummary(now);
+            }
+            break;
+        }
+        if (progress && now - _progressTime >= PROGRESS_INTERVAL * 1000000ull) {
+            printProgress(now);
+            _progressTime = now;
+        }
+        _parker.Park(POLL_INTERVAL);
+    }
+}
+
+void Reporter::print(const FileResult& result) {
+    ++_files;
+    _bytes += result.bytes;
+    if (result.status == FileResult::FAILED) {
+        ++_failed;
+    } else if (result.status == FileResult::SKIPPED) {
+        ++_skipped;
+    }
+    // Successfully processed files are not reported in quiet mode
+    const bool quiet = _options.quiet && result.status != FileResult::FAILED;
+
+    std::string line;
+    if (_options.report == Options::REPORT_JSON) {
+        if (quiet)
+            return;
+        char buf[64];
+        line = "{\"file\":";
+        appendJsonString(line, result.file);
+        line += ",\"status\":\"";
+        line += statusName(result.status);
+        snprintf(buf, sizeof(buf), "\",\"bytes\":%llu,\"seconds\":%.3f",
+            static_cast<unsigned long long>(result.bytes), result.seconds);
+        line += buf;
+        if (!result.error.empty()) {
+            line += ",\"error\":";
+            appendJsonString(line, result.error);
+        }
+        if (!result.profile.empty()) {
+            line += ",\"profile\":";
+            appendJsonString(line, result.profile);
+        }
+        line += "}\n";
+        fputs(line.c_str(), stdout);
+        return;
+    }
+
+    // Human readable lines, failures only in progress mode
+    if (result.status == FileResult::FAILED) {
+        line = result.file + ": " + result.error + "\n";
+        fputs(line.c_str(), stderr);
+    } else if (result.status == FileResult::ENCODED && _options.report == Options::REPORT_TEXT && !quiet) {
+        line = result.file + ": OK\n";
+        fputs(line.c_str(), stdout);
+    }
+    if (!result.profile.empty()) {
+        line = result.file + ": " + result.profile + "\n";
+        fputs(line.c_str(), stderr);
+    }
+}
+
+void Reporter::printProgress(uint64_t now) {
+    uint64_t submittedFiles = 0;
+    uint64_t submittedBytes = 0;
+    bool submitFinished = false;
+    {
+        threading::ScopedLock lock(_lock);
+        submittedFiles = _submittedFiles;
+        submittedBytes = _submittedBytes;
+        submitFinished = _submitFinished;
+    }
+
+    const double elapsed = (now - _startTime) / NANOSECONDS;
+    const double byteRate = elapsed > 0 ? _bytes / elapsed : 0;
+    char total[32] = "?";
+    if (submitFinished) {
+        snprintf(total, sizeof(total), "%llu", static_cast<unsigned long long>(submittedFiles));
+    }
+    // Remaining time is known once the directory is scanned
+    std::string eta("?");
+    if (submitFinished && byteRate > 0) {
+        const uint64_t left = submittedBytes > _bytes ? submittedBytes - _bytes : 0;
+        eta = formatDuration(left / byteRate);
+    }
+    utils::error("%llu/%s files, %.1f files/s, %.1f MB/s, ETA %s\n",
+        static_cast<unsigned long long>(_files), total,
+        elapsed > 0 ? _files / elapsed : 0.0, byteRate / MEGABYTE, eta.c_str());
+}
+
+void Reporter::printSummary(uint64_t now) {
+    const double elapsed = (now - _startTime) / NANOSECONDS;
+    utils::error("%llu files (%llu failed, %llu skipped) in %s, %.1f files/s, %.1f MB/s\n",
+        static_cast<unsigned long long>(_files),
+        static_cast<unsigned long long>(_failed),
+        static_cast<unsigned long long>(_skipped),
+        formatDuration(elapsed).c_str(),
+        elapsed > 0 ? _files / elapsed : 0.0,
+        elapsed > 0 ? _bytes / elapsed / MEGABYTE : 0.0);
+}
+
+} // namespace mp3enc
@@ -0,0 +1,131 @@
+//
+//  reporter.hpp - reporting of results by a dedicated thread
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_REPORTER_HPP
+#define MP3ENC_REPORTER_HPP
+
+#include "atomic.hpp"
+#include "mutex.hpp"
+#include "options.hpp"
+
+#include <string>
+
+#include <pthread.h>
+#include <stdint.h>
+
+namespace mp3enc {
+
+    // Outcome of processing of a single file
+    struct FileResult {
+        enum Status {
+            ENCODED,
+            // Up to date in incremental mode
+            SKIPPED,
+            FAILED
+        };
+
+        Status status;
+        std::string file;
+        // Error message of a failed file
+        std::string error;
+        // Breakdown of encoding time by LAME stages (--profile)
+        std::string profile;
+        // Size of the input file
+        uint64_t bytes;
+        // Time spent on the file in seconds
+        double seconds;
+
+        FileResult()
+        : status(ENCODED)
+        , bytes(0)
+        , seconds(0) {
+        }
+    };
+
+    // Reporter prints results of encoding from a thread of its own, as
+    // text lines, JSON lines or a periodic progress summary (--report).
+    // Workers hand results over through a lock-free queue and never wake
+    // the reporter up, so they neither wait for each other nor for the
+    // console; the reporter polls the queue a few times per second.
+    class Reporter {
+        typedef threading::MpscQueue<FileResult> Queue;
+
+    public:
+        // Results collected by a worker while it works on a task and
+        // handed over to the reporter at once
+        class Results {
+            Queue::Node* _first;
+            Queue::Node* _last;
+
+            friend class Reporter;
+
+            Results(const Results&);
+            Results& operator=(const Results&);
+        public:
+            Results()
+            : _first(NULL)
+            , _last(NULL) {
+            }
+
+            ~Results();
+
+            void Add(const FileResult& result);
+        }; // class Results
+
+        Reporter(const Options& options);
+        ~Reporter();
+
+        // Starts reporter thread
+        void Start();
+        // Hands results over to the reporter. Never blocks.
+        void Post(Results& results);
+
+        // Called by the thread submitting files to tell that one more
+        // file of given size is queued, for progress estimation
+        void Submitted(uint64_t bytes);
+        // Tells that all files are submitted and their total is known
+        void SubmitFinished();
+
+        // Prints remaining results and stops reporter thread. Must be
+        // called after all results are posted.
+        void Stop();
+
+    private:
+        const Options& _options;
+        Queue _queue;
+        threading::Parker _parker;
+        pthread_t _thread;
+        bool _started;
+        volatile size_t _stopping;
+
+        // Protects the totals of submitted files, which are updated
+        // by the submitting thread, not by the workers
+        threading::Mutex _lock;
+        uint64_t _submittedFiles;
+        uint64_t _submittedBytes;
+        bool _submitFinished;
+
+        // Owned by the reporter thread
+        uint64_t _files;
+        uint64_t _failed;
+        uint64_t _skipped;
+        uint64_t _bytes;
+        uint64_t _startTime;
+        uint64_t _progressTime;
+
+        Reporter(const Reporter&);
+        Reporter& operator=(const Reporter&);
+
+        static void* threadProc(void* arg);
+        void run();
+        void print(const FileResult& result);
+        void printProgress(uint64_t now);
+        void printSummary(uint64_t now);
+    }; // class Reporter
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_REPORTER_HPP
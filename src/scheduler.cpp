@@ -0,0 +1,216 @@
+//
+//  scheduler.cpp - work-stealing task scheduler
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "scheduler.hpp"
+
+#include <cassert>
+
+namespace {
+
+    // Number of submitted tasks per worker that may wait in the queues.
+    // Enough to keep workers busy and let them balance the load by
+    // stealing, while file lists of any size take bounded memory.
+    static const size_t QUEUED_TASKS_PER_WORKER = 256;
+
+} // namespace
+
+namespace mp3enc {
+
+Scheduler::Scheduler(size_t workers)
+: _queues(workers)
+, _pending(0)
+, _capacity(workers * QUEUED_TASKS_PER_WORKER)
+, _submitting(true)
+, _generation(0)
+, _active(workers) {
+    assert(workers > 0);
+    for (size_t i = 0; i < _queues.size(); ++i) {
+        _queues[i] = new Queue;
+    }
+}
+
+Scheduler::~Scheduler() {
+    for (size_t i = 0; i < _queues.size(); ++i) {
+        delete _queues[i];
+    }
+}
+
+void Scheduler::SetGroup(size_t worker, size_t group) {
+    assert(worker < _queues.size());
+    _queues[worker]->group = group;
+}
+
+void Scheduler::SetActive(size_t count) {
+    assert(count > 0 && count <= _queues.size());
+    threading::ScopedLock lock(_lock);
+    _active = count;
+    // Wake up workers that became active
+    _changed.Broadcast();
+}
+
+size_t Scheduler::GetActive() {
+    threading::ScopedLock lock(_lock);
+    return _active;
+}
+
+void Scheduler::Submit(const Task& task) {
+    size_t active = 0;
+    {
+        threading::ScopedLock lock(_lock);
+        while (_pending >= _capacity) {
+            _room.Wait(_lock);
+        }
+        active = _active;
+    }
+
+    // Pick the queue with the least amount of work. Account for the
+    // number of tasks as well, so that empty files are spread evenly.
+    Queue* least = NULL;
+    uint64_t leastLoad = 0;
+    for (size_t i = 0; i < active; ++i) {
+        Queue* queue = _queues[i];
+        threading::ScopedLock lock(queue->lock);
+        const uint64_t load = queue->load + queue->tasks.size();
+        if (!least || load < leastLoad) {
+            least = queue;
+            leastLoad = load;
+        }
+    }
+
+    {
+        // Keep queued files largest first, as far as the bounded window
+        // allows (longest-processing-time heuristic): the owner starts
+        // with the largest ones, while thieves take the smallest from the
+        // back. Requests of clients are served in the order of arrival.
+        threading::ScopedLock lock(least->lock);
+        std::deque<Task>::iterator pos = least->tasks.end();
+        if (!task.client) {
+            while (pos != least->tasks.begin() && (pos - 1)->size < task.size) {
+                --pos;
+            }
+        }
+        least->tasks.insert(pos, task);
+        least->load += task.size;
+    }
+
+    threading::ScopedLock lock(_lock);
+    ++_pending;
+    ++_generation;
+    _changed.Broadcast();
+}
+
+void Scheduler::Finish() {
+    threading::ScopedLock lock(_lock);
+    _submitting = false;
+    // Release idle workers if all tasks are done already
+    _changed.Broadcast();
+}
+
+void Scheduler::Push(size_t worker, const Task& task) {
+    assert(worker < _queues.size());
+    {
+        Queue& queue = *_queues[worker];
+        threading::ScopedLock lock(queue.lock);
+        queue.tasks.push_back(task);
+        queue.load += task.size;
+    }
+
+    threading::ScopedLock lock(_lock);
+    ++_pending;
+    ++_generation;
+    _changed.Broadcast();
+}
+
+bool Scheduler::Pop(size_t worker, Task& task) {
+    assert(worker < _queues.size());
+    for (;;) {
+        unsigned long generation = 0;
+        {
+            threading::ScopedLock lock(_lock);
+            if (_pending == 0 && !_submitting)
+                return false;
+            if (worker >= _active) {
+                // Wait until activated or all work is done
+                _changed.Wait(_lock);
+                continue;
+            }
+            generation = _generation;
+        }
+
+        if (popLocal(worker, task) || steal(worker, task))
+            return true;
+
+        // All queues are empty, but some tasks are still being processed
+        // or submitted. Wait until new tasks are pushed or all complete.
+        threading::ScopedLock lock(_lock);
+        while ((_pending > 0 || _submitting) && _generation == generation) {
+            _changed.Wait(_lock);
+        }
+    }
+}
+
+void Scheduler::Done() {
+    threading::ScopedLock lock(_lock);
+    assert(_pending > 0);
+    if (--_pending == 0 && !_submitting) {
+        // Release idle workers
+        _changed.Broadcast();
+    }
+    if (_pending < _capacity) {
+        _room.Signal();
+    }
+}
+
+bool Scheduler::popLocal(size_t worker, Task& task) {
+    Queue& queue = *_queues[worker];
+    threading::ScopedLock lock(queue.lock);
+    if (queue.tasks.empty())
+        return false;
+    task = queue.tasks.front();
+    queue.tasks.pop_front();
+    queue.load -= task.size;
+    return true;
+}
+
+bool Scheduler::steal(size_t worker, Task& task) {
+    // The victim may be drained by its owner or other thieves between
+    // the search and the steal. Repeat the search in that case.
+    const size_t group = _queues[worker]->group;
+    for (;;) {
+        Queue* victim = NULL;
+        uint64_t victimLoad = 0;
+        bool victimNear = false;
+        for (size_t i = 1; i < _queues.size(); ++i) {
+            Queue* queue = _queues[(worker + i) % _queues.size()];
+            const bool near = queue->group == group;
+            threading::ScopedLock lock(queue->lock);
+            if (queue->tasks.empty())
+                continue;
+            // Any queue of the own group is better than a remote one
+            if (!victim || (near && !victimNear) ||
+                (near == victimNear && queue->load > victimLoad)) {
+                victim = queue;
+                victimLoad = queue->load;
+                victimNear = near;
+            }
+        }
+
+        if (!victim)
+            return false;
+
+        threading::ScopedLock lock(victim->lock);
+        if (!victim->tasks.empty()) {
+            task = victim->tasks.back();
+            victim->tasks.pop_back();
+            victim->load -= task.size;
+            return true;
+        }
+    }
+}
+
+} // namespace mp3enc
@@ -0,0 +1,140 @@
+//
+//  scheduler.hpp - work-stealing task scheduler
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_SCHEDULER_HPP
+#define MP3ENC_SCHEDULER_HPP
+
+#include "mutex.hpp"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace mp3enc {
+
+    class ClientJob;
+    class SegmentedJob;
+
+    // File of a batch of short files
+    struct BatchFile {
+        std::string path;
+        uint64_t size;
+    };
+
+    // Unit of work for a worker thread: either a whole file, a batch of
+    // short files, a segment of a file being encoded in segmented mode
+    // or a job submitted by a client of the daemon
+    struct Task {
+        std::string file;
+        // Files of a batch, 'file' is not used then
+        std::vector<BatchFile> batch;
+        // Estimated cost of the task (input size in bytes)
+        uint64_t size;
+        SegmentedJob* job;
+        size_t segment;
+        ClientJob* client;
+
+        Task()
+        : size(0)
+        , job(NULL)
+        , segment(0)
+        , client(NULL) {
+        }
+    };
+
+    // Scheduler keeps a separate task queue for every worker. Tasks are
+    // submitted while workers are already running, each one going to the
+    // least loaded queue, where it is placed before smaller tasks. Workers
+    // take tasks from the front of their own queues and, once it is empty,
+    // steal from the back of the most loaded queue of others, preferring
+    // workers of the same group (NUMA node), whose input is more likely to
+    // be in the nearby memory. Workers beyond the active count (see
+    // SetActive()) take no tasks and their queues receive no submitted
+    // ones.
+    class Scheduler {
+        struct Queue {
+            threading::Mutex lock;
+            std::deque<Task> tasks;
+            // Sum of sizes of queued tasks
+            uint64_t load;
+            // Group of the worker owning the queue
+            size_t group;
+
+            Queue()
+            : load(0)
+            , group(0) {
+            }
+        };
+
+        std::vector<Queue*> _queues;
+
+        // Protects the counters below
+        threading::Mutex _lock;
+        // Signals that tasks were pushed or all tasks were completed
+        threading::Condition _changed;
+        // Signals that submitter may queue more tasks
+        threading::Condition _room;
+        // Number of tasks that are either queued or being processed.
+        // Tasks being processed may push more tasks.
+        size_t _pending;
+        // Submit() blocks while this many tasks are pending
+        size_t _capacity;
+        // Set until Finish() is called
+        bool _submitting;
+        // Incremented on every push to detect missed wake-ups
+        unsigned long _generation;
+        // Workers with lower indices take tasks
+        size_t _active;
+
+        Scheduler(const Scheduler&);
+        Scheduler& operator=(const Scheduler&);
+
+    public:
+        Scheduler(size_t workers);
+        ~Scheduler();
+
+        // Assigns worker to a group. All workers are in group 0 by
+        // default. Must be called before workers are started.
+        void SetGroup(size_t worker, size_t group);
+
+        // Sets number of workers that take tasks, from 1 to the number
+        // of workers. Idle workers finish tasks they have taken already,
+        // and the tasks left in their queues are stolen by others.
+        void SetActive(size_t count);
+        size_t GetActive();
+
+        // Queues new task to the least loaded worker. Blocks while too
+        // many tasks are pending, which bounds memory used by the queues.
+        // Must be called from a thread other than workers.
+        void Submit(const Task& task);
+
+        // Tells that no more tasks will be submitted. Workers finish
+        // once the queued tasks are done.
+        void Finish();
+
+        // Pushes task produced by a worker to the back of its own queue,
+        // where it is the first candidate for stealing
+        void Push(size_t worker, const Task& task);
+
+        // Gets next task for a worker. Blocks while other workers process
+        // tasks that may produce new ones or more tasks may be submitted.
+        // Returns false when there is nothing left to do.
+        bool Pop(size_t worker, Task& task);
+
+        // Must be called when a task returned by Pop() is completed
+        void Done();
+
+    private:
+
+        bool popLocal(size_t worker, Task& task);
+        bool steal(size_t worker, Task& task);
+    }; // class Scheduler
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_SCHEDULER_HPP
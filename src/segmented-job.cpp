@@ -0,0 +1,326 @@
+//
+//  segmented-job.cpp - intra-file parallel encoding
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "segmented-job.hpp"
+#include "wavfile.hpp"
+
+#include <cassert>
+#include <stdexcept>
+
+#include <string.h>
+
+namespace {
+
+    static const char* WRITE_ERROR = "Failed to write MP3 stream";
+
+    // CRC-16 lookup table (polynomial 0x8005, reflected) used by LAME
+    // for music and tag CRCs
+    struct CrcTable {
+        uint16_t values[256];
+
+        CrcTable() {
+            for (unsigned i = 0; i < 256; ++i) {
+                uint16_t crc = static_cast<uint16_t>(i);
+                for (int bit = 0; bit < 8; ++bit) {
+                    crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+                }
+                values[i] = crc;
+            }
+        }
+    };
+
+    // Initialized before main() and hence before any worker thread starts
+    static const CrcTable crcTable;
+
+    uint16_t updateCRC(uint16_t crc, const unsigned char* data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            crc = (crc >> 8) ^ crcTable.values[(crc ^ data[i]) & 0xff];
+        }
+        return crc;
+    }
+
+    // Returns the length of MPEG Layer III frame starting at given
+    // position or zero if there is no valid frame header
+    size_t frameLength(const unsigned char* header, size_t available) {
+        static const int bitrates[2][15] = {
+            // MPEG-2 and MPEG-2.5
+            { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+            // MPEG-1
+            { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 }
+        };
+        static const int sampleRates[3] = { 44100, 48000, 32000 };
+
+        if (available < 4 || header[0] != 0xFF || (header[1] & 0xE0) != 0xE0)
+            return 0;
+
+        const int version = (header[1] >> 3) & 3;
+        const int layer = (header[1] >> 1) & 3;
+        const int bitrateIndex = header[2] >> 4;
+        const int sampleRateIndex = (header[2] >> 2) & 3;
+        const int padding = (header[2] >> 1) & 1;
+
+        // Reserved version, non Layer III, free format or invalid values
+        if (version == 1 || layer != 1 || bitrateIndex == 0 ||
+            bitrateIndex == 15 || sampleRateIndex == 3)
+            return 0;
+
+        const bool mpeg1 = version == 3;
+        // MPEG-2 halves and MPEG-2.5 quarters MPEG-1 sample rates
+        const int sampleRate = sampleRates[sampleRateIndex] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+        const int bitrate = bitrates[mpeg1 ? 1 : 0][bitrateIndex] * 1000;
+
+        return (mpeg1 ? 144 : 72) * bitrate / sampleRate + padding;
+    }
+
+    void putUint32(unsigned char* buf, uint32_t value) {
+        // big endian
+        buf[0] = static_cast<unsigned char>(value >> 24);
+        buf[1] = static_cast<unsigned char>(value >> 16);
+        buf[2] = static_cast<unsigned char>(value >> 8);
+        buf[3] = static_cast<unsigned char>(value);
+    }
+
+    void putUint16(unsigned char* buf, uint16_t value) {
+        // big endian
+        buf[0] = static_cast<unsigned char>(value >> 8);
+        buf[1] = static_cast<unsigned char>(value);
+    }
+
+    //
+    // Offsets of Xing/LAME tag fields relative to "Xing"/"Info" identifier
+    // (see VbrTag.c in LAME sources for the details)
+    //
+    enum {
+        XING_FRAMES = 8,
+        XING_BYTES = 12,
+        XING_TOC = 16,
+        XING_TOC_SIZE = 100,
+        LAME_DELAY_PADDING = 141,
+        LAME_MUSIC_LENGTH = 148,
+        LAME_MUSIC_CRC = 152,
+        LAME_TAG_CRC = 154,
+        LAME_TAG_END = 156
+    };
+
+} // namespace
+
+namespace mp3enc {
+
+SegmentedJob::SegmentedJob(
+    const std::string& input,
+    const std::string& output,
+    const platform::FileInfo& inputInfo,
+    uint64_t inputSize,
+    const WavFile& wav,
+    size_t minSamples,
+    bool useMapping,
+    const OutputMode& outputMode)
+: _input(input)
+, _outputPath(output)
+, _inputInfo(inputInfo)
+, _inputSize(inputSize)
+, _startTime(platform::MonotonicTime())
+, _useMapping(useMapping)
+, _output(output.c_str(), outputMode,
+    outputMode.uncached ? estimateMp3Size(wav, EncoderSettings()) : 0)
+, _totalSamples(wav.GetTotalSamples())
+, _frameSamples(mp3FrameSamples(wav.GetSampleRate()))
+, _written(0)
+, _processed(0)
+, _bytesWritten(0)
+, _musicCRC(0) {
+    // Segment boundaries are aligned to MP3 frames
+    const size_t totalFrames = (_totalSamples + _frameSamples - 1) / _frameSamples;
+    size_t segmentFrames = (minSamples + _frameSamples - 1) / _frameSamples;
+    if (segmentFrames == 0)
+        segmentFrames = 1;
+
+    size_t count = totalFrames / segmentFrames;
+    if (count == 0)
+        count = 1;
+
+    _segments.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        Segment& segment = _segments[i];
+        // Spread the remainder evenly across segments
+        segment.first = totalFrames * i / count;
+        segment.count = totalFrames * (i + 1) / count - segment.first;
+        segment.done = false;
+    }
+}
+
+bool SegmentedJob::ProcessSegment(
+    EncoderCache& encoders,
+    size_t index,
+    std::vector<unsigned char>& inBuf,
+    std::vector<unsigned char>& outBuf) {
+    assert(index < _segments.size());
+    Segment& segment = _segments[index];
+
+    bool failed = false;
+    {
+        threading::ScopedLock lock(_lock);
+        failed = !_error.empty();
+    }
+
+    // Don't waste CPU time on the segments of failed job
+    if (!failed) {
+        try {
+            // Each segment uses its own input stream, so that
+            // segments can be read concurrently
+            WavFile input(_input.c_str(), _useMapping);
+            EncodedSegment encoded;
+            encodeSegment(encoders, input, segment.first, segment.count, inBuf, outBuf, encoded);
+            StageProfile profile;
+            encoders.CollectProfile(profile);
+            {
+                threading::ScopedLock lock(_lock);
+                _profile.Add(profile);
+            }
+            trimSegment(segment, encoded, index + 1 == _segments.size());
+            if (index == 0) {
+                // No need to lock: segment 0 is written only after
+                // it is done
+                _tag.swap(encoded.tag);
+            }
+        } catch (std::exception& e) {
+            threading::ScopedLock lock(_lock);
+            if (_error.empty())
+                _error = e.what();
+        }
+    }
+
+    threading::ScopedLock lock(_lock);
+    segment.done = true;
+    ++_processed;
+
+    // Write all encoded segments that follow the ones
+    // already written
+    try {
+        while (_error.empty() && _written < _segments.size() && _segments[_written].done) {
+            writeSegment(_segments[_written++]);
+        }
+        if (_error.empty() && _written == _segments.size()) {
+            writeTag();
+            if (!_output.Publish())
+                throw std::runtime_error(WRITE_ERROR);
+        }
+    } catch (std::exception& e) {
+        if (_error.empty())
+            _error = e.what();
+    }
+
+    return _processed == _segments.size();
+}
+
+void SegmentedJob::trimSegment(Segment& segment, const EncodedSegment& encoded, bool last) {
+    const std::vector<unsigned char>& stream = encoded.stream;
+
+    if (stream.empty())
+        throw std::runtime_error("Unexpected MP3 stream");
+
+    // Skip the tag frame (if any) and pre-roll frames
+    size_t skip = encoded.prerollFrames + (encoded.tag.empty() ? 0 : 1);
+    size_t pos = 0;
+    for (; skip > 0; --skip) {
+        const size_t len = frameLength(&stream[0] + pos, stream.size() - pos);
+        if (len == 0)
+            throw std::runtime_error("Unexpected MP3 stream");
+        pos += len;
+    }
+
+    // Take frames of the segment. The last segment also keeps
+    // the frames produced by flushing the encoder.
+    const size_t begin = pos;
+    segment.frames.clear();
+    while (pos < stream.size() && (last || segment.frames.size() < segment.count)) {
+        const size_t len = frameLength(&stream[0] + pos, stream.size() - pos);
+        if (len == 0 || pos + len > stream.size())
+            throw std::runtime_error("Unexpected MP3 stream");
+        segment.frames.push_back(static_cast<unsigned short>(len));
+        pos += len;
+    }
+
+    if (!last && segment.frames.size() != segment.count)
+        throw std::runtime_error("Unexpected number of MP3 frames in segment");
+
+    segment.data.assign(stream.begin() + begin, stream.begin() + pos);
+}
+
+void SegmentedJob::writeSegment(Segment& segment) {
+    if (_frames.empty() && !_tag.empty()) {
+        // Reserve space for the tag frame in the beginning of the stream
+        if (_tag.size() != _output.Write(&_tag[0], _tag.size()))
+            throw std::runtime_error(WRITE_ERROR);
+    }
+
+    if (!segment.data.empty()) {
+        if (segment.data.size() != _output.Write(&segment.data[0], segment.data.size()))
+            throw std::runtime_error(WRITE_ERROR);
+        _musicCRC = updateCRC(_musicCRC, &segment.data[0], segment.data.size());
+    }
+
+    _bytesWritten += segment.data.size();
+    _frames.insert(_frames.end(), segment.frames.begin(), segment.frames.end());
+
+    // Release memory as soon as possible
+    std::vector<unsigned char>().swap(segment.data);
+    std::vector<unsigned short>().swap(segment.frames);
+}
+
+void SegmentedJob::writeTag() {
+    // Find Xing tag identifier. It follows the side information
+    // of the tag frame.
+    size_t xing = 0;
+    for (; xing + LAME_TAG_END <= _tag.size(); ++xing) {
+        if (0 == memcmp(&_tag[xing], "Xing", 4) || 0 == memcmp(&_tag[xing], "Info", 4))
+            break;
+    }
+    if (xing + LAME_TAG_END > _tag.size()) {
+        // Tag is disabled by encoder (e.g. frame is too small to fit it)
+        return;
+    }
+
+    unsigned char* tag = &_tag[xing];
+    const uint32_t streamSize = static_cast<uint32_t>(_bytesWritten + _tag.size());
+    putUint32(tag + XING_FRAMES, static_cast<uint32_t>(_frames.size()));
+    putUint32(tag + XING_BYTES, streamSize);
+
+    // Seek table: percentage of audio stream position to byte offset
+    // scaled to 0..255
+    size_t offset = 0;
+    size_t frame = 0;
+    for (size_t i = 0; i < XING_TOC_SIZE; ++i) {
+        const size_t target = _frames.size() * i / XING_TOC_SIZE;
+        for (; frame < target; ++frame)
+            offset += _frames[frame];
+        const size_t point = _bytesWritten ? 256 * offset / _bytesWritten : 0;
+        tag[XING_TOC + i] = static_cast<unsigned char>(point > 255 ? 255 : point);
+    }
+
+    // Encoder delay is the same for all segments, padding
+    // is determined by the total number of frames
+    const int delay = (tag[LAME_DELAY_PADDING] << 4) | (tag[LAME_DELAY_PADDING + 1] >> 4);
+    long padding = static_cast<long>(_frames.size() * _frameSamples) - delay - static_cast<long>(_totalSamples);
+    if (padding < 0)
+        padding = 0;
+    if (padding > 0xFFF)
+        padding = 0xFFF;
+    tag[LAME_DELAY_PADDING + 1] = static_cast<unsigned char>(((delay & 0x0F) << 4) | (padding >> 8));
+    tag[LAME_DELAY_PADDING + 2] = static_cast<unsigned char>(padding);
+
+    putUint32(tag + LAME_MUSIC_LENGTH, streamSize);
+    putUint16(tag + LAME_MUSIC_CRC, _musicCRC);
+    // Tag CRC covers the frame up to tag CRC field
+    putUint16(tag + LAME_TAG_CRC, updateCRC(0, &_tag[0], xing + LAME_TAG_CRC));
+
+    if (!_output.Seek(0) || _tag.size() != _output.Write(&_tag[0], _tag.size()))
+        throw std::runtime_error(WRITE_ERROR);
+}
+
+} // namespace mp3enc
@@ -0,0 +1,148 @@
+//
+//  segmented-job.hpp - intra-file parallel encoding
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_SEGMENTED_JOB_HPP
+#define MP3ENC_SEGMENTED_JOB_HPP
+
+#include "file.hpp"
+#include "mp3encoder.hpp"
+#include "mutex.hpp"
+#include "platform.hpp"
+#include "profile.hpp"
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace mp3enc {
+
+    // SegmentedJob splits a long WAV file into segments that are encoded
+    // independently (and concurrently) by the pool workers. Encoded frames
+    // are stitched into a single MP3 stream in the order of segments as
+    // soon as all preceding segments are written, and the LAME tag of the
+    // stream is updated once the last segment is done.
+    class SegmentedJob {
+        struct Segment {
+            // Range of MP3 frames covered by the segment
+            size_t first;
+            size_t count;
+            // Encoded frames of the segment, waiting to be written
+            std::vector<unsigned char> data;
+            std::vector<unsigned short> frames;
+            bool done;
+        };
+
+        // Serializes access to segments and output stream
+        threading::Mutex _lock;
+        const std::string _input;
+        const std::string _outputPath;
+        // Attributes of input file taken before encoding started
+        const platform::FileInfo _inputInfo;
+        // Size of input file and time when the job started, for reports
+        const uint64_t _inputSize;
+        const uint64_t _startTime;
+        // Read input segments through memory mappings
+        const bool _useMapping;
+        OutputFile _output;
+        // Number of input samples (per channel) and samples per MP3 frame
+        const size_t _totalSamples;
+        const size_t _frameSamples;
+        std::vector<Segment> _segments;
+        // Number of segments written to output stream so far
+        size_t _written;
+        // Number of segments processed (either encoded or failed)
+        size_t _processed;
+        // Error message of the first failed segment
+        std::string _error;
+
+        // LAME tag frame of the first segment used as a template
+        // for the tag of the stitched stream
+        std::vector<unsigned char> _tag;
+        // Sizes of all MP3 frames written so far
+        std::vector<unsigned short> _frames;
+        size_t _bytesWritten;
+        uint16_t _musicCRC;
+        // Stage times of all segments' encoders
+        StageProfile _profile;
+
+        SegmentedJob(const SegmentedJob&);
+        SegmentedJob& operator=(const SegmentedJob&);
+
+    public:
+        // Splits WAV file into segments of at least minSamples samples.
+        // If the file is too short to be split, the job consists of
+        // a single segment.
+        SegmentedJob(
+            const std::string& input,
+            const std::string& output,
+            const platform::FileInfo& inputInfo,
+            uint64_t inputSize,
+            const WavFile& wav,
+            size_t minSamples,
+            bool useMapping,
+            const OutputMode& outputMode);
+
+        ~SegmentedJob() {
+        }
+
+        const std::string& GetInput() const {
+            return _input;
+        }
+
+        const std::string& GetOutput() const {
+            return _outputPath;
+        }
+
+        const platform::FileInfo& GetInputInfo() const {
+            return _inputInfo;
+        }
+
+        uint64_t GetInputSize() const {
+            return _inputSize;
+        }
+
+        // MonotonicTime() when the job was created
+        uint64_t GetStartTime() const {
+            return _startTime;
+        }
+
+        size_t GetSegmentCount() const {
+            return _segments.size();
+        }
+
+        // Encodes segment with given index. Returns true if the call
+        // completed the last outstanding segment of the job. After that
+        // GetError() tells whether the job succeeded and the object can
+        // be safely deleted.
+        bool ProcessSegment(
+            EncoderCache& encoders,
+            size_t index,
+            std::vector<unsigned char>& inBuf,
+            std::vector<unsigned char>& outBuf);
+
+        // Returns error message of the failed job or empty string
+        // if all segments were successfully encoded
+        const std::string& GetError() const {
+            return _error;
+        }
+
+        // Returns time spent by LAME in the stages of encoding summed
+        // over all segments. Valid once the job is complete.
+        const StageProfile& GetProfile() const {
+            return _profile;
+        }
+
+    private:
+
+        void trimSegment(Segment& segment, const EncodedSegment& encoded, bool last);
+        void writeSegment(Segment& segment);
+        void writeTag();
+    }; // class SegmentedJob
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_SEGMENTED_JOB_HPP
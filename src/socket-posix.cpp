@@ -0,0 +1,167 @@
+//
+//  socket-posix.cpp - POSIX local stream sockets
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "socket.hpp"
+#include "exception.hpp"
+
+#include <cerrno>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+    // Self-pipe that wakes socketAccept() up when termination
+    // of the process is requested
+    int stopPipe[2] = { -1, -1 };
+
+    extern "C" void onTerminate(int) {
+        const char byte = 0;
+        const ssize_t res = write(stopPipe[1], &byte, 1);
+        (void) res;
+    }
+
+    void makeAddress(const char* path, sockaddr_un& addr) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr.sun_path))
+            throw std::runtime_error("Socket path is too long");
+        strcpy(addr.sun_path, path);
+    }
+
+    // Tells whether the socket file at the path is left by a process that
+    // is gone, that is nobody accepts connections there
+    bool isStale(const sockaddr_un& addr) {
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return false;
+        const bool stale = connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 &&
+            errno == ECONNREFUSED;
+        close(fd);
+        return stale;
+    }
+
+} // namespace
+
+namespace mp3enc {
+namespace platform {
+
+SocketHandle socketListen(const char* path) {
+    sockaddr_un addr;
+    makeAddress(path, addr);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw CRuntimeError(errno);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    int res = bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    if (res != 0 && errno == EADDRINUSE && isStale(addr)) {
+        unlink(path);
+        res = bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    }
+    if (res != 0 || listen(fd, SOMAXCONN) != 0) {
+        const int error = errno;
+        close(fd);
+        throw CRuntimeError(error);
+    }
+
+    if (stopPipe[0] < 0 && pipe(stopPipe) != 0) {
+        const int error = errno;
+        close(fd);
+        unlink(path);
+        throw CRuntimeError(error);
+    }
+
+    // Clients that disconnect before their jobs are done must not
+    // kill the process when notifications are sent to them
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onTerminate;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    return fd;
+}
+
+SocketHandle socketAccept(SocketHandle listener) {
+    for (;;) {
+        pollfd fds[2];
+        fds[0].fd = static_cast<int>(listener);
+        fds[0].events = POLLIN;
+        fds[1].fd = stopPipe[0];
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return InvalidSocket;
+        }
+        if (fds[1].revents != 0)
+            return InvalidSocket;
+        if (fds[0].revents == 0)
+            continue;
+
+        const int fd = accept(static_cast<int>(listener), NULL, NULL);
+        if (fd >= 0) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            return fd;
+        }
+        // The client could have given up before it was accepted
+        if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN)
+            return InvalidSocket;
+    }
+}
+
+size_t socketRead(SocketHandle socket, void* buf, size_t size) {
+    for (;;) {
+        const ssize_t res = recv(static_cast<int>(socket), buf, size, 0);
+        if (res >= 0)
+            return static_cast<size_t>(res);
+        if (errno != EINTR)
+            return 0;
+    }
+}
+
+bool socketWrite(SocketHandle socket, const void* buf, size_t size) {
+    const char* data = reinterpret_cast<const char*>(buf);
+    while (size > 0) {
+        const ssize_t res = send(static_cast<int>(socket), data, size, 0);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += res;
+        size -= static_cast<size_t>(res);
+    }
+    return true;
+}
+
+void socketShutdown(SocketHandle socket) {
+    shutdown(static_cast<int>(socket), SHUT_RD);
+}
+
+void socketClose(SocketHandle socket) {
+    close(static_cast<int>(socket));
+}
+
+void socketRemove(SocketHandle listener, const char* path) {
+    close(static_cast<int>(listener));
+    unlink(path);
+}
+
+} // namespace platform
+} // namespace mp3enc
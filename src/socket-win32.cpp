@@ -0,0 +1,140 @@
+//
+//  socket-win32.cpp - Windows local stream sockets
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "socket.hpp"
+
+#include <winsock2.h>
+#include <afunix.h>
+#include <windows.h>
+
+#include <stdexcept>
+
+#include <limits.h>
+#include <string.h>
+
+#pragma comment(lib, "ws2_32.lib")
+
+namespace {
+
+    // How long socketAccept() waits for a client before it checks
+    // whether termination was requested, in milliseconds
+    static const long ACCEPT_POLL_INTERVAL = 200;
+
+    volatile LONG stopRequested = 0;
+
+    BOOL WINAPI onConsoleCtrl(DWORD) {
+        InterlockedExchange(&stopRequested, 1);
+        return TRUE;
+    }
+
+    // Winsock reports errors with WSAGetLastError(), which does not
+    // map to errno, hence the message is generic
+    void throwSocketError(const char* what) {
+        throw std::runtime_error(what);
+    }
+
+} // namespace
+
+namespace mp3enc {
+namespace platform {
+
+// Unix domain sockets are supported since Windows 10 1803
+
+SocketHandle socketListen(const char* path) {
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+        throwSocketError("Failed to initialize Winsock");
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        WSACleanup();
+        throw std::runtime_error("Socket path is too long");
+    }
+    strcpy(addr.sun_path, path);
+
+    const SOCKET fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == INVALID_SOCKET) {
+        WSACleanup();
+        throwSocketError("Failed to create socket");
+    }
+
+    // Socket files are not removed when their owners are gone
+    int res = bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    if (res != 0 && WSAGetLastError() == WSAEADDRINUSE) {
+        DeleteFileA(path);
+        res = bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    }
+    if (res != 0 || listen(fd, SOMAXCONN) != 0) {
+        closesocket(fd);
+        WSACleanup();
+        throwSocketError("Failed to listen on socket");
+    }
+
+    SetConsoleCtrlHandler(onConsoleCtrl, TRUE);
+    return static_cast<SocketHandle>(fd);
+}
+
+SocketHandle socketAccept(SocketHandle listener) {
+    const SOCKET fd = static_cast<SOCKET>(listener);
+    while (!stopRequested) {
+        fd_set ready;
+        FD_ZERO(&ready);
+        FD_SET(fd, &ready);
+        timeval timeout = { 0, ACCEPT_POLL_INTERVAL * 1000 };
+        const int res = select(0, &ready, NULL, NULL, &timeout);
+        if (res == SOCKET_ERROR)
+            return InvalidSocket;
+        if (res == 0)
+            continue;
+
+        const SOCKET client = accept(fd, NULL, NULL);
+        if (client != INVALID_SOCKET)
+            return static_cast<SocketHandle>(client);
+        if (WSAGetLastError() != WSAECONNRESET)
+            return InvalidSocket;
+    }
+    return InvalidSocket;
+}
+
+size_t socketRead(SocketHandle socket, void* buf, size_t size) {
+    const int chunk = size < INT_MAX ? static_cast<int>(size) : INT_MAX;
+    const int res = recv(static_cast<SOCKET>(socket), reinterpret_cast<char*>(buf), chunk, 0);
+    return res > 0 ? static_cast<size_t>(res) : 0;
+}
+
+bool socketWrite(SocketHandle socket, const void* buf, size_t size) {
+    const char* data = reinterpret_cast<const char*>(buf);
+    while (size > 0) {
+        const int chunk = size < INT_MAX ? static_cast<int>(size) : INT_MAX;
+        const int res = send(static_cast<SOCKET>(socket), data, chunk, 0);
+        if (res == SOCKET_ERROR)
+            return false;
+        data += res;
+        size -= static_cast<size_t>(res);
+    }
+    return true;
+}
+
+void socketShutdown(SocketHandle socket) {
+    shutdown(static_cast<SOCKET>(socket), SD_RECEIVE);
+}
+
+void socketClose(SocketHandle socket) {
+    closesocket(static_cast<SOCKET>(socket));
+}
+
+void socketRemove(SocketHandle listener, const char* path) {
+    closesocket(static_cast<SOCKET>(listener));
+    DeleteFileA(path);
+    WSACleanup();
+}
+
+} // namespace platform
+} // namespace mp3enc
@@ -0,0 +1,51 @@
+//
+//  socket.hpp - cross platform local (Unix domain) stream sockets
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_SOCKET_HPP
+#define MP3ENC_SOCKET_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mp3enc {
+    namespace platform {
+        //
+        // Platform-specific socket handle
+        //
+        typedef intptr_t SocketHandle;
+
+        static const SocketHandle InvalidSocket = -1;
+
+        //
+        // The following functions are implemented in platform-
+        // specific files (socket-posix.cpp, socket-win32.cpp, etc)
+        //
+
+        // Creates a socket listening at given path. A stale socket file
+        // left by a process that is gone is replaced. Throws on error.
+        // Termination signals (SIGINT, SIGTERM, Ctrl+C) are redirected to
+        // socketAccept() from now on.
+        SocketHandle socketListen(const char* path);
+        // Waits for the next client. Returns InvalidSocket once
+        // termination of the process is requested.
+        SocketHandle socketAccept(SocketHandle listener);
+        // Receives up to size bytes. Returns 0 at the end of stream
+        // and on errors.
+        size_t socketRead(SocketHandle socket, void* buf, size_t size);
+        // Sends the whole buffer. Returns false on error (e.g. if the
+        // peer is gone).
+        bool socketWrite(SocketHandle socket, const void* buf, size_t size);
+        // Makes pending and further reads of the socket return end of
+        // stream, so that the thread reading it stops
+        void socketShutdown(SocketHandle socket);
+        void socketClose(SocketHandle socket);
+        // Closes listening socket and removes its file
+        void socketRemove(SocketHandle listener, const char* path);
+
+    } // namespace platform
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_SOCKET_HPP
@@ -0,0 +1,219 @@
+//
+//  synth.cpp - synthetic WAV corpus for benchmarks
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "synth.hpp"
+#include "file.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+#include <stdio.h>
+#include <string.h>
+
+using mp3enc::SynthSpec;
+
+namespace {
+
+    static const double PI = 3.14159265358979323846;
+
+    // Number of samples per channel generated at once
+    static const size_t BLOCK_SAMPLES = 4096;
+
+    // Small deterministic generator, so that the corpus does
+    // not depend on the C library's rand()
+    class Random {
+        uint32_t _state;
+
+    public:
+        Random(uint32_t seed)
+        : _state(seed ? seed : 1) {
+        }
+
+        // Uniformly distributed value in [-1, 1)
+        double Next() {
+            // xorshift32
+            _state ^= _state << 13;
+            _state ^= _state >> 17;
+            _state ^= _state << 5;
+            return _state / 2147483648.0 - 1.0;
+        }
+    }; // class Random
+
+    // Generates one channel of the signal sample by sample
+    class Generator {
+        const SynthSpec* _spec;
+        Random _random;
+        double _phase;
+        uint64_t _sample;
+        // Sweep range in Hz
+        double _low;
+        double _high;
+        // Transients: current burst envelope
+        double _envelope;
+
+    public:
+        Generator(const SynthSpec& spec, int channel)
+        : _spec(&spec)
+        , _random(0x9e3779b9u * (channel + 1) + spec.signal * 7919 + spec.sampleRate)
+        , _phase(channel * 0.25 * PI)
+        , _sample(0)
+        , _low(20.0)
+        , _high(0.45 * spec.sampleRate)
+        , _envelope(0.0) {
+        }
+
+        double Next() {
+            const SynthSpec& spec = *_spec;
+            const double t = static_cast<double>(_sample) / spec.sampleRate;
+            ++_sample;
+            switch (spec.signal) {
+            case SynthSpec::SWEEP: {
+                const double position = spec.seconds > 0 ? t / spec.seconds : 0;
+                const double frequency = _low * pow(_high / _low, position);
+                _phase += 2 * PI * frequency / spec.sampleRate;
+                return 0.5 * sin(_phase);
+            }
+            case SynthSpec::NOISE:
+                return 0.3 * _random.Next();
+            case SynthSpec::TRANSIENTS: {
+                // A burst every 250 ms decaying with 20 ms time constant
+                const uint64_t period = spec.sampleRate / 4;
+                if (_sample % period == 1) {
+                    _envelope = 0.9;
+                }
+                const double burst = _envelope * _random.Next();
+                _envelope *= exp(-1.0 / (0.02 * spec.sampleRate));
+                _phase += 2 * PI * 220.0 / spec.sampleRate;
+                return burst + 0.05 * sin(_phase);
+            }
+            case SynthSpec::SILENCE:
+                break;
+            }
+            return 0.0;
+        }
+    }; // class Generator
+
+    const char* signalName(SynthSpec::Signal signal) {
+        switch (signal) {
+        case SynthSpec::SWEEP:
+            return "sweep";
+        case SynthSpec::NOISE:
+            return "noise";
+        case SynthSpec::TRANSIENTS:
+            return "transients";
+        case SynthSpec::SILENCE:
+            return "silence";
+        }
+        return "unknown";
+    }
+
+    void putUint16(unsigned char* dest, uint32_t value) {
+        dest[0] = static_cast<unsigned char>(value);
+        dest[1] = static_cast<unsigned char>(value >> 8);
+    }
+
+    void putUint32(unsigned char* dest, uint32_t value) {
+        putUint16(dest, value & 0xffff);
+        putUint16(dest + 2, value >> 16);
+    }
+
+} // namespace
+
+namespace mp3enc {
+
+std::string SynthSpec::Name() const {
+    char name[128];
+    snprintf(name, sizeof(name), "%s-%dch-%d-%gs.wav",
+        signalName(signal), channels, sampleRate, seconds);
+    return name;
+}
+
+uint64_t SynthSpec::Samples() const {
+    return static_cast<uint64_t>(seconds * sampleRate + 0.5);
+}
+
+void synthWrite(const std::string& path, const SynthSpec& spec) {
+    const uint64_t samples = spec.Samples();
+    const uint32_t blockAlign = spec.channels * 2;
+    const uint64_t dataSize = samples * blockAlign;
+    if (dataSize > 0xffffffffu - 36) {
+        throw std::runtime_error("Synthetic file is too long");
+    }
+
+    // Canonical 44-byte header, always little-endian
+    unsigned char header[44];
+    memcpy(header, "RIFF", 4);
+    putUint32(header + 4, static_cast<uint32_t>(36 + dataSize));
+    memcpy(header + 8, "WAVEfmt ", 8);
+    putUint32(header + 16, 16);
+    putUint16(header + 20, 1);
+    putUint16(header + 22, spec.channels);
+    putUint32(header + 24, spec.sampleRate);
+    putUint32(header + 28, spec.sampleRate * blockAlign);
+    putUint16(header + 32, blockAlign);
+    putUint16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    putUint32(header + 40, static_cast<uint32_t>(dataSize));
+
+    OutputFile output(path.c_str());
+    if (output.Write(header, sizeof(header)) != sizeof(header)) {
+        throw std::runtime_error("Failed to write synthetic WAV file");
+    }
+
+    std::vector<Generator> generators;
+    for (int i = 0; i < spec.channels; ++i) {
+        generators.push_back(Generator(spec, i));
+    }
+
+    std::vector<unsigned char> block(BLOCK_SAMPLES * blockAlign);
+    for (uint64_t done = 0; done < samples; ) {
+        const size_t count = samples - done < BLOCK_SAMPLES
+            ? static_cast<size_t>(samples - done)
+            : BLOCK_SAMPLES;
+        unsigned char* dest = &block[0];
+        for (size_t i = 0; i < count; ++i) {
+            for (int ch = 0; ch < spec.channels; ++ch, dest += 2) {
+                double value = generators[ch].Next();
+                value = value > 1.0 ? 1.0 : value < -1.0 ? -1.0 : value;
+                const int16_t pcm = static_cast<int16_t>(floor(value * 32767.0 + 0.5));
+                putUint16(dest, static_cast<uint16_t>(pcm));
+            }
+        }
+        const size_t size = count * blockAlign;
+        if (output.Write(&block[0], size) != size) {
+            throw std::runtime_error("Failed to write synthetic WAV file");
+        }
+        done += count;
+    }
+}
+
+std::vector<SynthSpec> synthCorpus(double shortSeconds, double longSeconds) {
+    static const SynthSpec::Signal SIGNALS[] = {
+        SynthSpec::SWEEP, SynthSpec::NOISE, SynthSpec::TRANSIENTS, SynthSpec::SILENCE
+    };
+    static const int RATES[] = { 32000, 44100, 48000 };
+
+    std::vector<SynthSpec> specs;
+    for (size_t s = 0; s < sizeof(SIGNALS) / sizeof(SIGNALS[0]); ++s) {
+        for (int channels = 1; channels <= 2; ++channels) {
+            for (size_t r = 0; r < sizeof(RATES) / sizeof(RATES[0]); ++r) {
+                SynthSpec spec;
+                spec.signal = SIGNALS[s];
+                spec.channels = channels;
+                spec.sampleRate = RATES[r];
+                spec.seconds = shortSeconds;
+                specs.push_back(spec);
+                spec.seconds = longSeconds;
+                specs.push_back(spec);
+            }
+        }
+    }
+    return specs;
+}
+
+} // namespace mp3enc
@@ -0,0 +1,52 @@
+//
+//  synth.hpp - synthetic WAV corpus for benchmarks
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_SYNTH_HPP
+#define MP3ENC_SYNTH_HPP
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace mp3enc {
+
+    // Description of a synthetic WAV file
+    struct SynthSpec {
+        enum Signal {
+            // Logarithmic sine sweep across the audible range
+            SWEEP,
+            // White noise
+            NOISE,
+            // Decaying noise bursts over a quiet tone
+            TRANSIENTS,
+            // Digital silence
+            SILENCE
+        };
+
+        Signal signal;
+        int channels;
+        int sampleRate;
+        double seconds;
+
+        // File name that identifies the spec, e.g. sweep-2ch-44100-10s.wav
+        std::string Name() const;
+        // Number of samples per channel
+        uint64_t Samples() const;
+    };
+
+    // Writes 16-bit PCM WAV file for the spec. The contents depend on
+    // the spec only, so corpora generated on different machines and at
+    // different times are identical.
+    void synthWrite(const std::string& path, const SynthSpec& spec);
+
+    // Returns specs of the standard corpus: every signal in mono and
+    // stereo at 32, 44.1 and 48 kHz, both short and long
+    std::vector<SynthSpec> synthCorpus(double shortSeconds, double longSeconds);
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_SYNTH_HPP
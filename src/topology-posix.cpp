@@ -0,0 +1,121 @@
+//
+//  topology-posix.cpp - POSIX CPU topology and thread affinity
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include "config.h"
+
+#include "topology.hpp"
+#include "platform.hpp"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+#if defined(__linux__)
+
+    // Reads a number from sysfs attribute of given CPU. Returns
+    // default value if the attribute is not available.
+    int readCpuAttribute(int cpu, const char* name, int defaultValue) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+        FILE* file = fopen(path, "r");
+        if (!file)
+            return defaultValue;
+        int value = defaultValue;
+        if (fscanf(file, "%d", &value) != 1) {
+            value = defaultValue;
+        }
+        fclose(file);
+        return value;
+    }
+
+    // Finds NUMA node of given CPU, which is linked
+    // from CPU directory as "nodeN"
+    int cpuNode(int cpu) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+        DIR* dir = opendir(path);
+        if (!dir)
+            return 0;
+        int node = 0;
+        while (const struct dirent* entry = readdir(dir)) {
+            char* end = NULL;
+            if (strncmp(entry->d_name, "node", 4) == 0) {
+                const long value = strtol(entry->d_name + 4, &end, 10);
+                if (end != entry->d_name + 4 && *end == '\0') {
+                    node = static_cast<int>(value);
+                    break;
+                }
+            }
+        }
+        closedir(dir);
+        return node;
+    }
+
+#endif // #if defined(__linux__)
+
+} // namespace
+
+namespace mp3enc {
+namespace platform {
+
+std::vector<CpuInfo> CpuTopology() {
+    std::vector<CpuInfo> cpus;
+#if defined(__linux__)
+    // CPUs the process is restricted to (taskset, cpusets)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+        CpuInfo info;
+        info.cpu = cpu;
+        info.core = readCpuAttribute(cpu, "core_id", cpu);
+        info.package = readCpuAttribute(cpu, "physical_package_id", 0);
+        info.node = cpuNode(cpu);
+        cpus.push_back(info);
+    }
+#else
+    for (int cpu = 0; cpu < CpuCount(); ++cpu) {
+        CpuInfo info;
+        info.cpu = cpu;
+        info.core = cpu;
+        info.package = 0;
+        info.node = 0;
+        cpus.push_back(info);
+    }
+#endif
+    return cpus;
+}
+
+bool SetThreadAffinity(const std::vector<int>& cpus) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE) {
+            CPU_SET(cpus[i], &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    // macOS offers affinity hints only, not pinning
+    (void)cpus;
+    return false;
+#endif
+}
+
+} // namespace platform
+} // namespace mp3enc
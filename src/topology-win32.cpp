@@ -0,0 +1,87 @@
+//
+//  topology-win32.cpp - Windows CPU topology and thread affinity
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "topology.hpp"
+
+#include <Windows.h>
+
+namespace mp3enc {
+namespace platform {
+
+// Only the processor group of the process (up to 64 CPUs) is used
+std::vector<CpuInfo> CpuTopology() {
+    std::vector<CpuInfo> cpus;
+    DWORD size = 0;
+    GetLogicalProcessorInformation(NULL, &size);
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+        return cpus;
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> entries(
+        size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION) + 1);
+    if (!GetLogicalProcessorInformation(&entries[0], &size))
+        return cpus;
+    entries.resize(size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+
+    DWORD_PTR processMask = 0;
+    DWORD_PTR systemMask = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+        return cpus;
+
+    const int bits = static_cast<int>(sizeof(DWORD_PTR) * 8);
+    for (int cpu = 0; cpu < bits; ++cpu) {
+        const DWORD_PTR bit = static_cast<DWORD_PTR>(1) << cpu;
+        if (!(processMask & bit))
+            continue;
+        CpuInfo info;
+        info.cpu = cpu;
+        info.core = cpu;
+        info.package = 0;
+        info.node = 0;
+        int core = 0;
+        int package = 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& entry = entries[i];
+            const bool contains = (entry.ProcessorMask & bit) != 0;
+            switch (entry.Relationship) {
+            case RelationProcessorCore:
+                if (contains) {
+                    info.core = core;
+                }
+                ++core;
+                break;
+            case RelationProcessorPackage:
+                if (contains) {
+                    info.package = package;
+                }
+                ++package;
+                break;
+            case RelationNumaNode:
+                if (contains) {
+                    info.node = static_cast<int>(entry.NumaNode.NodeNumber);
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        cpus.push_back(info);
+    }
+    return cpus;
+}
+
+bool SetThreadAffinity(const std::vector<int>& cpus) {
+    DWORD_PTR mask = 0;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        if (cpus[i] >= 0 && cpus[i] < static_cast<int>(sizeof(DWORD_PTR) * 8)) {
+            mask |= static_cast<DWORD_PTR>(1) << cpus[i];
+        }
+    }
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+}
+
+} // namespace platform
+} // namespace mp3enc
@@ -0,0 +1,124 @@
+//
+//  topology.cpp - CPU topology and placement of worker threads
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "topology.hpp"
+
+#include <algorithm>
+
+#include <stdio.h>
+
+using mp3enc::platform::CpuInfo;
+
+namespace {
+
+    // Orders CPUs by node, package, core and number
+    bool lessByPlace(const CpuInfo& a, const CpuInfo& b) {
+        if (a.node != b.node)
+            return a.node < b.node;
+        if (a.package != b.package)
+            return a.package < b.package;
+        if (a.core != b.core)
+            return a.core < b.core;
+        return a.cpu < b.cpu;
+    }
+
+    // CPU along with its number among SMT siblings of its core
+    struct RankedCpu {
+        int cpu;
+        int rank;
+    };
+
+    bool lessByRank(const RankedCpu& a, const RankedCpu& b) {
+        return a.rank < b.rank;
+    }
+
+} // namespace
+
+namespace mp3enc {
+
+Placement::Placement(bool pin, bool skipSmt) {
+    if (!pin)
+        return;
+
+    std::vector<CpuInfo> cpus = platform::CpuTopology();
+    std::sort(cpus.begin(), cpus.end(), lessByPlace);
+
+    // Split CPUs by nodes. Within a node, first logical CPUs of all
+    // cores go first, then second ones and so on.
+    std::vector<std::vector<RankedCpu> > nodes;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        const CpuInfo& info = cpus[i];
+        const bool sameNode = i > 0 && cpus[i - 1].node == info.node;
+        const bool sibling = sameNode && cpus[i - 1].package == info.package &&
+            cpus[i - 1].core == info.core;
+        if (!sameNode) {
+            nodes.push_back(std::vector<RankedCpu>());
+            _nodeIds.push_back(info.node);
+        }
+        RankedCpu ranked;
+        ranked.cpu = info.cpu;
+        ranked.rank = sibling ? nodes.back().back().rank + 1 : 0;
+        if (skipSmt && ranked.rank > 0) {
+            // Keep the rank for the next sibling
+            nodes.back().back().rank = ranked.rank;
+            continue;
+        }
+        nodes.back().push_back(ranked);
+    }
+
+    _nodes.resize(nodes.size());
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        std::stable_sort(nodes[n].begin(), nodes[n].end(), lessByRank);
+        for (size_t i = 0; i < nodes[n].size(); ++i) {
+            _nodes[n].push_back(nodes[n][i].cpu);
+        }
+    }
+
+    // Interleave nodes, so that any number of workers is spread evenly
+    for (size_t i = 0; ; ++i) {
+        bool added = false;
+        for (size_t n = 0; n < _nodes.size(); ++n) {
+            if (i < _nodes[n].size()) {
+                Slot slot;
+                slot.cpu = _nodes[n][i];
+                slot.node = n;
+                _slots.push_back(slot);
+                added = true;
+            }
+        }
+        if (!added)
+            break;
+    }
+}
+
+size_t Placement::GetGroup(size_t worker) const {
+    return IsEnabled() ? _slots[worker % _slots.size()].node : 0;
+}
+
+bool Placement::PinToNode(size_t worker) const {
+    return IsEnabled() && platform::SetThreadAffinity(_nodes[GetGroup(worker)]);
+}
+
+bool Placement::PinToCpu(size_t worker) const {
+    if (!IsEnabled())
+        return false;
+    return platform::SetThreadAffinity(std::vector<int>(1, _slots[worker % _slots.size()].cpu));
+}
+
+std::string Placement::Describe(size_t workers) const {
+    std::string description;
+    for (size_t i = 0; i < workers && IsEnabled(); ++i) {
+        const Slot& slot = _slots[i % _slots.size()];
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%s%d/%d", i > 0 ? " " : "", slot.cpu, _nodeIds[slot.node]);
+        description += buf;
+    }
+    return description;
+}
+
+} // namespace mp3enc
@@ -0,0 +1,87 @@
+//
+//  topology.hpp - CPU topology and placement of worker threads
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_TOPOLOGY_HPP
+#define MP3ENC_TOPOLOGY_HPP
+
+#include <string>
+#include <vector>
+
+namespace mp3enc {
+    namespace platform {
+
+        // Logical CPU and its place in the machine
+        struct CpuInfo {
+            int cpu;
+            // Physical core, unique within the package
+            int core;
+            int package;
+            // NUMA node
+            int node;
+        };
+
+        //
+        // The following functions are implemented in platform-
+        // specific files (topology-posix.cpp, topology-win32.cpp, etc)
+        //
+
+        // Lists logical CPUs the process may run on. Where the topology
+        // is not known, every CPU is reported as a core of its own on
+        // node 0. Returns empty list on failure.
+        std::vector<CpuInfo> CpuTopology();
+        // Restricts the calling thread to given logical CPUs. Returns
+        // false on failure or if the platform does not support it.
+        bool SetThreadAffinity(const std::vector<int>& cpus);
+
+    } // namespace platform
+
+    // Placement assigns worker threads to logical CPUs. Workers are spread
+    // over NUMA nodes round robin and, within a node, take distinct
+    // physical cores before SMT siblings (which are skipped altogether if
+    // requested). A worker pins itself before it allocates its buffers and
+    // encoders, so that the memory is allocated on its node (first touch).
+    class Placement {
+        struct Slot {
+            int cpu;
+            // Index in _nodes
+            size_t node;
+        };
+
+        // Assignment order of CPUs
+        std::vector<Slot> _slots;
+        // CPUs of every node in use
+        std::vector<std::vector<int> > _nodes;
+        std::vector<int> _nodeIds;
+
+    public:
+        // Placement is disabled (leaving threads to the system)
+        // unless 'pin' is true
+        Placement(bool pin, bool skipSmt);
+
+        bool IsEnabled() const {
+            return !_slots.empty();
+        }
+
+        // Number of CPUs workers are placed on
+        size_t GetCpuCount() const {
+            return _slots.size();
+        }
+
+        // Group of workers sharing a NUMA node, 0 if disabled
+        size_t GetGroup(size_t worker) const;
+
+        // Restricts the calling thread, which runs the given worker,
+        // to all CPUs of the worker's node or to the worker's CPU
+        bool PinToNode(size_t worker) const;
+        bool PinToCpu(size_t worker) const;
+
+        // Human readable list of CPUs and nodes of the workers
+        std::string Describe(size_t workers) const;
+    }; // class Placement
+
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_TOPOLOGY_HPP
@@ -0,0 +1,277 @@
+//
+//  walker-posix.cpp - POSIX directory tree traversal
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include "config.h"
+
+#include "walker.hpp"
+#include "exception.hpp"
+#include "utils.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#if !defined(O_CLOEXEC)
+#define O_CLOEXEC 0
+#endif
+
+namespace {
+
+#if defined(__linux__) && defined(SYS_getdents64)
+
+    // Size of the buffer for entries of a single directory
+    static const size_t DIRENT_BUFFER_SIZE = 32768;
+
+    // Record layout filled by getdents64() system call
+    struct LinuxDirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    // Reads directory entries with getdents64(). A single system call
+    // fetches as many entries as fit into the buffer and, unlike
+    // readdir(), the buffer is owned by the reader and re-used.
+    class DirReader {
+        int _fd;
+        std::vector<char> _buf;
+        size_t _pos;
+        size_t _len;
+
+        DirReader(const DirReader&);
+        DirReader& operator=(const DirReader&);
+
+    public:
+        // Takes ownership of directory descriptor
+        DirReader(int fd)
+        : _fd(fd)
+        , _buf(DIRENT_BUFFER_SIZE)
+        , _pos(0)
+        , _len(0) {
+        }
+
+        ~DirReader() {
+            close(_fd);
+        }
+
+        int Fd() const {
+            return _fd;
+        }
+
+        // Fetches next entry. Returns false at the end of directory
+        // or on read error.
+        bool Next(const char*& name, unsigned char& type) {
+            if (_pos >= _len) {
+                const long res = syscall(SYS_getdents64, _fd, &_buf[0], _buf.size());
+                if (res <= 0)
+                    return false;
+                _pos = 0;
+                _len = static_cast<size_t>(res);
+            }
+            const LinuxDirent64* entry = reinterpret_cast<const LinuxDirent64*>(&_buf[_pos]);
+            _pos += entry->d_reclen;
+            name = entry->d_name;
+            type = entry->d_type;
+            return true;
+        }
+    }; // class DirReader
+
+#else
+
+    // Portable fallback based on readdir()
+    class DirReader {
+        DIR* _dir;
+
+        DirReader(const DirReader&);
+        DirReader& operator=(const DirReader&);
+
+    public:
+        // Takes ownership of directory descriptor
+        DirReader(int fd)
+        : _dir(fdopendir(fd)) {
+            if (!_dir)
+                close(fd);
+        }
+
+        ~DirReader() {
+            if (_dir)
+                closedir(_dir);
+        }
+
+        int Fd() const {
+            return _dir ? dirfd(_dir) : -1;
+        }
+
+        bool Next(const char*& name, unsigned char& type) {
+            const struct dirent* entry = _dir ? readdir(_dir) : NULL;
+            if (!entry)
+                return false;
+            name = entry->d_name;
+#if defined(_DIRENT_HAVE_D_TYPE) || defined(DT_UNKNOWN)
+            type = entry->d_type;
+#else
+            type = 0;
+#endif
+            return true;
+        }
+    }; // class DirReader
+
+#endif
+
+#if !defined(DT_UNKNOWN)
+    enum {
+        DT_UNKNOWN = 0,
+        DT_DIR = 4,
+        DT_REG = 8,
+        DT_LNK = 10
+    };
+#endif
+
+    // Depth-first traversal that keeps a descriptor and an entry
+    // buffer open for every directory on the current path only
+    class PosixWalker {
+        std::vector<DirReader*> _dirs;
+        // Lengths of _path for each open directory
+        std::vector<size_t> _pathLengths;
+        // Path of the current directory with trailing separator
+        std::string _path;
+        std::string _extension;
+        bool _recursive;
+
+    public:
+        PosixWalker(const char* directory, const char* extension, bool recursive)
+        : _path(mp3enc::utils::NormalizeDirectory(directory))
+        , _extension(extension)
+        , _recursive(recursive) {
+            const int fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd < 0)
+                throw mp3enc::CRuntimeError(errno);
+            push(fd);
+        }
+
+        ~PosixWalker() {
+            while (!_dirs.empty()) {
+                pop();
+            }
+        }
+
+        bool nextFile(std::string& path, uint64_t& size) {
+            while (!_dirs.empty()) {
+                DirReader& dir = *_dirs.back();
+                const char* name = NULL;
+                unsigned char type = DT_UNKNOWN;
+                if (!dir.Next(name, type)) {
+                    pop();
+                    continue;
+                }
+
+                // Skip hidden entries along with "." and "..",
+                // like shell globbing does
+                if (name[0] == '.')
+                    continue;
+
+                struct stat st;
+                if (type == DT_UNKNOWN) {
+                    // File system does not report entry types
+                    if (fstatat(dir.Fd(), name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                        continue;
+                    type = S_ISDIR(st.st_mode) ? DT_DIR
+                        : S_ISLNK(st.st_mode) ? DT_LNK
+                        : S_ISREG(st.st_mode) ? DT_REG
+                        : DT_UNKNOWN;
+                }
+
+                if (type == DT_DIR) {
+                    if (_recursive) {
+                        descend(dir.Fd(), name);
+                    }
+                    continue;
+                }
+
+                // Symbolic links to files are followed, symbolic
+                // links to directories are not, which rules out cycles
+                if ((type != DT_REG && type != DT_LNK) || !hasExtension(name))
+                    continue;
+                if (fstatat(dir.Fd(), name, &st, 0) != 0 || !S_ISREG(st.st_mode))
+                    continue;
+
+                path = _path + name;
+                size = static_cast<uint64_t>(st.st_size);
+                return true;
+            }
+            return false;
+        }
+
+    private:
+
+        bool hasExtension(const char* name) const {
+            const size_t len = strlen(name);
+            return len > _extension.size() &&
+                strcasecmp(name + len - _extension.size(), _extension.c_str()) == 0;
+        }
+
+        void descend(int parent, const char* name) {
+            const int fd = openat(parent, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd < 0) {
+                // Unreadable subdirectories are ignored
+                return;
+            }
+            // The name is invalidated by the next read of parent
+            // directory, hence path is updated first
+            _pathLengths.push_back(_path.size());
+            _path.append(name);
+            _path.push_back(mp3enc::platform::PathSeparator);
+            _dirs.push_back(new DirReader(fd));
+        }
+
+        void push(int fd) {
+            _pathLengths.push_back(_path.size());
+            _dirs.push_back(new DirReader(fd));
+        }
+
+        void pop() {
+            assert(!_dirs.empty());
+            delete _dirs.back();
+            _dirs.pop_back();
+            _path.resize(_pathLengths.back());
+            _pathLengths.pop_back();
+        }
+    }; // class PosixWalker
+
+} // namespace
+
+namespace mp3enc {
+namespace platform {
+
+WalkerHandle walkerInit(const char* directory, const char* extension, bool recursive) {
+    return reinterpret_cast<WalkerHandle>(new PosixWalker(directory, extension, recursive));
+}
+
+bool walkerNext(WalkerHandle handle, std::string& path, uint64_t& size) {
+    assert(handle);
+    return reinterpret_cast<PosixWalker*>(handle)->nextFile(path, size);
+}
+
+void walkerClose(WalkerHandle handle) {
+    assert(handle);
+    delete reinterpret_cast<PosixWalker*>(handle);
+}
+
+} // namspace platform
+} // namespace mp3enc
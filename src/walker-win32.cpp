@@ -0,0 +1,154 @@
+//
+//  walker-win32.cpp - Windows directory tree traversal
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#include <config.h>
+
+#include "walker.hpp"
+#include "exception.hpp"
+#include "utils.hpp"
+
+#include <windows.h>
+
+#include <cassert>
+#include <cerrno>
+#include <string.h>
+#include <vector>
+
+namespace {
+
+    // Open search in a single directory
+    struct Search {
+        HANDLE handle;
+        WIN32_FIND_DATAA data;
+        // Length of the walker's path for this directory
+        size_t pathLength;
+        // Whether data holds an entry not yet processed
+        bool pending;
+    };
+
+    class Win32Walker {
+        std::vector<Search> _searches;
+        // Path of the current directory with trailing separator
+        std::string _path;
+        std::string _extension;
+        bool _recursive;
+
+    public:
+        Win32Walker(const char* directory, const char* extension, bool recursive)
+        : _path(mp3enc::utils::NormalizeDirectory(directory))
+        , _extension(extension)
+        , _recursive(recursive) {
+            if (!open()) {
+                const DWORD error = GetLastError();
+                throw mp3enc::CRuntimeError(
+                    error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND ? ENOENT : EACCES);
+            }
+        }
+
+        ~Win32Walker() {
+            while (!_searches.empty()) {
+                close();
+            }
+        }
+
+        bool nextFile(std::string& path, uint64_t& size) {
+            while (!_searches.empty()) {
+                Search& search = _searches.back();
+                if (!search.pending && !FindNextFileA(search.handle, &search.data)) {
+                    close();
+                    continue;
+                }
+                search.pending = false;
+
+                const WIN32_FIND_DATAA& data = search.data;
+                // Skip hidden entries along with "." and ".."
+                if (data.cFileName[0] == '.' || (data.dwFileAttributes & FILE_ATTRIBUTE_HIDDEN))
+                    continue;
+
+                if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                    // Junctions and directory symbolic links are not
+                    // followed, which rules out cycles
+                    if (_recursive && !(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+                        const size_t length = _path.size();
+                        _path.append(data.cFileName);
+                        _path.push_back(mp3enc::platform::PathSeparator);
+                        if (!open()) {
+                            // Unreadable subdirectories are ignored
+                            _path.resize(length);
+                        }
+                    }
+                    continue;
+                }
+
+                if (!hasExtension(data.cFileName))
+                    continue;
+
+                path = _path + data.cFileName;
+                size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+                return true;
+            }
+            return false;
+        }
+
+    private:
+
+        bool hasExtension(const char* name) const {
+            const size_t len = strlen(name);
+            return len > _extension.size() &&
+                _stricmp(name + len - _extension.size(), _extension.c_str()) == 0;
+        }
+
+        // Starts search in the directory at _path
+        bool open() {
+            Search search;
+            const std::string pattern(_path + "*");
+#if _WIN32_WINNT >= 0x0601
+            // Skip short names and fetch entries in larger batches
+            search.handle = FindFirstFileExA(pattern.c_str(), FindExInfoBasic, &search.data,
+                FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+#else
+            search.handle = FindFirstFileA(pattern.c_str(), &search.data);
+#endif
+            if (search.handle == INVALID_HANDLE_VALUE)
+                return false;
+            search.pathLength = _path.size();
+            search.pending = true;
+            _searches.push_back(search);
+            return true;
+        }
+
+        void close() {
+            assert(!_searches.empty());
+            FindClose(_searches.back().handle);
+            _searches.pop_back();
+            // Restore path of the parent directory
+            if (!_searches.empty()) {
+                _path.resize(_searches.back().pathLength);
+            }
+        }
+    }; // class Win32Walker
+
+} // namespace
+
+namespace mp3enc {
+namespace platform {
+
+WalkerHandle walkerInit(const char* directory, const char* extension, bool recursive) {
+    return reinterpret_cast<WalkerHandle>(new Win32Walker(directory, extension, recursive));
+}
+
+bool walkerNext(WalkerHandle handle, std::string& path, uint64_t& size) {
+    assert(handle);
+    return reinterpret_cast<Win32Walker*>(handle)->nextFile(path, size);
+}
+
+void walkerClose(WalkerHandle handle) {
+    assert(handle);
+    delete reinterpret_cast<Win32Walker*>(handle);
+}
+
+} // namspace platform
+} // namespace mp3enc
@@ -0,0 +1,66 @@
+//
+//  walker.hpp - cross platform directory tree traversal
+//
+//  Copyright © 2019 Denis Shtyrov. All rights reserved.
+//
+
+#ifndef MP3ENC_WALKER_HPP
+#define MP3ENC_WALKER_HPP
+
+#include <string>
+
+#include <stdint.h>
+
+namespace mp3enc {
+    namespace platform {
+        //
+        // Platform-specific directory walker handle
+        //
+        typedef void* WalkerHandle;
+
+        //
+        // The following functions are implemented in platform-
+        // specific files (walker-posix.cpp, walker-win32.cpp, etc)
+        //
+
+        // Starts traversal of the directory. Files are matched against
+        // given extension case-insensitively. Subdirectories are visited
+        // only in recursive mode. Throws if the directory cannot be opened.
+        WalkerHandle walkerInit(const char* directory, const char* extension, bool recursive);
+        // Fetches next matching file. Returns false when traversal is
+        // complete. Unreadable subdirectories are silently skipped.
+        bool walkerNext(WalkerHandle handle, std::string& path, uint64_t& size);
+        void walkerClose(WalkerHandle handle);
+
+    } // namespace platform
+
+    // DirWalker lists matching files of a directory tree lazily, one
+    // directory block at a time, so that the files can be processed
+    // while the rest of the tree is still being scanned. Memory usage
+    // depends on the depth of the tree, not on the number of files.
+    class DirWalker {
+        platform::WalkerHandle _handle;
+        // Objects of this class must not be copied
+        DirWalker(const DirWalker&);
+        DirWalker& operator=(const DirWalker&);
+
+    public:
+        DirWalker(const char* directory, const char* extension, bool recursive)
+        : _handle(platform::walkerInit(directory, extension, recursive)) {
+        }
+        ~DirWalker() {
+            if (_handle) {
+                platform::walkerClose(_handle);
+                _handle = 0;
+            }
+        }
+
+        // Gets path and size of the next matching file. Returns
+        // false if there are no more files.
+        bool NextFile(std::string& path, uint64_t& size) {
+            return platform::walkerNext(_handle, path, size);
+        }
+    }; // class DirWalker
+} // namespace mp3enc
+
+#endif // #ifndef MP3ENC_WALKER_HPP
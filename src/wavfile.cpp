@@ -8,14 +8,67 @@
 
 #include "wavfile.hpp"
 
+#include "exception.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <cassert>
 #include <stdexcept>
 #include <string>
 
 namespace {
+
+// Number of bytes following the mapped block returned by MapSamples()
+// that are requested to be read ahead in background
+static const size_t PREFETCH_SIZE = 1024 * 1024;
+
+// Chunk size written by streaming programs that do not know the size
+static const uint32_t UNKNOWN_SIZE = 0xFFFFFFFF;
+
+// Format tags of fmt chunk
+static const uint16_t WAVE_FORMAT_PCM = 1;
+static const uint16_t WAVE_FORMAT_IEEE_FLOAT = 3;
+static const uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+// Tail of KSDATAFORMAT_SUBTYPE_* GUIDs of extensible format, which
+// start with the format tag
+static const unsigned char SUBFORMAT_GUID_TAIL[14] = {
+    0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+};
+
+// Number of 24-bit samples unpacked at once by unpack24()
+static const size_t UNPACK_BLOCK = 256;
+
+// Unpacks count 24-bit samples to 32-bit integers in place. Blocks are
+// unpacked from the end of the buffer, where unpacked samples do not
+// overlap packed ones yet, through a copy of the packed block, so that
+// the inner loop has no aliasing and is vectorized by the compiler.
+void unpack24(void* samples, size_t count, bool bigEndian) {
+    unsigned char* bytes = reinterpret_cast<unsigned char*>(samples);
+    int32_t* values = reinterpret_cast<int32_t*>(samples);
+    // Positions of the most and least significant bytes of a sample
+    const size_t high = bigEndian ? 0 : 2;
+    const size_t low = bigEndian ? 2 : 0;
+    unsigned char packed[UNPACK_BLOCK * 3];
+    for (size_t end = count; end > 0; ) {
+        const size_t begin = end > UNPACK_BLOCK ? end - UNPACK_BLOCK : 0;
+        const size_t n = end - begin;
+        memcpy(packed, bytes + begin * 3, n * 3);
+        int32_t* out = values + begin;
+        for (size_t i = 0; i < n; ++i) {
+            const unsigned char* in = packed + i * 3;
+            out[i] = static_cast<int32_t>(
+                static_cast<uint32_t>(in[high]) << 24 |
+                static_cast<uint32_t>(in[1]) << 16 |
+                static_cast<uint32_t>(in[low]) << 8);
+        }
+        end = begin;
+    }
+}
+
 //
-// Chunk structures defined by RIFF(X) format
+// Chunk structures defined by RIFF(X) and RF64 formats
 //
 
 #pragma pack(push, 1)
@@ -26,20 +79,35 @@ struct ChunkDescriptor {
     char fmt[4];
 };
 
-struct FormatChunk {
+struct ChunkHeader {
     char id[4];
     uint32_t size;
+};
+
+// Body of fmt chunk. Plain PCM format ends at bits_per_sample,
+// WAVE_FORMAT_EXTENSIBLE has all of the fields.
+struct FormatChunk {
     uint16_t audio_fmt;
     uint16_t channels;
     uint32_t sample_rate;
     uint32_t byte_rate;
     uint16_t block_align;
     uint16_t bits_per_sample;
+    uint16_t extension_size;
+    uint16_t valid_bits_per_sample;
+    uint32_t channel_mask;
+    unsigned char sub_format[16];
 };
 
-struct DataChunk {
-    char id[4];
-    uint32_t size;
+// Body of ds64 chunk of RF64 files holding 64-bit sizes
+struct Ds64Chunk {
+    uint32_t riff_size_low;
+    uint32_t riff_size_high;
+    uint32_t data_size_low;
+    uint32_t data_size_high;
+    uint32_t sample_count_low;
+    uint32_t sample_count_high;
+    uint32_t table_length;
 };
 
 #pragma pack(pop)
@@ -47,16 +115,73 @@ struct DataChunk {
 
 namespace mp3enc {
 
-WavFile::WavFile(const char* filepath)
+WavFile::WavFile(const char* filepath, bool useMapping)
 : _file(filepath)
+, _data(NULL)
+, _bigendian(false)
+, _totalSamples(0)
+, _lengthKnown(true)
+, _samplesRead(0)
+, _dataOffset(0)
+, _channels(0)
+, _sampleRate(0)
+, _bitsPerSample(0)
+, _format(PCM_16)
+, _channelMask(0) {
+    parseChunks(false);
+    if (useMapping) {
+        mapData(filepath);
+    }
+}
+
+WavFile::WavFile(FILE* stream)
+: _file(stream)
+, _data(NULL)
 , _bigendian(false)
 , _totalSamples(0)
+, _lengthKnown(true)
 , _samplesRead(0)
+, _dataOffset(0)
 , _channels(0)
-, _sampleRate(0) {
-    parseRiffChunk();
-    parseFormatChunk();
-    parseDataChunk();
+, _sampleRate(0)
+, _bitsPerSample(0)
+, _format(PCM_16)
+, _channelMask(0) {
+    parseChunks(true);
+}
+
+WavFile::WavFile(FILE* stream, int channels, int sampleRate)
+: _file(stream)
+, _data(NULL)
+, _bigendian(false)
+, _totalSamples(static_cast<size_t>(-1))
+, _lengthKnown(false)
+, _samplesRead(0)
+, _dataOffset(0)
+, _channels(channels)
+, _sampleRate(sampleRate)
+, _bitsPerSample(16)
+, _format(PCM_16)
+, _channelMask(0) {
+    if (channels < 1 || channels > 2 || sampleRate <= 0)
+        throw std::runtime_error("Unsupported PCM format");
+}
+
+WavFile::WavFile(void* pcm, size_t size, int channels, int sampleRate)
+: _data(reinterpret_cast<const unsigned char*>(pcm))
+, _bigendian(false)
+, _totalSamples(0)
+, _lengthKnown(true)
+, _samplesRead(0)
+, _dataOffset(0)
+, _channels(channels)
+, _sampleRate(sampleRate)
+, _bitsPerSample(16)
+, _format(PCM_16)
+, _channelMask(0) {
+    if (channels < 1 || channels > 2 || sampleRate <= 0)
+        throw std::runtime_error("Unsupported PCM format");
+    _totalSamples = size / (_channels * sizeof(short));
 }
 
 size_t WavFile::ReadSamples(void* dest, size_t num) {
@@ -69,74 +194,217 @@ size_t WavFile::ReadSamples(void* dest, size_t num) {
         num = _totalSamples - _samplesRead;
     }
 
-    const int sampleSize = sizeof(short) * _channels;
-    const int read = _file.Read(dest, num * sampleSize) / sampleSize;
+    if (IsMapped()) {
+        const void* samples = NULL;
+        num = MapSamples(samples, num);
+        memcpy(dest, samples, num * _channels * (_bitsPerSample / 8));
+        return num;
+    }
+
+    const size_t sampleSize = _channels * (_bitsPerSample / 8);
+    const size_t read = _file.Read(dest, num * sampleSize) / sampleSize;
     _samplesRead += read;
 
-    if (read == 0 && _samplesRead != _totalSamples) {
+    if (read == 0 && _file.Error()) {
+        throw std::runtime_error("Failed to read WAV stream");
+    }
+    if (read == 0 && _samplesRead != _totalSamples && _lengthKnown) {
         // We reached EOF and read unexpected number of samples.
         // Input file must be corrupt!
         throw std::runtime_error("Unexpected end of WAV stream");
     }
 
-    if (platform::BigEndian != _bigendian) {
-        // PCM data needs to be converted to local machine endianness
-        uint16_t* samples = reinterpret_cast<uint16_t*>(dest);
-        for (size_t i = 0; i < num * _channels; ++i) {
-            samples[i] = utils::swap_bytes_uint16(samples[i]);
-        }
+    ConvertSamples(dest, read);
+    return read;
+}
+
+size_t WavFile::ReserveSamples(size_t num, uint64_t& offset, size_t& bytes) {
+    assert(!IsMapped());
+    if (num > _totalSamples - _samplesRead) {
+        num = _totalSamples - _samplesRead;
     }
 
-    return read;
+    const size_t sampleSize = _channels * (_bitsPerSample / 8);
+    offset = _dataOffset + static_cast<uint64_t>(_samplesRead) * sampleSize;
+    bytes = num * sampleSize;
+    _samplesRead += num;
+    return num;
+}
+
+void WavFile::ConvertSamples(void* samples, size_t num) const {
+    if (_format == PCM_24) {
+        unpack24(samples, num * _channels, _bigendian);
+    }
+}
+
+size_t WavFile::MapSamples(const void*& samples, size_t num) {
+    assert(IsMapped());
+    if (num > _totalSamples - _samplesRead) {
+        num = _totalSamples - _samplesRead;
+    }
+
+    const size_t sampleSize = _channels * (_bitsPerSample / 8);
+    const uint64_t offset = _dataOffset + static_cast<uint64_t>(_samplesRead) * sampleSize;
+    samples = _data + offset;
+    _samplesRead += num;
+
+    // Let the system fetch following pages while the returned
+    // block is being encoded
+    if (_mapping.IsOpen()) {
+        _mapping.Prefetch(offset + num * sampleSize, PREFETCH_SIZE);
+    }
+    return num;
+}
+
+void WavFile::Prefetch() {
+    if (_mapping.IsOpen()) {
+        const size_t sampleSize = _channels * (_bitsPerSample / 8);
+        _mapping.Prefetch(_dataOffset + static_cast<uint64_t>(_samplesRead) * sampleSize, PREFETCH_SIZE);
+    }
+}
+
+void WavFile::Seek(size_t sample) {
+    if (sample > _totalSamples)
+        throw std::out_of_range("WAV stream position is out of range");
+
+    // Mapped samples are addressed directly
+    if (!IsMapped()) {
+        const uint64_t offset = _dataOffset + static_cast<uint64_t>(sample) * _channels * (_bitsPerSample / 8);
+        if (!_file.Seek(offset))
+            throw CRuntimeError(errno);
+    }
+    _samplesRead = sample;
 }
         
-void WavFile::parseRiffChunk() {
+void WavFile::mapData(const char* filepath) {
+    // PCM data is passed to the encoder as is, so it must not need
+    // unpacking and must be properly aligned
+    if (_format == PCM_24 || _dataOffset % GetSampleSize() != 0)
+        return;
+
+    if (!_mapping.Open(filepath))
+        return;
+
+    // Truncated files are read using regular I/O, which
+    // reports the error in a controlled manner
+    const uint64_t dataSize = static_cast<uint64_t>(_totalSamples) * _channels * (_bitsPerSample / 8);
+    if (_mapping.Size() < _dataOffset + dataSize) {
+        _mapping.Close();
+        return;
+    }
+    _data = _mapping.Data();
+}
+
+void WavFile::parseChunks(bool streaming) {
     // RIFF chunk descriptor
-    ChunkDescriptor chunk;
+    ChunkDescriptor riff;
 
     // Read chunk descriptor and validate it
-    const bool validChunk = _file.ReadStruct(chunk) &&
-        (0 == strncmp(chunk.id, "RIFF", 4) || 0 == strncmp(chunk.id, "RIFX", 4)) &&
-        0 == strncmp(chunk.fmt, "WAVE", 4);
+    const bool validChunk = _file.ReadStruct(riff) &&
+        (0 == strncmp(riff.id, "RIFF", 4) || 0 == strncmp(riff.id, "RIFX", 4) ||
+         0 == strncmp(riff.id, "RF64", 4)) &&
+        0 == strncmp(riff.fmt, "WAVE", 4);
     if (!validChunk)
         throw std::runtime_error("Unsupported RIFF type");
 
     // Is the data stored in big endian (RIFX) format?
-    _bigendian = (chunk.id[3] == 'X');
-}
+    _bigendian = (riff.id[3] == 'X');
+    const bool rf64 = (riff.id[1] == 'F');
 
-void WavFile::parseFormatChunk() {
-    // Format sub-chunk
-    FormatChunk chunk;
+    // Walk chunks up to PCM data. Chunks of no interest (LIST, bext,
+    // JUNK, fact, ...) are skipped without reading them, unless the
+    // stream is not seekable.
+    bool formatFound = false;
+    uint64_t rf64DataSize = 0;
+    uint64_t dataSize = 0;
+    for (;;) {
+        ChunkHeader chunk;
+        if (!_file.ReadStruct(chunk))
+            throw std::runtime_error("Invalid RIFF data chunk");
+        uint64_t size = utils::native_uint32(chunk.size, _bigendian);
+        if (0 == strncmp(chunk.id, "data", 4)) {
+            // Size of RF64 data is kept in ds64 chunk
+            dataSize = rf64 && size == UNKNOWN_SIZE ? rf64DataSize : size;
+            if (!formatFound)
+                throw std::runtime_error("Unsupported WAV format");
+            break;
+        }
 
-    // Read chunk descriptor and validate it
-    const bool validChunk = _file.ReadStruct(chunk) &&
-        0 == strncmp(chunk.id, "fmt ", 4) &&
-        // Only raw 16 bit PCM format is supported
-        utils::native_uint16(chunk.size, _bigendian) == 16 &&
-        utils::native_uint16(chunk.audio_fmt, _bigendian) == 1 &&
-        utils::native_uint16(chunk.bits_per_sample, _bigendian) == 16;
-    if (!validChunk)
-        throw std::runtime_error("Unsupported WAV format");
+        uint64_t parsed = 0;
+        if (0 == strncmp(chunk.id, "fmt ", 4)) {
+            parsed = parseFormat(size);
+            formatFound = true;
+        } else if (0 == strncmp(chunk.id, "ds64", 4) && rf64) {
+            Ds64Chunk ds64;
+            if (size < sizeof(ds64) || !_file.ReadStruct(ds64))
+                throw std::runtime_error("Invalid RF64 ds64 chunk");
+            rf64DataSize = static_cast<uint64_t>(utils::native_uint32(ds64.data_size_high, _bigendian)) << 32 |
+                utils::native_uint32(ds64.data_size_low, _bigendian);
+            parsed = sizeof(ds64);
+        }
 
-    // Save audio format parameters
-    _channels = utils::native_uint16(chunk.channels, _bigendian);
-    _sampleRate = utils::native_uint32(chunk.sample_rate, _bigendian);
-    _bitsPerSample = utils::native_uint16(chunk.bits_per_sample, _bigendian);
+        // Chunks are word aligned
+        const uint64_t rest = size - parsed + (size & 1);
+        const bool skipped = streaming ? _file.Skip(rest) : _file.Seek(_file.Tell() + rest);
+        if (!skipped)
+            throw std::runtime_error("Invalid RIFF data chunk");
+    }
+
+    // PCM data immediately follows data chunk header
+    _dataOffset = _file.Tell();
+
+    // Save total number of samples in input stream
+    if (streaming && (dataSize == 0 || (!rf64 && dataSize == UNKNOWN_SIZE))) {
+        _totalSamples = static_cast<size_t>(-1);
+        _lengthKnown = false;
+        return;
+    }
+    _totalSamples = static_cast<size_t>(dataSize / (_channels * GetBitsPerSample() / 8));
 }
 
-void WavFile::parseDataChunk() {
-    // Data sub-chunk
-    DataChunk chunk;
+uint64_t WavFile::parseFormat(uint64_t size) {
+    // Format sub-chunk, of which only the part present in the
+    // file is read
+    FormatChunk chunk;
+    memset(&chunk, 0, sizeof(chunk));
+    const size_t length = static_cast<size_t>(std::min<uint64_t>(size, sizeof(chunk)));
+    if (size < 16 || _file.Read(&chunk, length) != length)
+        throw std::runtime_error("Unsupported WAV format");
 
-    // Read chunk descriptor and validate it
-    const bool validChunk = _file.ReadStruct(chunk) &&
-        0 == strncmp(chunk.id, "data", 4);
-    if (!validChunk)
-        throw std::runtime_error("Invalid RIFF data chunk");
+    // Extensible format carries the actual format tag in its sub-format
+    uint16_t format = utils::native_uint16(chunk.audio_fmt, _bigendian);
+    const uint16_t bitsPerSample = utils::native_uint16(chunk.bits_per_sample, _bigendian);
+    if (format == WAVE_FORMAT_EXTENSIBLE) {
+        // Samples with fewer valid bits (e.g. 24 in 32 or 20 in 24) are
+        // left-aligned in their containers, so they are encoded as
+        // samples of the container size
+        const uint16_t validBits = utils::native_uint16(chunk.valid_bits_per_sample, _bigendian);
+        if (length < sizeof(chunk) ||
+            0 != memcmp(chunk.sub_format + 2, SUBFORMAT_GUID_TAIL, sizeof(SUBFORMAT_GUID_TAIL)) ||
+            validBits > bitsPerSample)
+            throw std::runtime_error("Unsupported WAV format");
+        format = static_cast<uint16_t>(chunk.sub_format[0] | chunk.sub_format[1] << 8);
+        _channelMask = utils::native_uint32(chunk.channel_mask, _bigendian);
+    }
 
-    // Save total number of samples in input stream
-    _totalSamples = utils::native_uint32(chunk.size, _bigendian) / (_channels * GetBitsPerSample() / 8);
+    // 16, 24 and 32 bit integers and 32 bit floats are supported
+    _channels = utils::native_uint16(chunk.channels, _bigendian);
+    _sampleRate = utils::native_uint32(chunk.sample_rate, _bigendian);
+    _bitsPerSample = bitsPerSample;
+    if (format == WAVE_FORMAT_PCM && _bitsPerSample == 16) {
+        _format = PCM_16;
+    } else if (format == WAVE_FORMAT_PCM && _bitsPerSample == 24) {
+        _format = PCM_24;
+    } else if (format == WAVE_FORMAT_PCM && _bitsPerSample == 32) {
+        _format = PCM_32;
+    } else if (format == WAVE_FORMAT_IEEE_FLOAT && _bitsPerSample == 32) {
+        _format = FLOAT_32;
+    } else {
+        throw std::runtime_error("Unsupported WAV format");
+    }
+    if (_channels == 0)
+        throw std::runtime_error("Unsupported WAV format");
+    return length;
 }
     
 } // namespace mp3enc
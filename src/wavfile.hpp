@@ -8,28 +8,70 @@
 #define MP3ENC_WAVFILE_HPP
 
 #include "file.hpp"
+#include "mapping.hpp"
 #include "utils.hpp"
 
 namespace mp3enc {
 
     class WavFile {
+    public:
+        // Format of samples handed to the encoder
+        enum SampleFormat {
+            // 16-bit integers
+            PCM_16,
+            // 24-bit integers stored in three bytes, unpacked to 32-bit
+            // integers with the sample in the upper bytes
+            PCM_24,
+            // 32-bit integers
+            PCM_32,
+            // 32-bit IEEE floats in -1..1 range
+            FLOAT_32
+        };
+
+    private:
         InputFile _file;
+        // Memory mapping of the file used for zero-copy reading
+        FileMapping _mapping;
+        // PCM data in memory, either within the mapping or passed
+        // by the caller. NULL if the data is read from the file.
+        const unsigned char* _data;
         // Does input file use big endian integer format?
         bool _bigendian;
         // Total number of samples stored in a file
         size_t _totalSamples;
+        // False for streams that last until end of file
+        bool _lengthKnown;
         // Samples read so far
         size_t _samplesRead;
+        // Offset of PCM data within input file
+        uint64_t _dataOffset;
         // Input audio stream parameters
         int _channels;
         int _sampleRate;
         int _bitsPerSample;
+        SampleFormat _format;
+        // Speaker positions of channels, 0 if not given
+        uint32_t _channelMask;
     
         WavFile(const WavFile&);
         WavFile& operator=(const WavFile&);
 
     public:
-        WavFile(const char* filepath);
+        // If useMapping is true, the file is memory mapped when PCM
+        // data can be passed to encoder as is (see MapSamples())
+        WavFile(const char* filepath, bool useMapping = false);
+        // Reads WAV stream from already open file (e.g. a pipe) strictly
+        // sequentially. Data size of 0 or 0xFFFFFFFF, as written by
+        // programs that cannot seek back to update the header, means
+        // that PCM data lasts until end of file.
+        explicit WavFile(FILE* stream);
+        // Reads headerless little-endian 16-bit PCM stream until end
+        // of file
+        WavFile(FILE* stream, int channels, int sampleRate);
+        // Reads headerless little-endian 16-bit PCM data held in memory
+        // (e.g. received from a daemon client). The data must outlive
+        // the object.
+        WavFile(void* pcm, size_t size, int channels, int sampleRate);
         ~WavFile() {
         }
 
@@ -41,25 +83,92 @@ namespace mp3enc {
             return _sampleRate;
         }
         
+        // Meaningless unless IsLengthKnown() is true
         size_t GetTotalSamples() const {
             return static_cast<size_t>(_totalSamples);
         }
 
+        bool IsLengthKnown() const {
+            return _lengthKnown;
+        }
+
+        // Bits per sample as stored in the file
         int GetBitsPerSample() const {
             return _bitsPerSample;
         }
 
+        SampleFormat GetSampleFormat() const {
+            return _format;
+        }
+
+        // WAVE channel mask of extensible format files, 0 otherwise
+        uint32_t GetChannelMask() const {
+            return _channelMask;
+        }
+
+        // Size of a sample of a channel in the format returned by
+        // ReadSamples() and ConvertSamples(). Buffers passed to them
+        // must have room for that many bytes per sample.
+        size_t GetSampleSize() const {
+            return _format == PCM_16 ? sizeof(int16_t) : sizeof(int32_t);
+        }
+
+        // Are returned samples in byte order of the machine? Samples are
+        // returned in byte order of the file, the encoder swaps them
+        // while converting them anyway.
+        bool IsNativeOrder() const {
+            return _format == PCM_24 || _bigendian == platform::BigEndian;
+        }
+
         // Read num samples from input WAV file and return
         // the actual number of samples read. Both 'num' argument
         // and method's return value specify number of samples
         // per channel (not the sum of samples in all channels)
         size_t ReadSamples(void* dest, size_t num);
+
+        // Does the object support zero-copy reading with MapSamples()?
+        bool IsMapped() const {
+            return _data != NULL;
+        }
+
+        // Zero-copy alternative to ReadSamples() available for memory
+        // mapped files and data in memory. Sets 'samples' to the next num samples within
+        // the file mapping and returns the actual number of samples.
+        size_t MapSamples(const void*& samples, size_t num);
+
+        // Asks the system to read PCM data following the current
+        // position in background (memory mapped files only)
+        void Prefetch();
+
+        // Alternative to ReadSamples() for callers doing I/O on their
+        // own. Advances stream position by up to num samples without
+        // reading them and returns the actual number of samples along
+        // with their location in the file. Data read from there must be
+        // passed through ConvertSamples().
+        size_t ReserveSamples(size_t num, uint64_t& offset, size_t& bytes);
+
+        // Converts num samples read from the file to the format returned
+        // by ReadSamples() in place: 24-bit samples are unpacked and take
+        // more space once converted, others are left as they are.
+        void ConvertSamples(void* samples, size_t num) const;
+
+        // Descriptor of the input file
+        int GetDescriptor() const {
+            return _file.Descriptor();
+        }
+
+        // Position input stream at a given sample (per channel) so
+        // that the next ReadSamples() call starts reading from it
+        void Seek(size_t sample);
         
     private:
 
-        void parseRiffChunk();
-        void parseFormatChunk();
-        void parseDataChunk();
+        // Walks RIFF chunks up to PCM data
+        void parseChunks(bool streaming);
+        // Parses fmt chunk of given size and returns number of bytes
+        // of the chunk consumed
+        uint64_t parseFormat(uint64_t size);
+        void mapData(const char* filepath);
     }; // class WavFile
     
 } // namespace mp3enc